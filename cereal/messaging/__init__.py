@@ -2,7 +2,7 @@
 from msgq.ipc_pyx import Context, Poller, SubSocket, PubSocket, SocketEventHandle, toggle_fake_events, \
                                 set_fake_prefix, get_fake_prefix, delete_fake_prefix, wait_for_one_event
 from msgq.ipc_pyx import MultiplePublishersError, IpcError
-from msgq import fake_event_handle, pub_sock, sub_sock, drain_sock_raw
+from msgq import fake_event_handle, sub_sock, drain_sock_raw
 import msgq
 
 import os
@@ -22,6 +22,12 @@ def reset_context():
   msgq.context = Context()
 
 
+def pub_sock(endpoint: str, segment_size: Optional[int] = None) -> PubSocket:
+  if segment_size is None:
+    segment_size = SERVICE_LIST[endpoint].segment_size if endpoint in SERVICE_LIST else 0
+  return msgq.pub_sock(endpoint, segment_size)
+
+
 def log_from_bytes(dat: bytes, struct: capnp.lib.capnp._StructModule = log.Event) -> capnp.lib.capnp._DynamicStructReader:
   with struct.from_bytes(dat, traversal_limit_in_words=NO_TRAVERSAL_LIMIT) as msg:
     return msg
@@ -0,0 +1,123 @@
+// Loopback benchmark of the msgq to zmq bridge. Publishes on a number of msgq services
+// at a fixed rate, runs MsgqToZmq in the same process and receives everything again
+// through zmq on 127.0.0.1. Reports throughput, end to end latency and lost messages.
+//
+// usage: msgq_to_zmq [num_services] [rate_hz] [seconds] [msg_size]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "cereal/messaging/msgq_to_zmq.h"
+#include "common/benchmarks/util.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+ExitHandler do_exit;
+
+struct BenchMsg {
+  uint64_t seq;
+  uint64_t sent_ns;
+};
+
+class BenchBridge : public MsgqToZmq {
+public:
+  using MsgqToZmq::printStats;
+};
+
+int main(int argc, char *argv[]) {
+  int num_services = argc > 1 ? atoi(argv[1]) : 10;
+  int rate_hz = argc > 2 ? atoi(argv[2]) : 1000;
+  int seconds = argc > 3 ? atoi(argv[3]) : 5;
+  size_t msg_size = std::max(argc > 4 ? (size_t)atol(argv[4]) : 256, sizeof(BenchMsg));
+
+  // Keep the queues away from a running openpilot
+  std::string prefix = "bridge_bench_" + std::to_string(getpid());
+  setenv("OPENPILOT_PREFIX", prefix.c_str(), 1);
+  std::filesystem::create_directory("/dev/shm/" + prefix);
+
+  std::vector<std::string> endpoints;
+  for (int i = 0; i < num_services; i++) endpoints.push_back("bridge_bench_" + std::to_string(i));
+
+  BenchBridge bridge;
+  std::thread bridge_thread([&]() { bridge.run(endpoints, "127.0.0.1"); });
+
+  MSGQContext msgq_context;
+  ZMQContext zmq_context;
+  std::vector<std::unique_ptr<MSGQPubSocket>> pubs;
+  std::vector<std::unique_ptr<ZMQSubSocket>> subs;
+  ZMQPoller poller;
+  for (auto &endpoint : endpoints) {
+    auto &pub = pubs.emplace_back(std::make_unique<MSGQPubSocket>());
+    pub->connect(&msgq_context, endpoint);
+    auto &sub = subs.emplace_back(std::make_unique<ZMQSubSocket>());
+    sub->connect(&zmq_context, endpoint, "127.0.0.1", false);
+    poller.registerSocket(sub.get());
+  }
+
+  // Wait until the bridge subscribed to every queue
+  for (auto &pub : pubs) {
+    while (*pub->q->num_readers == 0) util::sleep_for(10);
+  }
+  util::sleep_for(100);
+
+  std::atomic<bool> sending = true;
+  std::vector<double> latencies_us;
+  uint64_t received = 0;
+  std::thread recv_thread([&]() {
+    while (true) {
+      auto ready = poller.poll(100);
+      if (ready.empty() && !sending) break;
+
+      for (auto sub : ready) {
+        std::unique_ptr<Message> msg(sub->receive(true));
+        if (!msg) continue;
+        BenchMsg m = *(BenchMsg *)msg->getData();
+        latencies_us.push_back((nanos_since_boot() - m.sent_ns) / 1e3);
+        received++;
+      }
+    }
+  });
+
+  std::vector<char> data(msg_size);
+  uint64_t num_messages = (uint64_t)rate_hz * seconds;
+  uint64_t period_ns = 1000000000ULL / rate_hz;
+  uint64_t start = nanos_since_boot();
+  for (uint64_t seq = 0; seq < num_messages; seq++) {
+    uint64_t now = nanos_since_boot();
+    if (now < start + seq * period_ns) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(start + seq * period_ns - now));
+    }
+    for (auto &pub : pubs) {
+      BenchMsg m = {seq, nanos_since_boot()};
+      memcpy(data.data(), &m, sizeof(m));
+      pub->send(data.data(), data.size());
+    }
+  }
+  double elapsed = (nanos_since_boot() - start) / 1e9;
+  sending = false;
+  recv_thread.join();
+
+  do_exit = true;
+  bridge_thread.join();
+
+  uint64_t sent = num_messages * num_services;
+  printf("%d services at %d Hz, %zu byte messages\n", num_services, rate_hz, msg_size);
+  printf("sent %lu (%.0f msg/s), received %lu, lost %lu\n", sent, sent / elapsed, received, sent - std::min(sent, received));
+  printf("latency p50 %.1f us, p99 %.1f us, p999 %.1f us\n",
+         percentile(latencies_us, 0.5), percentile(latencies_us, 0.99), percentile(latencies_us, 0.999));
+  bridge.printStats();
+
+  pubs.clear();
+  std::filesystem::remove_all("/dev/shm/" + prefix);
+  return 0;
+}
@@ -0,0 +1,112 @@
+// Heap allocations and latency of building and sending a message with PubMaster:
+// through a flat array (the old send path), serialized straight into the queue, and
+// serialized into the queue from a builder backed by reusable scratch space.
+//
+// usage: pubmaster [iterations]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "cereal/messaging/messaging.h"
+
+// Count every allocation made by the process, capnp allocates segments with calloc
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+
+static uint64_t num_allocs = 0;
+
+void *malloc(size_t size) { num_allocs++; return __libc_malloc(size); }
+void *calloc(size_t n, size_t size) { num_allocs++; return __libc_calloc(n, size); }
+void *realloc(void *p, size_t size) { num_allocs++; return __libc_realloc(p, size); }
+}
+
+static uint64_t nanos_monotonic() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void build_car_state(MessageBuilder &msg, int i) {
+  auto cs = msg.initEvent().initCarState();
+  cs.setVEgo(i * 0.01);
+  cs.setAEgo(0.5);
+  cs.setSteeringAngleDeg(-2.5);
+}
+
+static void build_model(MessageBuilder &msg, int i) {
+  auto model = msg.initEvent().initModelV2();
+  model.setFrameId(i);
+  auto position = model.initPosition();
+  for (auto list : {position.initX(33), position.initY(33), position.initZ(33), position.initT(33)}) {
+    for (int j = 0; j < 33; j++) list.set(j, i + j);
+  }
+}
+
+enum class Path { FLAT_ARRAY, IN_PLACE, SCRATCH };
+
+static void run(PubMaster &pm, const char *name, void (*build)(MessageBuilder &, int), Path path, int iterations) {
+  std::vector<capnp::word> scratch(4096);
+  std::vector<double> latencies;
+  latencies.reserve(iterations);
+
+  uint64_t allocs_start = num_allocs;
+  for (int i = 0; i < iterations; i++) {
+    uint64_t start = nanos_monotonic();
+    if (path == Path::FLAT_ARRAY) {
+      MessageBuilder msg;
+      build(msg, i);
+      auto words = capnp::messageToFlatArray(msg);
+      auto bytes = words.asBytes();
+      pm.send(name, bytes.begin(), bytes.size());
+    } else if (path == Path::IN_PLACE) {
+      MessageBuilder msg;
+      build(msg, i);
+      pm.send(name, msg);
+    } else {
+      MessageBuilder msg(kj::arrayPtr(scratch.data(), scratch.size()));
+      build(msg, i);
+      pm.send(name, msg);
+    }
+    latencies.push_back(nanos_monotonic() - start);
+  }
+  double allocs = (double)(num_allocs - allocs_start) / iterations;
+
+  std::sort(latencies.begin(), latencies.end());
+  const char *path_name = path == Path::FLAT_ARRAY ? "flat array" : path == Path::IN_PLACE ? "in place" : "scratch";
+  printf("%-10s %-12s %12.1f %10.0f %10.0f %10.0f\n", name, path_name, allocs,
+         latencies[iterations / 2], latencies[iterations * 99 / 100], latencies.back());
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+  // Keep the queues away from a running openpilot
+  std::string prefix = "pubmaster_bench_" + std::to_string(getpid());
+  setenv("OPENPILOT_PREFIX", prefix.c_str(), 1);
+  std::filesystem::create_directory("/dev/shm/" + prefix);
+
+  {
+    PubMaster pm({"carState", "modelV2"});
+
+    printf("%d iterations\n", iterations);
+    printf("%-10s %-12s %12s %10s %10s %10s\n", "service", "path", "allocs/msg", "p50 ns", "p99 ns", "max ns");
+    for (Path path : {Path::FLAT_ARRAY, Path::IN_PLACE, Path::SCRATCH}) {
+      run(pm, "carState", build_car_state, path, iterations);
+    }
+    for (Path path : {Path::FLAT_ARRAY, Path::IN_PLACE, Path::SCRATCH}) {
+      run(pm, "modelV2", build_model, path, iterations);
+    }
+  }
+
+  std::filesystem::remove_all("/dev/shm/" + prefix);
+  return 0;
+}
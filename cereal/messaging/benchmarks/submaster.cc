@@ -0,0 +1,99 @@
+// Cost of a SubMaster update plus reading the state of every subscribed service,
+// looking services up by name compared to handles resolved once.
+//
+// usage: submaster [iterations]
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+
+static uint64_t nanos_monotonic() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+template <typename Update, typename Access>
+static double bench(int iterations, Update update, Access access) {
+  uint64_t sum = 0;
+  uint64_t start = nanos_monotonic();
+  for (int i = 0; i < iterations; i++) {
+    update();
+    sum += access();
+  }
+  double ns = (double)(nanos_monotonic() - start) / iterations;
+
+  // Keep the accesses from being optimized out
+  if (sum == 42) printf(" ");
+  return ns;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+  // Keep the queues away from a running openpilot
+  std::string prefix = "submaster_bench_" + std::to_string(getpid());
+  setenv("OPENPILOT_PREFIX", prefix.c_str(), 1);
+  std::filesystem::create_directory("/dev/shm/" + prefix);
+
+  std::vector<const char *> all_services;
+  for (const auto &[name, _] : services) all_services.push_back(name.c_str());
+
+  // One serialized message per service, fed in through update_msgs
+  std::vector<kj::Array<capnp::word>> buffers;
+  std::vector<std::unique_ptr<capnp::FlatArrayMessageReader>> readers;
+  for (size_t i = 0; i < all_services.size(); i++) {
+    MessageBuilder msg;
+    msg.initEvent();
+    buffers.push_back(capnp::messageToFlatArray(msg));
+    readers.push_back(std::make_unique<capnp::FlatArrayMessageReader>(buffers.back()));
+  }
+
+  printf("%d iterations, ns per iteration\n", iterations);
+  printf("%8s %14s %14s %18s %18s\n", "services", "update name", "update handle", "update_msgs name", "update_msgs handle");
+  for (size_t n : {5, 20, 60}) {
+    std::vector<const char *> names(all_services.begin(), all_services.begin() + n);
+    SubMaster sm(names);
+
+    std::vector<SubMaster::Handle> handles;
+    for (auto name : names) handles.push_back(sm.handle(name));
+
+    std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
+    for (size_t i = 0; i < n; i++) {
+      messages.push_back({names[i], readers[i]->getRoot<cereal::Event>()});
+    }
+
+    auto access_by_name = [&]() {
+      uint64_t sum = 0;
+      for (auto name : names) {
+        sum += sm.updated(name) + sm.alive(name) + sm.valid(name) + sm.rcv_frame(name) + sm[name].getLogMonoTime();
+      }
+      return sum;
+    };
+    auto access_by_handle = [&]() {
+      uint64_t sum = 0;
+      for (auto h : handles) {
+        sum += sm.updated(h) + sm.alive(h) + sm.valid(h) + sm.rcv_frame(h) + sm[h].getLogMonoTime();
+      }
+      return sum;
+    };
+    auto update = [&]() { sm.update(0); };
+    auto update_msgs = [&]() { sm.update_msgs(nanos_since_boot(), messages); };
+
+    printf("%8zu %14.0f %14.0f %18.0f %18.0f\n", n,
+           bench(iterations, update, access_by_name), bench(iterations, update, access_by_handle),
+           bench(iterations, update_msgs, access_by_name), bench(iterations, update_msgs, access_by_handle));
+  }
+
+  std::filesystem::remove_all("/dev/shm/" + prefix);
+  return 0;
+}
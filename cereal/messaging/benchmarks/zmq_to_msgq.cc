@@ -0,0 +1,169 @@
+// Loopback benchmark of the zmq to msgq bridge. Publishes on a number of services
+// through zmq on 127.0.0.1, forwards them into msgq in the same process and reads
+// them back from msgq. Compares ZmqToMsgq against the previous forwarding loop, which
+// copied every message into a heap allocated Message first.
+//
+// usage: zmq_to_msgq [num_services] [total_rate_hz] [seconds] [msg_size]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "cereal/messaging/zmq_to_msgq.h"
+#include "cereal/services.h"
+#include "common/benchmarks/util.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+ExitHandler do_exit;
+
+struct BenchMsg {
+  uint64_t seq;
+  uint64_t sent_ns;
+};
+
+static uint64_t thread_cpu_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// The forwarding loop ZmqToMsgq replaced
+static void copy_bridge(const std::vector<std::string> &endpoints, const std::string &ip) {
+  auto poller = std::make_unique<ZMQPoller>();
+  auto pub_context = std::make_unique<MSGQContext>();
+  auto sub_context = std::make_unique<ZMQContext>();
+  std::map<SubSocket *, PubSocket *> sub2pub;
+
+  for (auto endpoint : endpoints) {
+    auto pub_sock = new MSGQPubSocket();
+    auto sub_sock = new ZMQSubSocket();
+    pub_sock->connect(pub_context.get(), endpoint, true, services.at(endpoint).segment_size);
+    sub_sock->connect(sub_context.get(), endpoint, ip, false);
+
+    poller->registerSocket(sub_sock);
+    sub2pub[sub_sock] = pub_sock;
+  }
+
+  while (!do_exit) {
+    for (auto sub_sock : poller->poll(100)) {
+      std::unique_ptr<Message> msg(sub_sock->receive(true));
+      if (msg) {
+        sub2pub[sub_sock]->sendMessage(msg.get());
+      }
+    }
+  }
+
+  for (auto &[sub_sock, pub_sock] : sub2pub) {
+    delete sub_sock;
+    delete pub_sock;
+  }
+}
+
+static void run(const char *name, std::function<void()> bridge_fn, const std::vector<std::string> &endpoints,
+                int rate_hz, int seconds, size_t msg_size) {
+  do_exit = false;
+  uint64_t bridge_cpu_ns = 0;
+  std::thread bridge_thread([&]() {
+    uint64_t cpu_start = thread_cpu_ns();
+    bridge_fn();
+    bridge_cpu_ns = thread_cpu_ns() - cpu_start;
+  });
+
+  ZMQContext zmq_context;
+  MSGQContext msgq_context;
+  std::vector<std::unique_ptr<ZMQPubSocket>> pubs;
+  std::vector<std::unique_ptr<MSGQSubSocket>> subs;
+  MSGQPoller poller;
+  for (auto &endpoint : endpoints) {
+    auto &pub = pubs.emplace_back(std::make_unique<ZMQPubSocket>());
+    pub->connect(&zmq_context, endpoint);
+    auto &sub = subs.emplace_back(std::make_unique<MSGQSubSocket>());
+    sub->connect(&msgq_context, endpoint, "127.0.0.1");
+    poller.registerSocket(sub.get());
+  }
+
+  // zmq drops everything until the bridge is connected
+  util::sleep_for(1000);
+
+  std::atomic<bool> sending = true;
+  std::vector<double> latencies_us;
+  std::thread recv_thread([&]() {
+    while (true) {
+      auto ready = poller.poll(100);
+      if (ready.empty() && !sending) break;
+
+      for (auto sub : ready) {
+        while (true) {
+          std::unique_ptr<Message> msg(sub->receive(true));
+          if (!msg) break;
+          BenchMsg m = *(BenchMsg *)msg->getData();
+          latencies_us.push_back((nanos_since_boot() - m.sent_ns) / 1e3);
+        }
+      }
+    }
+  });
+
+  std::vector<char> data(msg_size);
+  uint64_t num_messages = (uint64_t)rate_hz * seconds;
+  uint64_t period_ns = 1000000000ULL / rate_hz;
+  uint64_t start = nanos_since_boot();
+  for (uint64_t seq = 0; seq < num_messages; seq++) {
+    uint64_t now = nanos_since_boot();
+    if (now < start + seq * period_ns) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(start + seq * period_ns - now));
+    }
+    BenchMsg m = {seq, nanos_since_boot()};
+    memcpy(data.data(), &m, sizeof(m));
+    pubs[seq % pubs.size()]->send(data.data(), data.size());
+  }
+  util::sleep_for(200);
+  sending = false;
+  recv_thread.join();
+
+  do_exit = true;
+  bridge_thread.join();
+
+  size_t received = latencies_us.size();
+  printf("%-6s %10lu %10zu %12.0f %10.1f %10.1f %10.1f\n", name, num_messages, received,
+         received ? (double)bridge_cpu_ns / received : 0.0,
+         percentile(latencies_us, 0.5), percentile(latencies_us, 0.99), percentile(latencies_us, 0.999));
+}
+
+int main(int argc, char *argv[]) {
+  size_t num_services = argc > 1 ? atoi(argv[1]) : 20;
+  int rate_hz = argc > 2 ? atoi(argv[2]) : 10000;
+  int seconds = argc > 3 ? atoi(argv[3]) : 5;
+  size_t msg_size = std::max(argc > 4 ? (size_t)atol(argv[4]) : 1024, sizeof(BenchMsg));
+
+  // Keep the queues away from a running openpilot
+  std::string prefix = "bridge_bench_" + std::to_string(getpid());
+  setenv("OPENPILOT_PREFIX", prefix.c_str(), 1);
+  std::filesystem::create_directory("/dev/shm/" + prefix);
+
+  std::vector<std::string> endpoints;
+  for (const auto &[name, _] : services) {
+    if (endpoints.size() == num_services) break;
+    endpoints.push_back(name);
+  }
+
+  printf("%zu services, %d msg/s in total, %zu byte messages\n", endpoints.size(), rate_hz, msg_size);
+  printf("%-6s %10s %10s %12s %10s %10s %10s\n", "", "sent", "received", "bridge ns/msg", "p50 us", "p99 us", "p999 us");
+  run("copy", [&]() { copy_bridge(endpoints, "127.0.0.1"); }, endpoints, rate_hz, seconds, msg_size);
+  run("view", [&]() { ZmqToMsgq().run(endpoints, "127.0.0.1"); }, endpoints, rate_hz, seconds, msg_size);
+
+  std::filesystem::remove_all("/dev/shm/" + prefix);
+  return 0;
+}
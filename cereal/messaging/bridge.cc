@@ -1,17 +1,33 @@
+#include <algorithm>
 #include <cassert>
+#include <sstream>
+#include <unordered_set>
 
 #include "cereal/messaging/msgq_to_zmq.h"
+#include "cereal/messaging/zmq_to_msgq.h"
 #include "cereal/services.h"
 #include "common/util.h"
 
 ExitHandler do_exit;
 
 static std::vector<std::string> get_services(const std::string &whitelist_str, bool zmq_to_msgq) {
+  // Whitelist is a comma separated list of service names
+  std::unordered_set<std::string> whitelist;
+  std::stringstream ss(whitelist_str);
+  for (std::string name; std::getline(ss, name, ',');) {
+    name.erase(std::remove_if(name.begin(), name.end(), ::isspace), name.end());
+    if (name.empty()) continue;
+    if (services.count(name) == 0) {
+      printf("Unknown service in whitelist: %s\n", name.c_str());
+      continue;
+    }
+    whitelist.insert(name);
+  }
+
   std::vector<std::string> service_list;
   for (const auto& it : services) {
     std::string name = it.second.name;
-    bool in_whitelist = whitelist_str.find(name) != std::string::npos;
-    if (zmq_to_msgq && !in_whitelist) {
+    if (zmq_to_msgq && whitelist.count(name) == 0) {
       continue;
     }
     service_list.push_back(name);
@@ -25,35 +41,8 @@ void msgq_to_zmq(const std::vector<std::string> &endpoints, const std::string &i
 }
 
 void zmq_to_msgq(const std::vector<std::string> &endpoints, const std::string &ip) {
-  auto poller = std::make_unique<ZMQPoller>();
-  auto pub_context = std::make_unique<MSGQContext>();
-  auto sub_context = std::make_unique<ZMQContext>();
-  std::map<SubSocket *, PubSocket *> sub2pub;
-
-  for (auto endpoint : endpoints) {
-    auto pub_sock = new MSGQPubSocket();
-    auto sub_sock = new ZMQSubSocket();
-    pub_sock->connect(pub_context.get(), endpoint);
-    sub_sock->connect(sub_context.get(), endpoint, ip, false);
-
-    poller->registerSocket(sub_sock);
-    sub2pub[sub_sock] = pub_sock;
-  }
-
-  while (!do_exit) {
-    for (auto sub_sock : poller->poll(100)) {
-      std::unique_ptr<Message> msg(sub_sock->receive(true));
-      if (msg) {
-        sub2pub[sub_sock]->sendMessage(msg.get());
-      }
-    }
-  }
-
-  // Clean up allocated sockets
-  for (auto &[sub_sock, pub_sock] : sub2pub) {
-    delete sub_sock;
-    delete pub_sock;
-  }
+  ZmqToMsgq bridge;
+  bridge.run(endpoints, ip);
 }
 
 int main(int argc, char **argv) {
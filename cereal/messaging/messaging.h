@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 
@@ -14,6 +15,11 @@
 
 class SubMaster {
 public:
+  // Index of a subscribed service, resolve once with handle() to skip the name lookup on every access
+  struct Handle {
+    int idx = -1;
+  };
+
   SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll = {},
             const char *address = nullptr, const std::vector<const char *> &ignore_alive = {});
   void update(int timeout = 1000);
@@ -32,17 +38,32 @@ public:
   uint64_t rcv_time(const char *name) const;
   cereal::Event::Reader &operator[](const char *name) const;
 
+  // Throws std::out_of_range for a service that isn't subscribed, like the name based accessors
+  Handle handle(const char *name) const;
+  bool updated(Handle h) const;
+  bool alive(Handle h) const;
+  bool valid(Handle h) const;
+  uint64_t rcv_frame(Handle h) const;
+  uint64_t rcv_time(Handle h) const;
+  cereal::Event::Reader &operator[](Handle h) const;
+
 private:
+  struct SubMessage;
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
+  void update_msg_(SubMessage *m, uint64_t current_time, const cereal::Event::Reader &event);
+  void update_alive_(uint64_t current_time);
   Poller *poller_ = nullptr;
-  struct SubMessage;
-  std::map<SubSocket *, SubMessage *> messages_;
+  std::vector<SubMessage *> messages_;
+  std::unordered_map<SubSocket *, SubMessage *> sockets_;
   std::map<std::string, SubMessage *> services_;
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // Builds into caller owned scratch space instead of allocating segments, as long as the message fits.
+  // The scratch must be zeroed, the builder zeroes it again when destroyed so it can be reused right away.
+  MessageBuilder(kj::ArrayPtr<capnp::word> scratch) : capnp::MallocMessageBuilder(scratch) {}
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -77,6 +98,8 @@ public:
   PubMaster(const std::vector<const char *> &service_list);
   inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
   int send(const char *name, MessageBuilder &msg);
+  // True once every live subscriber of name has read every message sent on it, false without subscribers
+  inline bool allReadersUpdated(const char *name) { return sockets_.at(name)->all_readers_updated(); }
   ~PubMaster();
 
 private:
@@ -1,13 +1,17 @@
 #include "cereal/messaging/msgq_to_zmq.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
+#include "common/timing.h"
 #include "common/util.h"
 
 extern ExitHandler do_exit;
 
-// Max messages to process per socket per poll
+// Max messages to process per socket per poll, so one busy service can't starve the others
 constexpr int MAX_MESSAGES_PER_SOCKET = 50;
+constexpr uint64_t STATS_INTERVAL_NS = 10000000000ULL;
 
 static std::string recv_zmq_msg(void *sock) {
   zmq_msg_t msg;
@@ -39,32 +43,90 @@ void MsgqToZmq::run(const std::vector<std::string> &endpoints, const std::string
   // Start ZMQ monitoring thread to monitor socket events
   std::thread thread(&MsgqToZmq::zmqMonitorThread, this);
 
-  // Main loop for processing messages
+  // Main loop for processing messages, woken up by msgq as soon as anything is published
+  uint64_t last_stats = nanos_since_boot();
   while (!do_exit) {
-    {
+    if (sockets_changed.exchange(false)) {
       std::unique_lock lk(mutex);
-      cv.wait(lk, [this]() { return do_exit || !sub2pub.empty(); });
-      if (do_exit) break;
-
-      for (auto sub_sock : msgq_poller->poll(100)) {
-        // Process messages for each socket
-        ZMQPubSocket *pub_sock = sub2pub.at(sub_sock);
-        for (int i = 0; i < MAX_MESSAGES_PER_SOCKET; ++i) {
-          auto msg = std::unique_ptr<Message>(sub_sock->receive(true));
-          if (!msg) break;
-
-          while (pub_sock->sendMessage(msg.get()) == -1) {
-            if (errno != EINTR) break;
-          }
-        }
-      }
+      updateSockets();
+    }
+
+    if (sub2pair.empty()) {
+      std::unique_lock lk(mutex);
+      cv.wait(lk, [this]() { return do_exit || sockets_changed; });
+      continue;
+    }
+
+    for (auto sub_sock : msgq_poller->poll(100)) {
+      forward(sub2pair.at(sub_sock));
+    }
+
+    if (nanos_since_boot() - last_stats > STATS_INTERVAL_NS) {
+      printStats();
+      last_stats = nanos_since_boot();
     }
-    util::sleep_for(1);  // Give zmqMonitorThread a chance to acquire the mutex
   }
 
   thread.join();
 }
 
+void MsgqToZmq::forward(SocketPair *pair) {
+  uint64_t start = nanos_since_boot();
+  msgq_queue_t *q = pair->sub_sock->q;
+  Stats &stats = pair->stats;
+
+  if (*q->read_valids[q->reader_id]) {
+    uint32_t read_cycles, read_pointer, write_cycles, write_pointer;
+    UNPACK64(read_cycles, read_pointer, *q->read_pointers[q->reader_id]);
+    UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+    stats.max_backlog = std::max(stats.max_backlog, (uint64_t)(write_cycles - read_cycles) * q->size + write_pointer - read_pointer);
+  }
+
+  uint64_t num_resets = q->num_resets;
+  for (int i = 0; i < MAX_MESSAGES_PER_SOCKET; ++i) {
+    // Copy straight from the msgq buffer into the zmq message
+    MessageView *view = pair->sub_sock->receive_view(true);
+    if (!view) break;
+
+    zmq_msg_t msg;
+    zmq_msg_init_size(&msg, view->getSize());
+    memcpy(zmq_msg_data(&msg), view->getData(), view->getSize());
+    bool valid = view->valid();
+    view->release();
+    if (!valid) {
+      // Overwritten while it was copied, the next receive resets the reader and counts it below
+      zmq_msg_close(&msg);
+      continue;
+    }
+
+    // A PUB socket drops messages for subscribers whose queue is full without an error,
+    // those drops only show up on the receiving side
+    size_t size = zmq_msg_size(&msg);
+    int ret;
+    while ((ret = zmq_msg_send(&msg, pair->pub_sock->sock, ZMQ_DONTWAIT)) == -1 && errno == EINTR) {}
+    if (ret == -1) {
+      zmq_msg_close(&msg);
+    } else {
+      stats.forwarded++;
+      stats.bytes += size;
+    }
+  }
+  stats.msgq_drops += q->num_resets - num_resets;
+  stats.max_forward_ns = std::max(stats.max_forward_ns, nanos_since_boot() - start);
+}
+
+void MsgqToZmq::printStats() {
+  for (auto &pair : socket_pairs) {
+    Stats &s = pair.stats;
+    if (!pair.sub_sock && s.forwarded == 0) continue;
+
+    printf("[%s] forwarded %lu msgs (%lu kB), dropped %lu in msgq, max backlog %lu B, max forward time %.2f ms\n",
+           pair.endpoint.c_str(), s.forwarded, s.bytes / 1024, s.msgq_drops, s.max_backlog, s.max_forward_ns / 1e6);
+    s.max_backlog = 0;
+    s.max_forward_ns = 0;
+  }
+}
+
 void MsgqToZmq::zmqMonitorThread() {
   std::vector<zmq_pollitem_t> pollitems;
 
@@ -101,26 +163,17 @@ void MsgqToZmq::zmqMonitorThread() {
         frame = recv_zmq_msg(pollitems[i].socket);
         if (frame.empty()) continue;
 
+        // The forwarding loop creates and removes the MSGQ subscribers
         std::unique_lock lk(mutex);
         auto &pair = socket_pairs[i];
         if (event_type & ZMQ_EVENT_ACCEPTED) {
           printf("socket [%s] connected\n", pair.endpoint.c_str());
-          if (++pair.connected_clients == 1) {
-            // Create new MSGQ subscriber socket and map to ZMQ publisher
-            pair.sub_sock = std::make_unique<MSGQSubSocket>();
-            pair.sub_sock->connect(msgq_context.get(), pair.endpoint, "127.0.0.1");
-            sub2pub[pair.sub_sock.get()] = pair.pub_sock.get();
-            registerSockets();
-          }
+          pair.connected_clients++;
         } else if (event_type & ZMQ_EVENT_DISCONNECTED) {
           printf("socket [%s] disconnected\n", pair.endpoint.c_str());
-          if (pair.connected_clients == 0 || --pair.connected_clients == 0) {
-            // Remove MSGQ subscriber socket from mapping and reset it
-            sub2pub.erase(pair.sub_sock.get());
-            pair.sub_sock.reset(nullptr);
-            registerSockets();
-          }
+          pair.connected_clients = std::max(pair.connected_clients - 1, 0);
         }
+        sockets_changed = true;
         cv.notify_one();
       }
     }
@@ -134,11 +187,22 @@ void MsgqToZmq::zmqMonitorThread() {
   cv.notify_one();
 }
 
-void MsgqToZmq::registerSockets() {
+void MsgqToZmq::updateSockets() {
+  for (auto &pair : socket_pairs) {
+    if (pair.connected_clients > 0 && !pair.sub_sock) {
+      pair.sub_sock = std::make_unique<MSGQSubSocket>();
+      pair.sub_sock->connect(msgq_context.get(), pair.endpoint, "127.0.0.1");
+    } else if (pair.connected_clients == 0 && pair.sub_sock) {
+      pair.sub_sock.reset(nullptr);
+    }
+  }
+
   msgq_poller = std::make_unique<MSGQPoller>();
-  for (const auto &socket_pair : socket_pairs) {
-    if (socket_pair.sub_sock) {
-      msgq_poller->registerSocket(socket_pair.sub_sock.get());
+  sub2pair.clear();
+  for (auto &pair : socket_pairs) {
+    if (pair.sub_sock) {
+      msgq_poller->registerSocket(pair.sub_sock.get());
+      sub2pair[pair.sub_sock.get()] = &pair;
     }
   }
 }
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #define private public
@@ -17,21 +19,38 @@ public:
   void run(const std::vector<std::string> &endpoints, const std::string &ip);
 
 protected:
-  void registerSockets();
-  void zmqMonitorThread();
+  struct Stats {
+    uint64_t forwarded = 0;
+    uint64_t bytes = 0;
+    uint64_t msgq_drops = 0;      // overwritten in msgq before the bridge read them
+    uint64_t max_backlog = 0;     // bytes waiting in msgq when the bridge woke up
+    uint64_t max_forward_ns = 0;  // time spent forwarding after one wakeup
+  };
 
   struct SocketPair {
     std::string endpoint;
     std::unique_ptr<ZMQPubSocket> pub_sock;
     std::unique_ptr<MSGQSubSocket> sub_sock;
     int connected_clients = 0;
+    Stats stats;
   };
 
+  void updateSockets();
+  void forward(SocketPair *pair);
+  void printStats();
+  void zmqMonitorThread();
+
   std::unique_ptr<MSGQContext> msgq_context;
   std::unique_ptr<ZMQContext> zmq_context;
+
+  // Guards connected_clients, which the monitor thread updates. The forwarding loop
+  // only takes it when sockets_changed is set or while there is nothing to forward.
   std::mutex mutex;
   std::condition_variable cv;
+  std::atomic<bool> sockets_changed = false;
+
+  // Only used by the forwarding loop
   std::unique_ptr<MSGQPoller> msgq_poller;
-  std::map<SubSocket *, ZMQPubSocket *> sub2pub;
+  std::unordered_map<SubSocket *, SocketPair *> sub2pair;
   std::vector<SocketPair> socket_pairs;
 };
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string>
 #include <mutex>
+#include <stdexcept>
 
 #include "cereal/services.h"
 #include "cereal/messaging/messaging.h"
@@ -62,42 +63,40 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::v
       .allocated_msg_reader = malloc(sizeof(capnp::FlatArrayMessageReader)),
       .is_polled = is_polled};
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
-    messages_[socket] = m;
+    messages_.push_back(m);
+    sockets_[socket] = m;
     services_[name] = m;
   }
 }
 
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  for (auto m : messages_) m->updated = false;
 
   auto sockets = poller_->poll(timeout);
 
   // add non-polled sockets for non-blocking receive
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
-    SubSocket *s = kv.first;
-    if (!m->is_polled) sockets.push_back(s);
+  for (auto m : messages_) {
+    if (!m->is_polled) sockets.push_back(m->socket);
   }
 
   uint64_t current_time = nanos_since_boot();
-
-  std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
+  if (++frame == UINT64_MAX) frame = 1;
 
   for (auto s : sockets) {
     Message *msg = s->receive(true);
     if (msg == nullptr) continue;
 
-    SubMessage *m = messages_.at(s);
+    SubMessage *m = sockets_.at(s);
 
     m->msg_reader->~FlatArrayMessageReader();
     capnp::ReaderOptions options;
     options.traversalLimitInWords = kj::maxValue; // Don't limit
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
     delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+    update_msg_(m, current_time, m->msg_reader->getRoot<cereal::Event>());
   }
 
-  update_msgs(current_time, messages);
+  update_alive_(current_time);
 }
 
 void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages){
@@ -108,18 +107,24 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
     if (m_find == services_.end()){
       continue;
     }
-    SubMessage *m = m_find->second;
-    m->event = kv.second;
-    m->updated = true;
-    m->rcv_time = current_time;
-    m->rcv_frame = frame;
-    m->valid = m->event.getValid();
-    if (SIMULATION) m->alive = true;
+    update_msg_(m_find->second, current_time, kv.second);
   }
 
+  update_alive_(current_time);
+}
+
+void SubMaster::update_msg_(SubMessage *m, uint64_t current_time, const cereal::Event::Reader &event) {
+  m->event = event;
+  m->updated = true;
+  m->rcv_time = current_time;
+  m->rcv_frame = frame;
+  m->valid = m->event.getValid();
+  if (SIMULATION) m->alive = true;
+}
+
+void SubMaster::update_alive_(uint64_t current_time) {
   if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
+    for (auto m : messages_) {
       m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
     }
   }
@@ -127,8 +132,7 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
 
 bool SubMaster::all_(const std::vector<const char *> &service_list, bool valid, bool alive) {
   int found = 0;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     if (service_list.size() == 0 || inList(service_list, m->name.c_str())) {
       found += (!valid || m->valid) && (!alive || (m->alive || m->ignore_alive));
     }
@@ -173,10 +177,40 @@ cereal::Event::Reader &SubMaster::operator[](const char *name) const {
   return services_.at(name)->event;
 }
 
+SubMaster::Handle SubMaster::handle(const char *name) const {
+  for (int i = 0; i < messages_.size(); i++) {
+    if (messages_[i]->name == name) return {i};
+  }
+  throw std::out_of_range(std::string("SubMaster: not subscribed to ") + name);
+}
+
+bool SubMaster::updated(Handle h) const {
+  return messages_[h.idx]->updated;
+}
+
+bool SubMaster::alive(Handle h) const {
+  return messages_[h.idx]->alive;
+}
+
+bool SubMaster::valid(Handle h) const {
+  return messages_[h.idx]->valid;
+}
+
+uint64_t SubMaster::rcv_frame(Handle h) const {
+  return messages_[h.idx]->rcv_frame;
+}
+
+uint64_t SubMaster::rcv_time(Handle h) const {
+  return messages_[h.idx]->rcv_time;
+}
+
+cereal::Event::Reader &SubMaster::operator[](Handle h) const {
+  return messages_[h.idx]->event;
+}
+
 SubMaster::~SubMaster() {
   delete poller_;
-  for (auto &kv : messages_) {
-    SubMessage *m = kv.second;
+  for (auto m : messages_) {
     m->msg_reader->~FlatArrayMessageReader();
     free(m->allocated_msg_reader);
     delete m->socket;
@@ -187,15 +221,22 @@ SubMaster::~SubMaster() {
 PubMaster::PubMaster(const std::vector<const char *> &service_list) {
   for (auto name : service_list) {
     assert(services.count(name) > 0);
-    PubSocket *socket = PubSocket::create(message_context.context(), name);
+    PubSocket *socket = PubSocket::create(message_context.context(), name, true, services.at(name).segment_size);
     assert(socket);
     sockets_[name] = socket;
   }
 }
 
 int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+  // Serialize straight into the queue instead of going through a flat array
+  PubSocket *socket = sockets_.at(name);
+  size_t size = msg.getSerializedSize();
+  char *buf = socket->reserve(size);
+  if (buf == nullptr) return -1;
+
+  kj::ArrayOutputStream out(kj::arrayPtr((capnp::byte *)buf, size));
+  capnp::writeMessage(out, msg);
+  return socket->commit();
 }
 
 PubMaster::~PubMaster() {
@@ -14,6 +14,7 @@ class TestServices:
     service = SERVICE_LIST[s]
     assert service.frequency <= 104
     assert service.decimation != 0
+    assert 0 < service.segment_size < 2**32
 
   def test_generated_header(self):
     with tempfile.NamedTemporaryFile(suffix=".h") as f:
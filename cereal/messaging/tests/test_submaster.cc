@@ -0,0 +1,22 @@
+#include <stdexcept>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+
+TEST_CASE("SubMaster::handle") {
+  SubMaster sm({"carState", "controlsState"});
+
+  SECTION("subscribed services") {
+    auto car_state = sm.handle("carState");
+    auto controls_state = sm.handle("controlsState");
+    REQUIRE(car_state.idx != controls_state.idx);
+    REQUIRE(sm.updated(car_state) == sm.updated("carState"));
+    REQUIRE(sm.rcv_frame(controls_state) == sm.rcv_frame("controlsState"));
+    REQUIRE(&sm[car_state] == &sm["carState"]);
+  }
+
+  SECTION("unknown service throws") {
+    REQUIRE_THROWS_AS(sm.handle("modelV2"), std::out_of_range);
+    REQUIRE_THROWS_AS(sm["modelV2"], std::out_of_range);
+  }
+}
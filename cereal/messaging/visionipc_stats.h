@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "cereal/messaging/messaging.h"
+#include "msgq/visionipc/visionipc_server.h"
+
+// Publishes the stats reported by VisionIpcServer::set_stats_callback as visionipcStats
+inline void publish_visionipc_stats(PubMaster &pm, const std::string &name, const std::map<VisionStreamType, VisionIpcStats> &stats) {
+  MessageBuilder msg;
+  auto vipc_stats = msg.initEvent().initVisionipcStats();
+  vipc_stats.setName(name);
+
+  auto streams = vipc_stats.initStreams(stats.size());
+  int i = 0;
+  for (const auto &[type, s] : stats) {
+    auto stream = streams[i++];
+    stream.setStreamType(static_cast<cereal::VisionIpcStats::StreamType>(type));
+    stream.setNumSent(s.num_sent);
+    stream.setNumStalls(s.num_stalls);
+    stream.setNumDrops(s.num_drops);
+    stream.setNumOverwrites(s.num_overwrites);
+    stream.setSyncTimeTotal(s.total_sync_ns / 1e6);
+    stream.setSyncTimeMax(s.max_sync_ns / 1e6);
+
+    auto clients = stream.initClients(s.clients.size());
+    for (int j = 0; j < s.clients.size(); j++) {
+      const VisionIpcClientStats &c = s.clients[j];
+      auto client = clients[j];
+      client.setPid(c.pid);
+      client.setName(c.name);
+      client.setNumFrames(c.num_frames);
+      client.setNumSkipped(c.num_skipped);
+      client.setNumDropped(c.num_dropped);
+      client.setNumReplaced(c.num_replaced);
+      client.setSyncTimeTotal(c.total_sync_ns / 1e6);
+      client.setSyncTimeMax(c.max_sync_ns / 1e6);
+      client.setHoldTimeTotal(c.total_hold_ns / 1e6);
+      client.setHoldTimeMax(c.max_hold_ns / 1e6);
+      client.setLatencyHistogram(kj::ArrayPtr<const uint64_t>(c.latency_hist.data(), c.latency_hist.size()));
+    }
+  }
+  pm.send("visionipcStats", msg);
+}
@@ -0,0 +1,33 @@
+#include "cereal/messaging/zmq_to_msgq.h"
+
+#include "cereal/services.h"
+#include "common/util.h"
+
+extern ExitHandler do_exit;
+
+void ZmqToMsgq::run(const std::vector<std::string> &endpoints, const std::string &ip) {
+  zmq_context = std::make_unique<ZMQContext>();
+  msgq_context = std::make_unique<MSGQContext>();
+  poller = std::make_unique<ZMQPoller>();
+
+  for (const auto &endpoint : endpoints) {
+    auto &socket_pair = socket_pairs.emplace_back();
+    socket_pair.pub_sock = std::make_unique<MSGQPubSocket>();
+    socket_pair.sub_sock = std::make_unique<ZMQSubSocket>();
+    socket_pair.pub_sock->connect(msgq_context.get(), endpoint, true, services.at(endpoint).segment_size);
+    socket_pair.sub_sock->connect(zmq_context.get(), endpoint, ip, false);
+
+    poller->registerSocket(socket_pair.sub_sock.get());
+    sub2pub[socket_pair.sub_sock.get()] = socket_pair.pub_sock.get();
+  }
+
+  while (!do_exit) {
+    for (auto sub_sock : poller->poll(100)) {
+      // Copy everything that is queued straight from the zmq message into the msgq buffer
+      MSGQPubSocket *pub_sock = sub2pub.at(sub_sock);
+      while (MessageView *view = sub_sock->receive_view(true)) {
+        pub_sock->send((char *)view->getData(), view->getSize());
+      }
+    }
+  }
+}
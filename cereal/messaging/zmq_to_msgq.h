@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "msgq/impl_msgq.h"
+#include "msgq/impl_zmq.h"
+
+class ZmqToMsgq {
+public:
+  ZmqToMsgq() {}
+  void run(const std::vector<std::string> &endpoints, const std::string &ip);
+
+protected:
+  struct SocketPair {
+    std::unique_ptr<ZMQSubSocket> sub_sock;
+    std::unique_ptr<MSGQPubSocket> pub_sock;
+  };
+
+  std::unique_ptr<ZMQContext> zmq_context;
+  std::unique_ptr<MSGQContext> msgq_context;
+  std::unique_ptr<ZMQPoller> poller;
+  std::unordered_map<SubSocket *, MSGQPubSocket *> sub2pub;
+  std::vector<SocketPair> socket_pairs;
+};
@@ -2,15 +2,26 @@
 from typing import Optional
 
 
+MB = 1024 * 1024
+
+# msgq segment size, has to fit at least three of the largest messages.
+# check the actual usage with selfdrive/debug/msgq_occupancy.py
+DEFAULT_SEGMENT_SIZE = 10 * MB
+SMALL_SEGMENT_SIZE = 1 * MB
+LARGE_SEGMENT_SIZE = 20 * MB
+
+
 class Service:
-  def __init__(self, should_log: bool, frequency: float, decimation: Optional[int] = None):
+  def __init__(self, should_log: bool, frequency: float, decimation: Optional[int] = None,
+               segment_size: int = DEFAULT_SEGMENT_SIZE):
     self.should_log = should_log
     self.frequency = frequency
     self.decimation = decimation
+    self.segment_size = segment_size
 
 
 _services: dict[str, tuple] = {
-  # service: (should_log, frequency, qlog decimation (optional))
+  # service: (should_log, frequency, qlog decimation (optional), msgq segment size (optional))
   # note: the "EncodeIdx" packets will still be in the log
   "gyroscope": (True, 104., 104),
   "gyroscope2": (True, 100., 100),
@@ -18,25 +29,25 @@ _services: dict[str, tuple] = {
   "accelerometer2": (True, 100., 100),
   "magnetometer": (True, 25.),
   "lightSensor": (True, 100., 100),
-  "temperatureSensor": (True, 2., 200),
-  "temperatureSensor2": (True, 2., 200),
+  "temperatureSensor": (True, 2., 200, SMALL_SEGMENT_SIZE),
+  "temperatureSensor2": (True, 2., 200, SMALL_SEGMENT_SIZE),
   "gpsNMEA": (True, 9.),
-  "deviceState": (True, 2., 1),
+  "deviceState": (True, 2., 1, SMALL_SEGMENT_SIZE),
   "touch": (True, 20., 1),
-  "can": (True, 100., 2053),  # decimation gives ~3 msgs in a full segment
+  "can": (True, 100., 2053, LARGE_SEGMENT_SIZE),  # decimation gives ~3 msgs in a full segment
   "controlsState": (True, 100., 10),
   "selfdriveState": (True, 100., 10),
   "pandaStates": (True, 10., 1),
-  "peripheralState": (True, 2., 1),
+  "peripheralState": (True, 2., 1, SMALL_SEGMENT_SIZE),
   "radarState": (True, 20., 5),
   "roadEncodeIdx": (False, 20., 1),
   "liveTracks": (True, 20.),
-  "sendcan": (True, 100., 139),
+  "sendcan": (True, 100., 139, LARGE_SEGMENT_SIZE),
   "logMessage": (True, 0.),
   "errorLogMessage": (True, 0., 1),
-  "liveCalibration": (True, 4., 4),
-  "liveTorqueParameters": (True, 4., 1),
-  "liveDelay": (True, 4., 1),
+  "liveCalibration": (True, 4., 4, SMALL_SEGMENT_SIZE),
+  "liveTorqueParameters": (True, 4., 1, SMALL_SEGMENT_SIZE),
+  "liveDelay": (True, 4., 1, SMALL_SEGMENT_SIZE),
   "androidLog": (True, 0.),
   "carState": (True, 100., 10),
   "carControl": (True, 100., 10),
@@ -45,18 +56,18 @@ _services: dict[str, tuple] = {
   "driverAssistance": (True, 20., 20),
   "procLog": (True, 0.5, 15),
   "gpsLocationExternal": (True, 10., 10),
-  "gpsLocation": (True, 1., 1),
+  "gpsLocation": (True, 1., 1, SMALL_SEGMENT_SIZE),
   "ubloxGnss": (True, 10.),
   "qcomGnss": (True, 2.),
   "gnssMeasurements": (True, 10., 10),
-  "clocks": (True, 0.1, 1),
+  "clocks": (True, 0.1, 1, SMALL_SEGMENT_SIZE),
   "ubloxRaw": (True, 20.),
   "livePose": (True, 20., 4),
   "liveParameters": (True, 20., 5),
   "cameraOdometry": (True, 20., 10),
   "thumbnail": (True, 1 / 60., 1),
-  "onroadEvents": (True, 1., 1),
-  "carParams": (True, 0.02, 1),
+  "onroadEvents": (True, 1., 1, SMALL_SEGMENT_SIZE),
+  "carParams": (True, 0.02, 1, SMALL_SEGMENT_SIZE),
   "roadCameraState": (True, 20., 20),
   "driverCameraState": (True, 20., 20),
   "driverEncodeIdx": (False, 20., 1),
@@ -65,17 +76,18 @@ _services: dict[str, tuple] = {
   "wideRoadEncodeIdx": (False, 20., 1),
   "wideRoadCameraState": (True, 20., 20),
   "drivingModelData": (True, 20., 10),
-  "modelV2": (True, 20.),
-  "managerState": (True, 2., 1),
-  "uploaderState": (True, 0., 1),
-  "navInstruction": (True, 1., 10),
+  "modelV2": (True, 20., None, LARGE_SEGMENT_SIZE),
+  "managerState": (True, 2., 1, SMALL_SEGMENT_SIZE),
+  "uploaderState": (True, 0., 1, SMALL_SEGMENT_SIZE),
+  "visionipcStats": (True, 1., 1, SMALL_SEGMENT_SIZE),
+  "navInstruction": (True, 1., 10, SMALL_SEGMENT_SIZE),
   "navRoute": (True, 0.),
   "navThumbnail": (True, 0.),
   "qRoadEncodeIdx": (False, 20.),
-  "userBookmark": (True, 0., 1),
+  "userBookmark": (True, 0., 1, SMALL_SEGMENT_SIZE),
   "soundPressure": (True, 10., 10),
   "rawAudioData": (False, 20.),
-  "bookmarkButton": (True, 0., 1),
+  "bookmarkButton": (True, 0., 1, SMALL_SEGMENT_SIZE),
   "audioFeedback": (True, 0., 1),
 
   # #custom
@@ -84,11 +96,11 @@ _services: dict[str, tuple] = {
 
   # debug
   "uiDebug": (True, 0., 1),
-  "testJoystick": (True, 0.),
+  "testJoystick": (True, 0., None, SMALL_SEGMENT_SIZE),
   "alertDebug": (True, 20., 5),
-  "roadEncodeData": (False, 20.),
-  "driverEncodeData": (False, 20.),
-  "wideRoadEncodeData": (False, 20.),
+  "roadEncodeData": (False, 20., None, LARGE_SEGMENT_SIZE),
+  "driverEncodeData": (False, 20., None, LARGE_SEGMENT_SIZE),
+  "wideRoadEncodeData": (False, 20., None, LARGE_SEGMENT_SIZE),
   "qRoadEncodeData": (False, 20.),
   "livestreamWideRoadEncodeIdx": (False, 20.),
   "livestreamRoadEncodeIdx": (False, 20.),
@@ -113,13 +125,13 @@ def build_header():
   h += "#include <map>\n"
   h += "#include <string>\n"
 
-  h += "struct service { std::string name; bool should_log; float frequency; int decimation; };\n"
+  h += "struct service { std::string name; bool should_log; float frequency; int decimation; size_t segment_size; };\n"
   h += "static std::map<std::string, service> services = {\n"
   for k, v in SERVICE_LIST.items():
     should_log = "true" if v.should_log else "false"
     decimation = -1 if v.decimation is None else v.decimation
-    h += '  { "%s", {"%s", %s, %f, %d}},\n' % \
-         (k, k, should_log, v.frequency, decimation)
+    h += '  { "%s", {"%s", %s, %f, %d, %d}},\n' % \
+         (k, k, should_log, v.frequency, decimation, v.segment_size)
   h += "};\n"
 
   h += "#endif\n"
@@ -0,0 +1,87 @@
+// Compares the one file per key params layout against the memory-mapped store
+// (PARAMS_STORE=mmap): single writes, concurrent writes, reads and readAll.
+//
+// usage: params [path] [num_writes] [num_threads]
+// path should be on the filesystem of interest, defaults to a new directory in /tmp
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/benchmarks/util.h"
+#include "common/params.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+static void run(const char *name, const std::string &path, int num_writes, int num_threads) {
+  Params params(path);
+  auto keys = params.allKeys();
+  keys.resize(std::min<size_t>(keys.size(), 100));
+
+  std::vector<double> put_us;
+  for (int i = 0; i < num_writes; i++) {
+    double start = millis_since_boot();
+    params.put(keys[i % keys.size()], std::to_string(i));
+    put_us.push_back((millis_since_boot() - start) * 1e3);
+  }
+
+  // Every thread writes its own keys
+  double start = millis_since_boot();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < num_writes / num_threads; i++) {
+        params.put(keys[(t + i * num_threads) % keys.size()], std::to_string(i));
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  double concurrent_us = (millis_since_boot() - start) * 1e3 / (num_writes / num_threads * num_threads);
+
+  std::vector<double> get_us;
+  for (int i = 0; i < num_writes; i++) {
+    double get_start = millis_since_boot();
+    params.get(keys[i % keys.size()]);
+    get_us.push_back((millis_since_boot() - get_start) * 1e3);
+  }
+
+  start = millis_since_boot();
+  size_t num_params = params.readAll().size();
+  double read_all_ms = millis_since_boot() - start;
+
+  printf("%-6s %10.1f %10.1f %14.1f %10.2f %10.2f %9.2f (%zu)\n", name,
+         percentile(put_us, 0.5), percentile(put_us, 0.99), concurrent_us,
+         percentile(get_us, 0.5), percentile(get_us, 0.99), read_all_ms, num_params);
+}
+
+static void print_store_stats(const std::string &path) {
+  Params params(path);
+  auto stats = ParamsStore::open(params.getParamPath() + ".store")->stats();
+  printf("mmap store: %lu writes in %lu fsyncs, %lu compactions\n", stats.writes, stats.commits, stats.compactions);
+}
+
+int main(int argc, char *argv[]) {
+  std::string path;
+  if (argc > 1) {
+    path = argv[1];
+  } else {
+    char tmp_path[] = "/tmp/params_bench_XXXXXX";
+    path = mkdtemp(tmp_path);
+  }
+  int num_writes = argc > 2 ? atoi(argv[2]) : 1000;
+  int num_threads = argc > 3 ? atoi(argv[3]) : 8;
+
+  printf("%d writes, %d threads for concurrent writes, %s\n", num_writes, num_threads, path.c_str());
+  printf("%-6s %10s %10s %14s %10s %10s %12s\n", "", "put p50 us", "put p99 us", "concurrent us", "get p50 us", "get p99 us", "readAll ms");
+
+  run("files", path, num_writes, num_threads);
+
+  // The store imports the params written above
+  setenv("PARAMS_STORE", "mmap", 1);
+  run("mmap", path, num_writes, num_threads);
+  print_store_stats(path);
+  return 0;
+}
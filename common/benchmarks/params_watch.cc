@@ -0,0 +1,88 @@
+// Compares reacting to param changes by polling every 100ms against ParamWatcher.
+// A writer thread changes one of the watched params at a fixed interval, the reader
+// reports how often it woke up and how long it took to see each change.
+// Set PARAMS_STORE=mmap to measure the store.
+//
+// usage: params_watch [change_interval_ms] [seconds] [num_keys]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/benchmarks/util.h"
+#include "common/params.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+// wait_fn waits for a change once and returns the changed keys
+static void run(const char *name, const std::string &path, const std::vector<std::string> &keys, int interval_ms, int seconds,
+                std::function<std::vector<std::string>()> wait_fn) {
+  std::atomic<bool> writing = true;
+  std::atomic<double> put_ms = 0;
+  std::thread writer([&]() {
+    Params writer_params(path);
+    for (int i = 0; i < seconds * 1000 / interval_ms; i++) {
+      util::sleep_for(interval_ms);
+      // Stamped before the put, the reader can wake up before it returns
+      put_ms = millis_since_boot();
+      writer_params.put(keys[i % keys.size()], std::to_string(i));
+    }
+    util::sleep_for(200);
+    writing = false;
+  });
+
+  uint64_t wakeups = 0;
+  std::vector<double> latencies_ms;
+  double start = millis_since_boot();
+  while (writing) {
+    auto changed = wait_fn();
+    wakeups++;
+    if (!changed.empty()) {
+      latencies_ms.push_back(millis_since_boot() - put_ms);
+    }
+  }
+  double elapsed = (millis_since_boot() - start) / 1000.;
+  writer.join();
+
+  printf("%-8s %10.1f %10zu %12.3f %12.3f\n", name, wakeups / elapsed, latencies_ms.size(),
+         percentile(latencies_ms, 0.5), percentile(latencies_ms, 0.99));
+}
+
+int main(int argc, char *argv[]) {
+  int interval_ms = argc > 1 ? atoi(argv[1]) : 250;
+  int seconds = argc > 2 ? atoi(argv[2]) : 10;
+  size_t num_keys = argc > 3 ? atoi(argv[3]) : 4;
+
+  char tmp_path[] = "/tmp/params_watch_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+  auto keys = params.allKeys();
+  keys.resize(std::min(keys.size(), num_keys));
+
+  printf("%zu keys, one changes every %d ms\n", keys.size(), interval_ms);
+  printf("%-8s %10s %10s %12s %12s\n", "", "wakeups/s", "changes", "p50 ms", "p99 ms");
+
+  // What processes that re-read params on a timer do
+  std::vector<std::string> values(keys.size());
+  run("poll", param_path, keys, interval_ms, seconds, [&]() {
+    util::sleep_for(100);
+    std::vector<std::string> changed;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (auto value = params.get(keys[i]); value != values[i]) {
+        values[i] = value;
+        changed.push_back(keys[i]);
+      }
+    }
+    return changed;
+  });
+
+  ParamWatcher watcher(params, keys);
+  // The timeout only lets the benchmark notice that the writer is done
+  run("inotify", param_path, keys, interval_ms, seconds, [&]() { return watcher.wait(1000); });
+  return 0;
+}
@@ -0,0 +1,49 @@
+// Measures how long a LOGD call blocks the calling thread, while other threads log as
+// well. Run with SWAGLOG_SYNC=1 to compare against formatting and sending on the caller.
+// Rate limits are off unless SWAGLOG_SITE_RATE or SWAGLOG_LEVEL_RATE is set.
+// Nothing needs to receive the messages.
+//
+// usage: swaglog [num_logs] [num_threads] [interval_us]
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "common/benchmarks/util.h"
+#include "common/swaglog.h"
+#include "common/timing.h"
+
+int main(int argc, char *argv[]) {
+  int num_logs = argc > 1 ? atoi(argv[1]) : 10000;
+  int num_threads = argc > 2 ? atoi(argv[2]) : 4;
+  int interval_us = argc > 3 ? atoi(argv[3]) : 100;
+  if (!getenv("SWAGLOG_SITE_RATE") && !getenv("SWAGLOG_LEVEL_RATE")) {
+    cloudlog_set_limits({.site_rate = 0, .level_rate = 0, .dedup = false});
+  }
+
+  std::vector<std::vector<double>> call_us(num_threads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < num_logs; i++) {
+        double start = nanos_since_boot();
+        LOGD("thread %d message %d value %.3f", t, i, i * 0.5);
+        call_us[t].push_back((nanos_since_boot() - start) / 1e3);
+        if (interval_us > 0) std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  cloudlog_flush();
+
+  std::vector<double> all;
+  for (auto &v : call_us) all.insert(all.end(), v.begin(), v.end());
+  auto stats = cloudlog_stats();
+  printf("%s, %d threads, %d logs each, %d us apart\n", getenv("SWAGLOG_SYNC") ? "sync" : "async",
+         num_threads, num_logs, interval_us);
+  printf("LOGD us: p50 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n", percentile(all, 0.5), percentile(all, 0.99),
+         percentile(all, 0.999), percentile(all, 1.0));
+  printf("logged %lu  dropped %lu  suppressed %lu\n", stats.logged, stats.dropped, stats.suppressed);
+  return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+// Value at fraction p of the samples, e.g. 0.99 for p99. Reorders v.
+inline double percentile(std::vector<double> &v, double p) {
+  if (v.empty()) return 0;
+  size_t idx = std::min(v.size() - 1, (size_t)(p * v.size()));
+  std::nth_element(v.begin(), v.begin() + idx, v.end());
+  return v[idx];
+}
@@ -1,16 +1,23 @@
 #include "common/params.h"
 
 #include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
 
 #include <algorithm>
-#include <cassert>
+#include <condition_variable>
 #include <csignal>
+#include <mutex>
+#include <new>
+#include <set>
+#include <thread>
 #include <unordered_map>
 
 #include "common/params_keys.h"
-#include "common/queue.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
 
@@ -88,19 +95,134 @@ private:
   int fd_ = -1;
 };
 
+// A value is written at most this long after putNonBlocking, plus the time the writes
+// queued before it take. Values of the same key that arrive in the meantime replace it.
+constexpr int WRITE_DELAY_MS = 10;
+
+// Writes the values of putNonBlocking for all Params objects of the process on one thread.
+// Only the newest value of every key is written.
+class ParamsWriter {
+public:
+  static ParamsWriter &instance() {
+    static ParamsWriter writer;
+    return writer;
+  }
+
+  ~ParamsWriter() {
+    {
+      std::lock_guard lk(lock);
+      exit = true;
+    }
+    cv.notify_all();
+    if (thread.joinable()) thread.join();
+  }
+
+  void push(Params *params, const std::string &key, const std::string &val) {
+    {
+      std::lock_guard lk(lock);
+      if (pending.empty()) oldest_ms = millis_since_boot();
+      if (!pending.insert_or_assign({params, key}, val).second) stats.coalesced++;
+      stats.queued++;
+      // start thread on demand
+      if (!thread.joinable()) thread = std::thread(&ParamsWriter::run, this);
+    }
+    cv.notify_all();
+  }
+
+  void flush(Params *params) {
+    std::unique_lock lk(lock);
+    flushing++;
+    cv.notify_all();
+    cv.wait(lk, [&]() { return !hasWrites(params); });
+    flushing--;
+  }
+
+  ParamsWriteStats getStats() {
+    std::lock_guard lk(lock);
+    return stats;
+  }
+
+private:
+  ParamsWriter() {
+    pthread_atfork(&ParamsWriter::beforeFork, &ParamsWriter::afterForkParent, &ParamsWriter::afterForkChild);
+  }
+
+  static void beforeFork() { instance().lock.lock(); }
+  static void afterForkParent() { instance().lock.unlock(); }
+
+  // The writer thread isn't forked. The parent writes what it queued, the child starts
+  // its own thread on the next push. The thread may have been waiting on cv, which
+  // can't be used in the child with that waiter registered, so it is made anew.
+  static void afterForkChild() {
+    ParamsWriter &w = instance();
+    if (w.thread.joinable()) w.thread.detach();
+    new (&w.cv) std::condition_variable();
+    w.pending.clear();
+    w.writing.clear();
+    w.flushing = 0;
+    w.lock.unlock();
+  }
+
+  bool hasWrites(Params *params) {
+    auto it = pending.lower_bound({params, ""});
+    return (it != pending.end() && it->first.first == params) || writing.count(params);
+  }
+
+  void run() {
+    std::unique_lock lk(lock);
+    while (true) {
+      cv.wait(lk, [&]() { return exit || !pending.empty(); });
+      if (pending.empty()) break;
+
+      // Give writes to the same key a moment to coalesce, unless someone waits for them
+      double delay_ms = oldest_ms + WRITE_DELAY_MS - millis_since_boot();
+      if (delay_ms > 0 && !exit && !flushing) {
+        cv.wait_for(lk, std::chrono::microseconds((int64_t)(delay_ms * 1000)), [&]() { return exit || flushing > 0; });
+        continue;
+      }
+
+      auto batch = std::move(pending);
+      pending.clear();
+      for (auto &[k, _] : batch) writing.insert(k.first);
+      lk.unlock();
+      for (auto &[k, val] : batch) {
+        // Params::put is Thread-Safe
+        k.first->put(k.second, val);
+      }
+      lk.lock();
+      writing.clear();
+      stats.written += batch.size();
+      stats.flushes++;
+      cv.notify_all();
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::map<std::pair<Params *, std::string>, std::string> pending;
+  std::set<Params *> writing;
+  double oldest_ms = 0;
+  int flushing = 0;
+  bool exit = false;
+  ParamsWriteStats stats;
+  std::thread thread;
+};
+
 } // namespace
 
 
 Params::Params(const std::string &path) {
+  // The writer has to outlive every Params object, including static ones
+  ParamsWriter::instance();
   params_prefix = "/" + util::getenv("OPENPILOT_PREFIX", "d");
   params_path = ensure_params_path(params_prefix, path);
+  if (util::getenv("PARAMS_STORE") == "mmap") {
+    store = ParamsStore::open(getParamPath() + ".store", getParamPath());
+  }
 }
 
 Params::~Params() {
-  if (future.valid()) {
-    future.wait();
-  }
-  assert(queue.empty());
+  flush();
 }
 
 std::vector<std::string> Params::allKeys() const {
@@ -128,6 +250,8 @@ std::optional<std::string> Params::getKeyDefaultValue(const std::string &key) {
 }
 
 int Params::put(const char* key, const char* value, size_t value_size) {
+  if (store) return store->put(key, value, value_size);
+
   // Information about safely and atomically writing a file: https://lwn.net/Articles/457667/
   // 1) Create temp file
   // 2) Write data to temp file
@@ -167,6 +291,8 @@ int Params::put(const char* key, const char* value, size_t value_size) {
 }
 
 int Params::remove(const std::string &key) {
+  if (store) return store->remove({key});
+
   FileLock file_lock(params_path + "/.lock");
   int result = unlink(getParamPath(key).c_str());
   if (result != 0) {
@@ -177,19 +303,21 @@ int Params::remove(const std::string &key) {
 
 std::string Params::get(const std::string &key, bool block) {
   if (!block) {
-    return util::read_file(getParamPath(key));
+    return store ? store->get(key) : util::read_file(getParamPath(key));
   } else {
     // blocking read until successful
     params_do_exit = 0;
     void (*prev_handler_sigint)(int) = std::signal(SIGINT, params_sig_handler);
     void (*prev_handler_sigterm)(int) = std::signal(SIGTERM, params_sig_handler);
 
+    ParamWatcher watcher(*this, {key});
     std::string value;
     while (!params_do_exit) {
-      if (value = util::read_file(getParamPath(key)); !value.empty()) {
+      if (value = get(key); !value.empty()) {
         break;
       }
-      util::sleep_for(100);  // 0.1 s
+      // Signals interrupt the wait, the timeout only covers one arriving right before it
+      watcher.wait(1000);
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -199,11 +327,25 @@ std::string Params::get(const std::string &key, bool block) {
 }
 
 std::map<std::string, std::string> Params::readAll() {
+  if (store) return store->readAll();
+
   FileLock file_lock(params_path + "/.lock");
   return util::read_files_in_dir(getParamPath());
 }
 
 void Params::clearAll(ParamKeyFlag key_flag) {
+  if (store) {
+    std::vector<std::string> remove_keys;
+    for (auto &key : store->keys()) {
+      auto it = keys.find(key);
+      if (it == keys.end() || (it->second.flags & key_flag)) {
+        remove_keys.push_back(key);
+      }
+    }
+    store->remove(remove_keys);
+    return;
+  }
+
   FileLock file_lock(params_path + "/.lock");
 
   // 1) delete params of key_flag
@@ -225,18 +367,102 @@ void Params::clearAll(ParamKeyFlag key_flag) {
 }
 
 void Params::putNonBlocking(const std::string &key, const std::string &val) {
-   queue.push(std::make_pair(key, val));
-  // start thread on demand
-  if (!future.valid() || future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
-    future = std::async(std::launch::async, &Params::asyncWriteThread, this);
+  ParamsWriter::instance().push(this, key, val);
+}
+
+void Params::flush() {
+  ParamsWriter::instance().flush(this);
+}
+
+ParamsWriteStats Params::writeStats() {
+  return ParamsWriter::instance().getStats();
+}
+
+ParamWatcher::ParamWatcher(Params &p, const std::vector<std::string> &watch_keys) : params(p) {
+  // Param files are replaced by renames. The store is appended to, touched after every
+  // commit and replaced by a rename when it is compacted.
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd >= 0) {
+    int wd;
+    if (params.store) {
+      store_name = params.params_prefix.substr(1) + ".store";
+      wd = inotify_add_watch(inotify_fd, params.params_path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVED_TO);
+    } else {
+      wd = inotify_add_watch(inotify_fd, params.getParamPath().c_str(), IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE);
+    }
+    if (wd < 0) {
+      LOGE("Failed to watch params, errno=%d", errno);
+      close(inotify_fd);
+      inotify_fd = -1;
+    }
+  }
+
+  // Read the values after adding the watch, so no change is missed
+  for (const auto &key : watch_keys) {
+    values[key] = params.get(key);
   }
 }
 
-void Params::asyncWriteThread() {
-  // TODO: write the latest one if a key has multiple values in the queue.
-  std::pair<std::string, std::string> p;
-  while (queue.try_pop(p, 0)) {
-    // Params::put is Thread-Safe
-    put(p.first, p.second);
+ParamWatcher::~ParamWatcher() {
+  if (inotify_fd >= 0) close(inotify_fd);
+}
+
+std::vector<std::string> ParamWatcher::wait(int timeout_ms) {
+  std::vector<std::string> changed;
+  double deadline = millis_since_boot() + timeout_ms;
+  while (changed.empty()) {
+    int remaining = timeout_ms < 0 ? -1 : std::max(0, (int)(deadline - millis_since_boot()));
+    if (inotify_fd < 0) {
+      if (remaining == 0) break;
+      util::sleep_for(remaining < 0 ? 100 : std::min(remaining, 100));
+      std::vector<std::string> all_keys;
+      for (const auto &[key, _] : values) all_keys.push_back(key);
+      changed = update(all_keys);
+      continue;
+    }
+
+    struct pollfd pfd = {.fd = inotify_fd, .events = POLLIN};
+    if (poll(&pfd, 1, remaining) <= 0) break;
+    changed = update(readEvents());
+  }
+  return changed;
+}
+
+std::vector<std::string> ParamWatcher::readEvents() {
+  bool all = false;
+  std::set<std::string> changed_keys;
+  alignas(struct inotify_event) char buf[4096];
+  ssize_t len;
+  while ((len = HANDLE_EINTR(read(inotify_fd, buf, sizeof(buf)))) > 0) {
+    for (char *ptr = buf; ptr < buf + len;) {
+      auto event = (struct inotify_event *)ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        all = true;
+      } else if (event->len > 0) {
+        if (store_name.empty()) {
+          if (values.count(event->name)) changed_keys.insert(event->name);
+        } else if (store_name == event->name) {
+          all = true;
+        }
+      }
+    }
+  }
+
+  if (all) {
+    for (const auto &[key, _] : values) changed_keys.insert(key);
+  }
+  return {changed_keys.begin(), changed_keys.end()};
+}
+
+std::vector<std::string> ParamWatcher::update(const std::vector<std::string> &check_keys) {
+  std::vector<std::string> changed;
+  for (const auto &key : check_keys) {
+    std::string value = params.get(key);
+    if (std::string &last = values[key]; value != last) {
+      last = std::move(value);
+      changed.push_back(key);
+    }
   }
+  return changed;
 }
@@ -1,14 +1,14 @@
 #pragma once
 
-#include <future>
 #include <map>
+#include <memory>
 #include <optional>
 #include <string>
 #include <tuple>
 #include <utility>
 #include <vector>
 
-#include "common/queue.h"
+#include "common/params_store.h"
 
 enum ParamKeyFlag {
   PERSISTENT = 0x02,
@@ -31,6 +31,14 @@ enum ParamKeyType {
   BYTES = 6
 };
 
+// Counters of the putNonBlocking writer, shared by all Params of a process
+struct ParamsWriteStats {
+  uint64_t queued = 0;     // putNonBlocking calls
+  uint64_t coalesced = 0;  // values replaced by a newer one before they were written
+  uint64_t written = 0;    // values written
+  uint64_t flushes = 0;    // times the writer emptied its queue
+};
+
 struct ParamKeyAttributes {
   uint32_t flags;
   ParamKeyType type;
@@ -77,14 +85,42 @@ public:
   inline void putBoolNonBlocking(const std::string &key, bool val) {
     putNonBlocking(key, val ? "1" : "0");
   }
+  // Blocks until all putNonBlocking writes of this object are written
+  void flush();
+  static ParamsWriteStats writeStats();
 
 private:
-  void asyncWriteThread();
+  friend class ParamWatcher;
 
   std::string params_path;
   std::string params_prefix;
 
-  // for nonblocking write
-  std::future<void> future;
-  SafeQueue<std::pair<std::string, std::string>> queue;
+  // Set if params live in a single store file instead of one file per key (PARAMS_STORE=mmap)
+  std::shared_ptr<ParamsStore> store;
+};
+
+// Waits for changes of a set of params. Uses inotify on the params directory and
+// falls back to reading the values every 100ms if that is not available.
+class ParamWatcher {
+public:
+  ParamWatcher(Params &params, const std::vector<std::string> &watch_keys);
+  ~ParamWatcher();
+  // Not copyable.
+  ParamWatcher(const ParamWatcher&) = delete;
+  ParamWatcher& operator=(const ParamWatcher&) = delete;
+
+  // Readable when one of the params might have changed, -1 without inotify
+  inline int fd() const { return inotify_fd; }
+  // Returns the params whose values changed since the last call. Blocks for up to
+  // timeout_ms (-1 forever), returns early with no params if a signal arrives.
+  std::vector<std::string> wait(int timeout_ms = -1);
+
+private:
+  std::vector<std::string> readEvents();
+  std::vector<std::string> update(const std::vector<std::string> &check_keys);
+
+  Params &params;
+  int inotify_fd = -1;
+  std::string store_name;
+  std::map<std::string, std::string> values;
 };
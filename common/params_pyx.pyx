@@ -37,6 +37,7 @@ cdef extern from "common/params.h":
     int put(string, string) nogil
     void putNonBlocking(string, string) nogil
     void putBoolNonBlocking(string, bool) nogil
+    void flush() nogil
     int putBool(string, bool) nogil
     bool checkKey(string) nogil
     ParamKeyType getKeyType(string) nogil
@@ -169,6 +170,11 @@ cdef class Params:
     with nogil:
       self.p.putBoolNonBlocking(k, val)
 
+  def flush(self):
+    """Blocks until the put_nonblocking writes of this object are on disk."""
+    with nogil:
+      self.p.flush()
+
   def remove(self, key):
     cdef string k = self.check_key(key)
     with nogil:
@@ -0,0 +1,458 @@
+#include "common/params_store.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "common/swaglog.h"
+#include "common/util.h"
+
+namespace {
+
+constexpr uint64_t STORE_MAGIC = 0x31534d5241504f; // "OPARMS1"
+constexpr uint32_t RECORD_MAGIC = 0x50524543;
+constexpr uint16_t RECORD_REMOVED = 1;
+
+constexpr uint64_t HEADER_SIZE = 4096;
+constexpr uint64_t MIN_CAPACITY = 256 * 1024;
+// Address space reserved for the mapping, the file itself only grows as needed
+constexpr uint64_t MAX_CAPACITY = 64 * 1024 * 1024;
+
+using StoreHeader = ParamsStore::Header;
+
+struct RecordHeader {
+  uint32_t magic;
+  uint16_t key_size;
+  uint16_t flags;
+  uint32_t value_size;
+  uint32_t reserved;
+  uint64_t checksum;
+};
+
+uint64_t record_size(size_t key_size, size_t value_size) {
+  return (sizeof(RecordHeader) + key_size + value_size + 7) & ~7ULL;
+}
+
+uint64_t round_capacity(uint64_t size) {
+  constexpr uint64_t granularity = 64 * 1024;
+  return std::max(MIN_CAPACITY, (size + granularity - 1) / granularity * granularity);
+}
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ ((const uint8_t *)data)[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t record_checksum(const RecordHeader &h, const char *key, const char *value) {
+  RecordHeader tmp = h;
+  tmp.checksum = 0;
+  uint64_t hash = fnv1a(14695981039346656037ULL, &tmp, sizeof(tmp));
+  hash = fnv1a(hash, key, h.key_size);
+  return fnv1a(hash, value, h.value_size);
+}
+
+void append_record(std::string &buf, const std::string &key, const char *value, size_t value_size, bool removed) {
+  RecordHeader h = {RECORD_MAGIC, (uint16_t)key.size(), removed ? RECORD_REMOVED : (uint16_t)0, (uint32_t)value_size, 0, 0};
+  h.checksum = record_checksum(h, key.data(), value);
+
+  size_t start = buf.size();
+  buf.append((const char *)&h, sizeof(h));
+  buf.append(key);
+  buf.append(value, value_size);
+  buf.resize(start + record_size(key.size(), value_size), '\0');
+}
+
+// Returns the record at offset if it is complete and intact
+const RecordHeader *read_record(const char *map, uint64_t offset, uint64_t end) {
+  if (offset + sizeof(RecordHeader) > end) return nullptr;
+
+  auto h = (const RecordHeader *)(map + offset);
+  if (h->magic != RECORD_MAGIC || offset + record_size(h->key_size, h->value_size) > end) return nullptr;
+
+  const char *key = (const char *)(h + 1);
+  if (h->checksum != record_checksum(*h, key, key + h->key_size)) return nullptr;
+  return h;
+}
+
+std::string boot_id() {
+  return util::read_file("/proc/sys/kernel/random/boot_id").substr(0, sizeof(StoreHeader::boot_id) - 1);
+}
+
+int write_all(int fd, const std::string &buf, uint64_t offset) {
+  size_t written = 0;
+  while (written < buf.size()) {
+    ssize_t ret = HANDLE_EINTR(pwrite(fd, buf.data() + written, buf.size() - written, offset + written));
+    if (ret <= 0) return -1;
+    written += ret;
+  }
+  return 0;
+}
+
+class StoreLock {
+public:
+  StoreLock(const std::string &fn) {
+    fd_ = HANDLE_EINTR(open(fn.c_str(), O_CREAT | O_RDONLY | O_CLOEXEC, 0664));
+    if (fd_ < 0 || HANDLE_EINTR(flock(fd_, LOCK_EX)) < 0) {
+      LOGE("Failed to lock file %s, errno=%d", fn.c_str(), errno);
+    }
+  }
+  ~StoreLock() { close(fd_); }
+
+private:
+  int fd_ = -1;
+};
+
+// Maps the whole address range up front, so growing the file never moves the mapping
+char *map_file(int fd) {
+  void *p = mmap(nullptr, MAX_CAPACITY, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  return p == MAP_FAILED ? nullptr : (char *)p;
+}
+
+// Writes a new store file with the given records, not visible under path until renamed
+int create_file(const std::string &path, const std::string &records, uint64_t extra, int *fd_out, char **map_out) {
+  uint64_t capacity = std::min(round_capacity(2 * (HEADER_SIZE + records.size() + extra)), MAX_CAPACITY);
+  if (HEADER_SIZE + records.size() + extra > capacity) return -1;
+
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0664));
+  if (fd < 0) return -1;
+
+  char *map = nullptr;
+  if (ftruncate(fd, capacity) < 0 || write_all(fd, records, HEADER_SIZE) < 0 || !(map = map_file(fd))) {
+    close(fd);
+    return -1;
+  }
+
+  auto header = (StoreHeader *)map;
+  header->magic = STORE_MAGIC;
+  header->commit_offset = HEADER_SIZE + records.size();
+  strncpy(header->boot_id, boot_id().c_str(), sizeof(header->boot_id) - 1);
+
+  if (HANDLE_EINTR(fsync(fd)) < 0) {
+    munmap(map, MAX_CAPACITY);
+    close(fd);
+    return -1;
+  }
+  *fd_out = fd;
+  *map_out = map;
+  return 0;
+}
+
+} // namespace
+
+std::shared_ptr<ParamsStore> ParamsStore::open(const std::string &path, const std::string &import_dir) {
+  static std::mutex stores_mutex;
+  static std::map<std::string, std::shared_ptr<ParamsStore>> stores;
+
+  std::lock_guard lk(stores_mutex);
+  auto &store = stores[path];
+  if (!store) {
+    std::shared_ptr<ParamsStore> s(new ParamsStore(path));
+    std::lock_guard store_lk(s->mutex_);
+    s->map(import_dir);
+    if (uint64_t recovered = s->stats_.recovered_bytes) {
+      LOGW("params store %s: recovered after a crash, cut off %lu bytes", path.c_str(), recovered);
+    }
+    store = s;
+  }
+  return store;
+}
+
+ParamsStore::~ParamsStore() {
+  unmap();
+}
+
+void ParamsStore::map(const std::string &import_dir) {
+  // Opening for the first time, serialized with writers and recovery of other processes
+  StoreLock lock(path_ + ".lock");
+
+  int fd = HANDLE_EINTR(::open(path_.c_str(), O_RDWR | O_CLOEXEC));
+  if (fd < 0) {
+    std::string records;
+    if (!import_dir.empty()) {
+      for (auto &[key, value] : util::read_files_in_dir(import_dir)) {
+        if (key[0] == '.') continue;
+        append_record(records, key, value.data(), value.size(), false);
+      }
+    }
+
+    std::string tmp_path = path_ + ".tmp";
+    char *map = nullptr;
+    if (create_file(tmp_path, records, 0, &fd, &map) == 0) {
+      munmap(map, MAX_CAPACITY);
+      if (rename(tmp_path.c_str(), path_.c_str()) < 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+
+  if (fd < 0 || !(map_ = map_file(fd))) {
+    if (fd >= 0) close(fd);
+    throw std::runtime_error(util::string_format("Failed to open params store %s, errno=%d", path_.c_str(), errno));
+  }
+  fd_ = fd;
+  if (((StoreHeader *)map_)->magic != STORE_MAGIC) {
+    throw std::runtime_error(util::string_format("Invalid params store %s", path_.c_str()));
+  }
+
+  index_.clear();
+  scanned_ = HEADER_SIZE;
+
+  // The first process to open the store after a reboot cuts off records that didn't make it to disk
+  std::string boot = boot_id();
+  if (boot.empty() || boot != ((StoreHeader *)map_)->boot_id) {
+    recover();
+    strncpy(((StoreHeader *)map_)->boot_id, boot.c_str(), sizeof(StoreHeader::boot_id) - 1);
+  }
+  refresh();
+}
+
+void ParamsStore::unmap() {
+  if (map_) munmap(map_, MAX_CAPACITY);
+  if (fd_ >= 0) close(fd_);
+  map_ = nullptr;
+  fd_ = -1;
+}
+
+void ParamsStore::recover() {
+  struct stat st;
+  if (fstat(fd_, &st) < 0) return;
+
+  uint64_t end = HEADER_SIZE;
+  while (const RecordHeader *h = read_record(map_, end, st.st_size)) {
+    end += record_size(h->key_size, h->value_size);
+  }
+
+  // Committed records that are torn, open() reports them
+  auto header = (StoreHeader *)map_;
+  stats_.recovered_bytes = header->commit_offset > end ? header->commit_offset - end : 0;
+
+  // Zero everything after the last intact record, so an old record can't reappear behind newer ones
+  if (ftruncate(fd_, end) == 0 && ftruncate(fd_, st.st_size) == 0) {
+    header->commit_offset = end;
+    HANDLE_EINTR(fsync(fd_));
+  }
+}
+
+void ParamsStore::refresh() {
+  auto header = (StoreHeader *)map_;
+  if (header->replaced) {
+    // Another process compacted the store, switch over to the new file
+    int fd = HANDLE_EINTR(::open(path_.c_str(), O_RDWR | O_CLOEXEC));
+    char *map = fd >= 0 ? map_file(fd) : nullptr;
+    if (!map) {
+      LOGE("Failed to reopen params store %s, errno=%d", path_.c_str(), errno);
+      if (fd >= 0) close(fd);
+      return;
+    }
+    unmap();
+    fd_ = fd;
+    map_ = map;
+    header = (StoreHeader *)map_;
+    index_.clear();
+    scanned_ = HEADER_SIZE;
+  }
+
+  uint64_t end = header->commit_offset.load(std::memory_order_acquire);
+  while (scanned_ < end) {
+    const RecordHeader *h = read_record(map_, scanned_, end);
+    if (!h) {
+      LOGE("params store %s: invalid record at %lu", path_.c_str(), scanned_);
+      scanned_ = end;
+      break;
+    }
+
+    std::string key((const char *)(h + 1), h->key_size);
+    if (h->flags & RECORD_REMOVED) {
+      index_.erase(key);
+    } else {
+      index_[key] = scanned_;
+    }
+    scanned_ += record_size(h->key_size, h->value_size);
+  }
+}
+
+std::string ParamsStore::get(const std::string &key) {
+  std::lock_guard lk(mutex_);
+  refresh();
+  auto it = index_.find(key);
+  if (it == index_.end()) return {};
+
+  auto h = (const RecordHeader *)(map_ + it->second);
+  return std::string((const char *)(h + 1) + h->key_size, h->value_size);
+}
+
+std::vector<std::string> ParamsStore::keys() {
+  std::lock_guard lk(mutex_);
+  refresh();
+  std::vector<std::string> ret;
+  for (auto &[key, _] : index_) ret.push_back(key);
+  return ret;
+}
+
+std::map<std::string, std::string> ParamsStore::readAll() {
+  std::lock_guard lk(mutex_);
+  refresh();
+  std::map<std::string, std::string> ret;
+  for (auto &[key, offset] : index_) {
+    auto h = (const RecordHeader *)(map_ + offset);
+    ret[key] = std::string((const char *)(h + 1) + h->key_size, h->value_size);
+  }
+  return ret;
+}
+
+int ParamsStore::put(const std::string &key, const char *value, size_t value_size) {
+  if (key.empty() || key.size() > UINT16_MAX || value_size > MAX_CAPACITY / 2) return -1;
+
+  std::vector<Write> writes = {{&key, value, value_size, false}};
+  return commit(writes);
+}
+
+int ParamsStore::remove(const std::vector<std::string> &keys) {
+  std::vector<Write> writes;
+  {
+    std::lock_guard lk(mutex_);
+    refresh();
+    for (auto &key : keys) {
+      if (index_.count(key)) writes.push_back({&key, "", 0, true});
+    }
+  }
+  return writes.empty() ? -1 : commit(writes);
+}
+
+ParamsStore::Stats ParamsStore::stats() {
+  std::lock_guard lk(commit_mutex_);
+  Stats s = stats_;
+  s.compactions = num_compactions_;
+  return s;
+}
+
+int ParamsStore::commit(std::vector<Write> &writes) {
+  std::unique_lock lk(commit_mutex_);
+  for (auto &w : writes) pending_.push_back(&w);
+
+  // All writes were queued together, so they end up in the same batch
+  while (!writes.back().done) {
+    if (committing_) {
+      commit_cv_.wait(lk);
+      continue;
+    }
+
+    committing_ = true;
+    std::vector<Write *> batch;
+    batch.swap(pending_);
+    lk.unlock();
+    int result = writeBatch(batch);
+    lk.lock();
+
+    for (auto w : batch) {
+      w->result = result;
+      w->done = true;
+    }
+    stats_.writes += batch.size();
+    stats_.commits++;
+    committing_ = false;
+    commit_cv_.notify_all();
+  }
+  return writes.back().result;
+}
+
+int ParamsStore::writeBatch(const std::vector<Write *> &batch) {
+  std::string records;
+  for (auto w : batch) {
+    append_record(records, *w->key, w->value, w->value_size, w->remove);
+  }
+
+  // Nobody else can append or compact while the file lock is held, so the mapping
+  // stays put and readers of this process only have to be kept out while it changes
+  StoreLock lock(path_ + ".lock");
+  uint64_t end;
+  {
+    std::lock_guard lk(mutex_);
+    refresh();
+    if (int ret = ensureCapacity(records.size()); ret != 0) return ret;
+    end = ((StoreHeader *)map_)->commit_offset;
+  }
+
+  if (write_all(fd_, records, end) < 0) return -20;
+  if (HANDLE_EINTR(fsync(fd_)) < 0) return -1;
+
+  {
+    std::lock_guard lk(mutex_);
+    ((StoreHeader *)map_)->commit_offset.store(end + records.size(), std::memory_order_release);
+    refresh();
+  }
+  // Writes through the mapping are invisible to inotify, wake up ParamWatchers only
+  // now that the records are committed
+  futimens(fd_, nullptr);
+  return 0;
+}
+
+int ParamsStore::ensureCapacity(uint64_t size) {
+  struct stat st;
+  if (fstat(fd_, &st) < 0) return -1;
+
+  uint64_t end = ((StoreHeader *)map_)->commit_offset;
+  if (end + size <= (uint64_t)st.st_size) return 0;
+
+  // Rewrite the log without overwritten records if that frees at least half of it
+  uint64_t live = 0;
+  for (auto &[key, offset] : index_) {
+    auto h = (const RecordHeader *)(map_ + offset);
+    live += record_size(h->key_size, h->value_size);
+  }
+  if (live + size < (end - HEADER_SIZE) / 2 || end + size > MAX_CAPACITY) {
+    return compact(size);
+  }
+
+  uint64_t capacity = std::min(std::max(2 * (uint64_t)st.st_size, round_capacity(end + size)), MAX_CAPACITY);
+  return ftruncate(fd_, capacity);
+}
+
+int ParamsStore::compact(uint64_t extra) {
+  std::string records;
+  for (auto &[key, offset] : index_) {
+    auto h = (const RecordHeader *)(map_ + offset);
+    records.append((const char *)h, record_size(h->key_size, h->value_size));
+  }
+
+  int fd = -1;
+  char *map = nullptr;
+  std::string tmp_path = path_ + ".tmp";
+  if (create_file(tmp_path, records, extra, &fd, &map) != 0) {
+    ::unlink(tmp_path.c_str());
+    return -1;
+  }
+  if (rename(tmp_path.c_str(), path_.c_str()) < 0) {
+    munmap(map, MAX_CAPACITY);
+    close(fd);
+    return -1;
+  }
+
+  size_t slash = path_.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : path_.substr(0, slash);
+  int dir_fd = HANDLE_EINTR(::open(dir.c_str(), O_RDONLY));
+  if (dir_fd >= 0) {
+    HANDLE_EINTR(fsync(dir_fd));
+    close(dir_fd);
+  }
+
+  // Other processes switch over on their next access
+  ((StoreHeader *)map_)->replaced = 1;
+  unmap();
+  fd_ = fd;
+  map_ = map;
+  index_.clear();
+  scanned_ = HEADER_SIZE;
+  refresh();
+  num_compactions_++;
+  return 0;
+}
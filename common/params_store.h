@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Key/value store in a single memory-mapped file, an alternative to one file per param.
+// Records are appended to a log and never modified in place. Readers only look at the
+// committed part of the log, so they need neither a file lock nor a syscall. They aren't
+// lock free within a process though: get, keys and readAll take a mutex that guards the
+// index of the process and the mapping, which is replaced after a compaction. Writers only
+// hold it to update the index, not during write and fsync. Writers append under a file
+// lock, concurrent writes from one process are grouped into a single fsync. The log is
+// rewritten without overwritten records when it grows too large. After a crash the log is
+// cut at the first record with a bad checksum.
+class ParamsStore {
+public:
+  // Stores are shared by all Params objects of a process. If the store doesn't exist yet,
+  // it is created with the files in import_dir.
+  static std::shared_ptr<ParamsStore> open(const std::string &path, const std::string &import_dir = {});
+  ~ParamsStore();
+
+  std::string get(const std::string &key);
+  std::vector<std::string> keys();
+  std::map<std::string, std::string> readAll();
+
+  int put(const std::string &key, const char *value, size_t value_size);
+  int remove(const std::vector<std::string> &keys);
+
+  struct Stats {
+    uint64_t writes = 0;
+    uint64_t commits = 0;
+    uint64_t compactions = 0;
+    uint64_t recovered_bytes = 0;  // Cut off the log after a crash when the store was opened
+  };
+  Stats stats();
+
+  // Start of the file
+  struct Header {
+    uint64_t magic;
+    std::atomic<uint32_t> replaced;      // set when a compaction moved the store to a new file
+    uint32_t reserved;
+    std::atomic<uint64_t> commit_offset; // end of the records readers may look at
+    char boot_id[40];                    // boot in which the log was last checked for torn writes
+  };
+
+private:
+  struct Write {
+    const std::string *key;
+    const char *value;
+    size_t value_size;
+    bool remove;
+    int result = 0;
+    bool done = false;
+  };
+
+  ParamsStore(const std::string &path) : path_(path) {}
+  void map(const std::string &import_dir);
+  void unmap();
+  void refresh();
+  void recover();
+  int commit(std::vector<Write> &writes);
+  int writeBatch(const std::vector<Write *> &batch);
+  int ensureCapacity(uint64_t size);
+  int compact(uint64_t extra);
+
+  const std::string path_;
+  int fd_ = -1;
+  char *map_ = nullptr;
+  uint64_t capacity_ = 0;
+
+  // Offset of the newest record of every key, guards the mapping
+  std::mutex mutex_;
+  std::unordered_map<std::string, uint64_t> index_;
+  uint64_t scanned_ = 0;
+
+  // Group commit: the first writer writes everything that queued up in the meantime
+  std::mutex commit_mutex_;
+  std::condition_variable commit_cv_;
+  std::vector<Write *> pending_;
+  bool committing_ = false;
+  Stats stats_;
+  std::atomic<uint64_t> num_compactions_ = 0;
+};
@@ -4,10 +4,21 @@
 
 #include "common/swaglog.h"
 
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstring>
+#include <iterator>
 #include <limits>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 #include <zmq.h>
 #include <stdarg.h>
@@ -15,16 +26,173 @@
 #include "common/version.h"
 #include "system/hardware/hw.h"
 
+class SwaglogState;
+static SwaglogState &swaglog_state();
+
+bool LOG_TIMESTAMPS = getenv("LOG_TIMESTAMPS");
+uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
+
+namespace {
+
+// Number of messages that can wait for the drainer, a power of two
+constexpr size_t QUEUE_SIZE = 1024;
+// Call sites with their own rate limit, later ones only have the level limit
+constexpr size_t SITE_TABLE_SIZE = 1024;
+constexpr int SITE_PROBES = 8;
+// Rate limits allow a burst of one second worth of messages
+constexpr uint64_t BURST_NS = 1000000000ULL;
+// Repeats of a message are counted for this long before a summary is sent
+constexpr uint64_t REPEAT_WINDOW_NS = 1000000000ULL;
+// Longest a flush waits for the drainer
+constexpr uint64_t FLUSH_TIMEOUT_NS = 1000000000ULL;
+
+int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, const struct timespec *timeout = nullptr) {
+  return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+void futex_wake(std::atomic<uint32_t> *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, std::numeric_limits<int>::max(), NULL, NULL, 0);
+}
+
+// Everything the drainer needs to build the json. filename and func are string literals.
+struct LogRecord {
+  int levelnum;
+  const char *filename;
+  int lineno;
+  const char *func;
+  double created;
+  bool timestamp;  // cloudlog_t event
+  uint32_t frame_id;
+  uint64_t nanos;
+  uint32_t suppressed;  // messages of the call site that were over the rate limit before this one
+  std::string msg;  // keeps its capacity, formatting into it rarely allocates
+};
+
+// Call sites are identified by the address of their file name literal and the line.
+// User space addresses fit in 48 bits.
+inline uint64_t site_key(const char *filename, int lineno) {
+  return (uint64_t)(uintptr_t)filename ^ ((uint64_t)lineno << 48);
+}
+
+// Token bucket in a single atomic (GCRA). tat is the time at which the bucket will be full
+// again, a message is allowed as long as that stays within one burst from now.
+class RateLimit {
+public:
+  bool allow(uint64_t now, uint64_t interval_ns) {
+    uint64_t t = tat.load(std::memory_order_relaxed);
+    while (true) {
+      uint64_t start = std::max(t, now);
+      if (start - now + interval_ns > BURST_NS) return false;
+      if (tat.compare_exchange_weak(t, start + interval_ns, std::memory_order_relaxed)) return true;
+    }
+  }
+
+private:
+  std::atomic<uint64_t> tat = 0;
+};
+
+struct CallSite {
+  std::atomic<uint64_t> key = 0;
+  std::atomic<const char *> func = nullptr;
+  std::atomic<uint32_t> suppressed = 0;
+  RateLimit limit;
+};
+
+// Last message of a call site, for collapsing repeats
+struct Repeat {
+  std::string msg;
+  uint64_t since_ns = 0;
+  uint32_t count = 0;
+  const char *filename;
+  int lineno;
+  const char *func;
+};
+
+// Bounded multi producer, single consumer queue. A producer claims a cell with a CAS on
+// the write position, fills it and publishes it through the cell's sequence number.
+class LogQueue {
+public:
+  LogQueue() {
+    for (size_t i = 0; i < QUEUE_SIZE; ++i) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns nullptr if the queue is full, otherwise a record that must be passed to push()
+  LogRecord *claim(size_t &pos) {
+    pos = write_pos.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = cells[pos % QUEUE_SIZE];
+      intptr_t diff = (intptr_t)cell.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+      if (diff == 0) {
+        if (write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &cell.record;
+      } else if (diff < 0) {
+        return nullptr;
+      } else {
+        pos = write_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(size_t pos) {
+    cells[pos % QUEUE_SIZE].seq.store(pos + 1, std::memory_order_release);
+  }
+
+  // Consumer side, returns nullptr if the next record is not published yet
+  LogRecord *front() {
+    Cell &cell = cells[read_pos % QUEUE_SIZE];
+    return cell.seq.load(std::memory_order_acquire) == read_pos + 1 ? &cell.record : nullptr;
+  }
+
+  void pop() {
+    cells[read_pos % QUEUE_SIZE].seq.store(read_pos + QUEUE_SIZE, std::memory_order_release);
+    ++read_pos;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    LogRecord record;
+  };
+  Cell cells[QUEUE_SIZE];
+  alignas(64) std::atomic<size_t> write_pos = 0;
+  alignas(64) size_t read_pos = 0;
+};
+
+void fill_record(LogRecord &r, int levelnum, const char *filename, int lineno, const char *func,
+                 uint32_t frame_id, bool timestamp) {
+  r.levelnum = levelnum;
+  r.filename = filename;
+  r.lineno = lineno;
+  r.func = func;
+  r.created = seconds_since_epoch();
+  r.timestamp = timestamp;
+  r.frame_id = frame_id;
+  r.nanos = nanos_since_boot();
+  r.suppressed = 0;
+}
+
+// Formats into the existing buffer of msg, leaves it empty on errors
+bool format_msg(std::string &msg, const char *fmt, va_list args) {
+  va_list args_copy;
+  va_copy(args_copy, args);
+  msg.resize(msg.capacity());
+  int len = vsnprintf(msg.data(), msg.size() + 1, fmt, args);
+  if (len > 0 && (size_t)len > msg.size()) {
+    msg.resize(len);
+    vsnprintf(msg.data(), msg.size() + 1, fmt, args_copy);
+  }
+  va_end(args_copy);
+  msg.resize(std::max(len, 0));
+  return len > 0;
+}
+
+} // namespace
+
 class SwaglogState {
 public:
   SwaglogState() {
-    zctx = zmq_ctx_new();
-    sock = zmq_socket(zctx, ZMQ_PUSH);
-
-    // Timeout on shutdown for messages to be received by the logging process
-    int timeout = 100;
-    zmq_setsockopt(sock, ZMQ_LINGER, &timeout, sizeof(timeout));
-    zmq_connect(sock, Path::swaglog_ipc().c_str());
+    connect();
 
     // workaround for https://github.com/dropbox/json11/issues/38
     setlocale(LC_NUMERIC, "C");
@@ -59,83 +227,369 @@ public:
     ctx_j["version"] = COMMA_VERSION;
     ctx_j["dirty"] = !getenv("CLEAN");
     ctx_j["device"] = Hardware::get_name();
+
+    SwaglogLimits limits;
+    if (const char *rate = getenv("SWAGLOG_SITE_RATE")) {
+      limits.site_rate = atof(rate);
+    }
+    if (const char *rate = getenv("SWAGLOG_LEVEL_RATE")) {
+      limits.level_rate = atof(rate);
+    }
+    if (const char *dedup = getenv("SWAGLOG_DEDUP")) {
+      limits.dedup = strcmp(dedup, "0") != 0;
+    }
+    setLimits(limits);
+
+    sync = getenv("SWAGLOG_SYNC") != nullptr;
+    if (!sync) {
+      drainer = std::thread(&SwaglogState::drainThread, this);
+    }
+    pthread_atfork(&SwaglogState::beforeFork, &SwaglogState::afterForkParent, &SwaglogState::afterForkChild);
   }
 
   ~SwaglogState() {
+    if (drainer.joinable()) {
+      do_exit = true;
+      wake();
+      drainer.join();
+    }
     zmq_close(sock);
     zmq_ctx_destroy(zctx);
   }
 
-  void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
-    std::lock_guard lk(lock);
-    if (levelnum >= print_level) {
-      printf("%s: %s\n", filename, msg);
+  void log(int levelnum, const char* filename, int lineno, const char* func,
+           uint32_t frame_id, bool timestamp, const char* fmt, va_list args) {
+    // Limits are checked before formatting, a flood costs the caller as little as possible
+    uint32_t site_suppressed = 0;
+    if (!allow(levelnum, filename, lineno, func, site_suppressed)) return;
+
+    if (sync) {
+      LogRecord r;
+      fill_record(r, levelnum, filename, lineno, func, frame_id, timestamp);
+      r.suppressed = site_suppressed;
+      if (format_msg(r.msg, fmt, args)) {
+        std::lock_guard lk(lock);
+        process(r);
+        report(r.nanos);
+      }
+      return;
+    }
+
+    size_t pos;
+    LogRecord *r = queue.claim(pos);
+    if (!r) {
+      dropped++;
+      return;
+    }
+    fill_record(*r, levelnum, filename, lineno, func, frame_id, timestamp);
+    r->suppressed = site_suppressed;
+    format_msg(r->msg, fmt, args);  // the drainer skips empty messages
+    queue.push(pos);
+    queued.fetch_add(1);
+    // Pairs with the fence in drainThread, either the drainer sees the record or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (drainer_waiting.load()) {
+      wake();
+    }
+
+    // Don't lose the last words of a process that is about to crash
+    if (levelnum >= CLOUDLOG_CRITICAL) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (sync) return;
+    uint64_t target = queued.load();
+    uint64_t deadline = nanos_since_boot() + FLUSH_TIMEOUT_NS;
+    while (drained.load() < target && nanos_since_boot() < deadline) {
+      wake();
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  SwaglogStats stats() {
+    return {logged.load(), dropped.load(), suppressed.load(), repeated.load()};
+  }
+
+  void setLimits(const SwaglogLimits &limits) {
+    site_interval_ns = limits.site_rate > 0 ? (uint64_t)(1e9 / limits.site_rate) : 0;
+    level_interval_ns = limits.level_rate > 0 ? (uint64_t)(1e9 / limits.level_rate) : 0;
+    dedup = limits.dedup;
+  }
+
+private:
+  void connect() {
+    zctx = zmq_ctx_new();
+    sock = zmq_socket(zctx, ZMQ_PUSH);
+
+    // Timeout on shutdown for messages to be received by the logging process
+    int timeout = 100;
+    zmq_setsockopt(sock, ZMQ_LINGER, &timeout, sizeof(timeout));
+    zmq_connect(sock, Path::swaglog_ipc().c_str());
+  }
+
+  // The drainer is between batches while the lock is held, so the child gets consistent state
+  static void beforeFork() { swaglog_state().lock.lock(); }
+  static void afterForkParent() { swaglog_state().lock.unlock(); }
+
+  // Only the forking thread exists in the child, neither the drainer nor the zmq I/O thread.
+  // The child logs on the calling thread like with SWAGLOG_SYNC, through a new socket. The
+  // parent's context and drainer can't be shut down from here and are left alone.
+  static void afterForkChild() {
+    SwaglogState &s = swaglog_state();
+    if (s.drainer.joinable()) s.drainer.detach();
+    s.sync = true;
+    s.connect();
+    s.lock.unlock();
+  }
+
+  bool allow(int levelnum, const char *filename, int lineno, const char *func, uint32_t &site_suppressed) {
+    uint64_t site_ns = site_interval_ns.load(std::memory_order_relaxed);
+    uint64_t level_ns = level_interval_ns.load(std::memory_order_relaxed);
+    if (!site_ns && !level_ns) return true;
+
+    uint64_t now = nanos_since_boot();
+    CallSite *site = site_ns ? findSite(filename, lineno, func) : nullptr;
+    if (site && !site->limit.allow(now, site_ns)) {
+      site->suppressed++;
+      suppressed++;
+      return false;
+    }
+    if (level_ns && !level_limits[std::clamp(levelnum / 10, 0, (int)std::size(level_limits) - 1)].allow(now, level_ns)) {
+      level_suppressed++;
+      suppressed++;
+      return false;
+    }
+    if (site && site->suppressed.load(std::memory_order_relaxed)) {
+      site_suppressed = site->suppressed.exchange(0);
+    }
+    return true;
+  }
+
+  CallSite *findSite(const char *filename, int lineno, const char *func) {
+    uint64_t key = site_key(filename, lineno);
+    size_t h = std::hash<uint64_t>()(key) * 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < SITE_PROBES; ++i) {
+      CallSite &site = sites[(h + i) % SITE_TABLE_SIZE];
+      uint64_t k = site.key.load(std::memory_order_acquire);
+      if (k == 0 && site.key.compare_exchange_strong(k, key)) {
+        site.func = func;
+        return &site;
+      }
+      if (k == key) return &site;
+    }
+    return nullptr;
+  }
+
+  // Sends the message unless it repeats the last one of its call site
+  void process(const LogRecord &r) {
+    if (r.suppressed) {
+      summary(r.filename, r.lineno, r.func, "swaglog: " + std::to_string(r.suppressed) + " messages over the rate limit");
+    }
+
+    if (dedup && !r.timestamp) {
+      Repeat &rep = repeats[site_key(r.filename, r.lineno)];
+      if (r.nanos - rep.since_ns < REPEAT_WINDOW_NS && rep.msg == r.msg) {
+        rep.count++;
+        repeated++;
+        pending_repeats = true;
+        return;
+      }
+      if (rep.count) {
+        summary(rep.filename, rep.lineno, rep.func, "swaglog: last message repeated " + std::to_string(rep.count) + " times");
+      }
+      rep = {r.msg, r.nanos, 0, r.filename, r.lineno, r.func};
+    }
+
+    emit(r);
+    logged++;
+  }
+
+  // Sends what was counted instead of sent: drops, rate limited messages of call sites
+  // that stayed quiet since and repeats that ended. final sends everything that is left.
+  void report(uint64_t now, bool final = false) {
+    if (uint64_t drops = dropped.load(); drops != reported_drops) {
+      summary(__FILE__, __LINE__, __func__, "swaglog: " + std::to_string(drops - reported_drops) + " messages dropped");
+      reported_drops = drops;
+    }
+    if (uint64_t n = level_suppressed.load(); n != reported_level_suppressed) {
+      summary(__FILE__, __LINE__, __func__, "swaglog: " + std::to_string(n - reported_level_suppressed) + " messages over the level rate limit");
+      reported_level_suppressed = n;
+    }
+
+    if (!final && now - last_report_ns < REPEAT_WINDOW_NS) return;
+    last_report_ns = now;
+
+    if (uint64_t n = suppressed.load(); n != scanned_suppressed) {
+      scanned_suppressed = n;
+      for (auto &site : sites) {
+        if (site.suppressed.load(std::memory_order_relaxed) == 0) continue;
+        uint64_t key = site.key.load(std::memory_order_acquire);
+        const char *func = site.func.load();
+        uint32_t count = site.suppressed.exchange(0);
+        summary((const char *)(uintptr_t)(key & ((1ULL << 48) - 1)), key >> 48, func ? func : "",
+                "swaglog: " + std::to_string(count) + " messages over the rate limit");
+      }
+    }
+
+    if (pending_repeats) {
+      pending_repeats = false;
+      for (auto &[_, rep] : repeats) {
+        if (rep.count == 0) continue;
+        if (!final && now - rep.since_ns < REPEAT_WINDOW_NS) {
+          pending_repeats = true;
+          continue;
+        }
+        summary(rep.filename, rep.lineno, rep.func, "swaglog: last message repeated " + std::to_string(rep.count) + " times");
+        rep.count = 0;
+        rep.since_ns = now;
+      }
+    }
+  }
+
+  void summary(const char *filename, int lineno, const char *func, const std::string &msg) {
+    LogRecord r;
+    fill_record(r, CLOUDLOG_WARNING, filename, lineno, func, NO_FRAME_ID, false);
+    r.msg = msg;
+    emit(r);
+  }
+
+  void wake() {
+    wake_seq.fetch_add(1);
+    futex_wake(&wake_seq);
+  }
+
+  void drainThread() {
+    while (true) {
+      uint32_t seq = wake_seq.load();
+      bool exiting = do_exit;
+      {
+        std::lock_guard lk(lock);
+        while (LogRecord *r = queue.front()) {
+          if (!r->msg.empty()) {
+            process(*r);
+          }
+          queue.pop();
+          drained.fetch_add(1);
+        }
+        report(nanos_since_boot(), exiting);
+      }
+      if (exiting) break;
+
+      // Producers only wake the drainer when it announced that it is going to sleep
+      drainer_waiting = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!queue.front() && !do_exit) {
+        // Summaries of repeats and rate limited call sites are sent once a second
+        struct timespec timeout = {.tv_sec = 1};
+        bool summaries_due = pending_repeats || suppressed.load() != scanned_suppressed;
+        futex_wait(&wake_seq, seq, summaries_due ? &timeout : nullptr);
+      }
+      drainer_waiting = false;
+    }
+  }
+
+  void emit(const LogRecord &r) {
+    json11::Json::object log_j = json11::Json::object {
+      {"ctx", ctx_j},
+      {"levelnum", r.levelnum},
+      {"filename", r.filename},
+      {"lineno", r.lineno},
+      {"funcname", r.func},
+      {"created", r.created}
+    };
+    if (!r.timestamp) {
+      log_j["msg"] = r.msg;
+    } else {
+      json11::Json::object tspt_j = json11::Json::object{
+        {"event", r.msg},
+        {"time", std::to_string(r.nanos)}
+      };
+      if (r.frame_id < NO_FRAME_ID) {
+        tspt_j["frame_id"] = std::to_string(r.frame_id);
+      }
+      log_j["msg"] = json11::Json::object{{"timestamp", tspt_j}};
+    }
+
+    log_s.clear();
+    log_s += (char)r.levelnum;
+    ((json11::Json)log_j).dump(log_s);
+
+    if (r.levelnum >= print_level) {
+      printf("%s: %s\n", r.filename, r.msg.c_str());
     }
     zmq_send(sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
   }
 
+  // Held while messages are processed, by the drainer or the caller with SWAGLOG_SYNC
   std::mutex lock;
+  std::atomic<bool> sync = false;
+
   void* zctx = nullptr;
   void* sock = nullptr;
   int print_level;
   json11::Json::object ctx_j;
-};
+  std::string log_s;
 
-bool LOG_TIMESTAMPS = getenv("LOG_TIMESTAMPS");
-uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
+  LogQueue queue;
+  std::thread drainer;
+  std::atomic<bool> do_exit = false;
+  std::atomic<bool> drainer_waiting = false;
+  std::atomic<uint32_t> wake_seq = 0;
+  std::atomic<uint64_t> queued = 0;
+  std::atomic<uint64_t> drained = 0;
+  std::atomic<uint64_t> logged = 0;
+  std::atomic<uint64_t> dropped = 0;
+
+  // Rate limits, 0 for no limit
+  std::atomic<uint64_t> site_interval_ns = 0;
+  std::atomic<uint64_t> level_interval_ns = 0;
+  std::atomic<bool> dedup = true;
+  CallSite sites[SITE_TABLE_SIZE];
+  RateLimit level_limits[CLOUDLOG_CRITICAL / 10 + 1];
+  std::atomic<uint64_t> suppressed = 0;
+  std::atomic<uint64_t> level_suppressed = 0;
+  std::atomic<uint64_t> repeated = 0;
+
+  // Only used by the drainer, or under the lock with SWAGLOG_SYNC
+  std::unordered_map<uint64_t, Repeat> repeats;
+  bool pending_repeats = false;
+  uint64_t last_report_ns = 0;
+  uint64_t reported_drops = 0;
+  uint64_t reported_level_suppressed = 0;
+  uint64_t scanned_suppressed = 0;
+};
 
-static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
-                            char* msg_buf, const json11::Json::object &msg_j={}) {
+static SwaglogState &swaglog_state() {
   static SwaglogState s;
+  return s;
+}
 
-  json11::Json::object log_j = json11::Json::object {
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  if (msg_j.empty()) {
-    log_j["msg"] = msg_buf;
-  } else {
-    log_j["msg"] = msg_j;
-  }
+SwaglogStats cloudlog_stats() {
+  return swaglog_state().stats();
+}
 
-  std::string log_s;
-  log_s += (char)levelnum;
-  ((json11::Json)log_j).dump(log_s);
-  s.log(levelnum, filename, lineno, func, msg_buf, log_s);
+void cloudlog_flush() {
+  swaglog_state().flush();
+}
 
-  free(msg_buf);
+void cloudlog_set_limits(const SwaglogLimits &limits) {
+  swaglog_state().setLimits(limits);
 }
 
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
+  swaglog_state().log(levelnum, filename, lineno, func, NO_FRAME_ID, false, fmt, args);
   va_end(args);
-  if (ret <= 0 || !msg_buf) return;
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf);
 }
 
 void cloudlog_t_common(int levelnum, const char* filename, int lineno, const char* func,
                        uint32_t frame_id, const char* fmt, va_list args) {
   if (!LOG_TIMESTAMPS) return;
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
-  if (ret <= 0 || !msg_buf) return;
-  json11::Json::object tspt_j = json11::Json::object{
-    {"event", msg_buf},
-    {"time", std::to_string(nanos_since_boot())}
-  };
-  if (frame_id < NO_FRAME_ID) {
-    tspt_j["frame_id"] = std::to_string(frame_id);
-  }
-  tspt_j = json11::Json::object{{"timestamp", tspt_j}};
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf, tspt_j);
+  swaglog_state().log(levelnum, filename, lineno, func, frame_id, true, fmt, args);
 }
 
 
@@ -15,6 +15,28 @@
 #define SWAG_LOG_CHECK_FMT(a, b)
 #endif
 
+// Log calls only format the message into a bounded queue, a background thread
+// serializes and sends it. Set SWAGLOG_SYNC=1 to do everything on the calling thread,
+// which is also what a forked child does.
+struct SwaglogStats {
+  uint64_t logged = 0;      // messages sent to the logging process
+  uint64_t dropped = 0;     // messages lost because the queue was full
+  uint64_t suppressed = 0;  // messages over a rate limit
+  uint64_t repeated = 0;    // repeats of a message that were collapsed into a summary
+};
+SwaglogStats cloudlog_stats();
+// Blocks until all messages logged so far are sent, for at most a second
+void cloudlog_flush();
+
+// Protects the logging process from processes in a fault loop. The defaults can be
+// changed with SWAGLOG_SITE_RATE, SWAGLOG_LEVEL_RATE and SWAGLOG_DEDUP=0.
+struct SwaglogLimits {
+  double site_rate = 100;    // messages per second from one call site, 0 for no limit
+  double level_rate = 1000;  // messages per second of one level, 0 for no limit
+  bool dedup = true;         // count repeats of the last message of a call site instead of sending them
+};
+void cloudlog_set_limits(const SwaglogLimits &limits);
+
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) SWAG_LOG_CHECK_FMT(5, 6);
 
@@ -1,6 +1,13 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <thread>
+
 #include "catch2/catch.hpp"
 #define private public
 #include "common/params.h"
+#include "common/timing.h"
 #include "common/util.h"
 
 TEST_CASE("params_nonblocking_put") {
@@ -14,10 +21,6 @@ TEST_CASE("params_nonblocking_put") {
       // param is empty
       REQUIRE(params.get(name).empty());
     }
-
-    // check if thread is running
-    REQUIRE(params.future.valid());
-    REQUIRE(params.future.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout);
   }
   // check results
   Params p(param_path);
@@ -25,3 +28,229 @@ TEST_CASE("params_nonblocking_put") {
     REQUIRE(p.get(name) == "1");
   }
 }
+
+TEST_CASE("params_nonblocking_coalesce") {
+  char tmp_path[] = "/tmp/asyncWriter_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+  auto before = Params::writeStats();
+
+  // Only the last value of a burst is written
+  for (int i = 0; i < 100; i++) {
+    params.putNonBlocking("CarParams", std::to_string(i));
+  }
+  params.putNonBlocking("IsMetric", "1");
+  params.flush();
+  REQUIRE(params.get("CarParams") == "99");
+  REQUIRE(params.get("IsMetric") == "1");
+
+  auto stats = Params::writeStats();
+  REQUIRE(stats.queued - before.queued == 101);
+  REQUIRE(stats.written + stats.coalesced - before.written - before.coalesced == 101);
+  REQUIRE(stats.written - before.written < 101);
+
+  // Values are written without a flush as well
+  params.putNonBlocking("IsMetric", "0");
+  double start = millis_since_boot();
+  while (params.get("IsMetric") != "0" && millis_since_boot() - start < 1000) {
+    util::sleep_for(1);
+  }
+  REQUIRE(params.get("IsMetric") == "0");
+}
+
+TEST_CASE("params_nonblocking_fork") {
+  char tmp_path[] = "/tmp/asyncWriter_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+  params.putNonBlocking("CarParams", "parent");
+
+  // The writer thread isn't forked, the child starts its own
+  pid_t pid = fork();
+  if (pid == 0) {
+    alarm(5);
+    params.putNonBlocking("IsMetric", "child");
+    params.flush();
+    _exit(params.get("IsMetric") == "child" ? 0 : 1);
+  }
+  REQUIRE(pid > 0);
+  int status = 0;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0);
+
+  // The parent's writer still runs
+  params.flush();
+  REQUIRE(params.get("CarParams") == "parent");
+  params.putNonBlocking("CarParams", "after fork");
+  params.flush();
+  REQUIRE(params.get("CarParams") == "after fork");
+}
+
+TEST_CASE("params_store") {
+  char tmp_path[] = "/tmp/params_store_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params(param_path).put("DongleId", "cafe");
+  setenv("PARAMS_STORE", "mmap", 1);
+
+  Params params(param_path);
+  REQUIRE(params.store);
+  // Existing params are imported when the store is created
+  REQUIRE(params.get("DongleId") == "cafe");
+
+  SECTION("put, get and remove") {
+    REQUIRE(params.put("CarParams", std::string("\0\1\2", 3)) == 0);
+    REQUIRE(params.putBool("IsMetric", true) == 0);
+    REQUIRE(params.get("CarParams") == std::string("\0\1\2", 3));
+    REQUIRE(params.getBool("IsMetric"));
+    REQUIRE(params.readAll().size() == 3);
+
+    // Nothing is written to the per key files
+    REQUIRE(util::read_file(params.getParamPath("IsMetric")).empty());
+
+    REQUIRE(params.remove("IsMetric") == 0);
+    REQUIRE(params.get("IsMetric").empty());
+    REQUIRE(params.remove("IsMetric") != 0);
+
+    params.putBool("IsMetric", true);
+    params.clearAll(CLEAR_ON_MANAGER_START);
+    REQUIRE(params.get("CarParams").empty());
+    REQUIRE(params.getBool("IsMetric"));
+  }
+
+  SECTION("concurrent writes are grouped") {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; i++) {
+      threads.emplace_back([&params, i]() {
+        for (int j = 0; j < 50; j++) {
+          params.put("CarParams", std::to_string(i * 100 + j));
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+
+    auto stats = params.store->stats();
+    REQUIRE(stats.writes == 400);
+    REQUIRE(std::stoi(params.get("CarParams")) % 100 == 49);
+
+    // Hold the first commit until the other writers queued up behind it
+    ParamsStore *store = params.store.get();
+    auto queued = [store](bool committing, size_t pending) {
+      for (int i = 0; i < 5000; i++) {
+        {
+          std::lock_guard lk(store->commit_mutex_);
+          if (store->committing_ == committing && store->pending_.size() == pending) return true;
+        }
+        util::sleep_for(1);
+      }
+      return false;
+    };
+    threads.clear();
+    std::unique_lock index_lk(store->mutex_);
+    threads.emplace_back([&params]() { params.put("IsMetric", "1"); });
+    REQUIRE(queued(true, 0));
+    for (int i = 0; i < 7; i++) {
+      threads.emplace_back([&params, i]() { params.put("CarParams", std::to_string(i)); });
+    }
+    REQUIRE(queued(true, 7));
+    index_lk.unlock();
+    for (auto &t : threads) t.join();
+
+    auto grouped = params.store->stats();
+    REQUIRE(grouped.writes - stats.writes == 8);
+    REQUIRE(grouped.commits - stats.commits == 2);
+    REQUIRE(params.get("IsMetric") == "1");
+  }
+
+  SECTION("log is compacted") {
+    std::string value(64 * 1024, 'x');
+    for (int i = 0; i < 100; i++) {
+      value[0] = 'a' + i % 26;
+      REQUIRE(params.put("CarParams", value) == 0);
+    }
+    REQUIRE(params.store->stats().compactions > 0);
+    REQUIRE(params.get("CarParams") == value);
+
+    // Another process with the old file open switches over to the new one
+    ParamsStore other(params.getParamPath() + ".store");
+    {
+      std::lock_guard lk(other.mutex_);
+      other.map("");
+    }
+    params.put("IsMetric", "1");
+    for (int i = 0; i < 100; i++) params.put("CarParams", value);
+    REQUIRE(other.get("IsMetric") == "1");
+    REQUIRE(other.get("CarParams") == value);
+  }
+
+  SECTION("torn writes are cut off after a reboot") {
+    params.put("IsMetric", "1");
+    params.put("CarParams", "abc");
+
+    // Corrupt the last record and pretend the system rebooted
+    auto header = (char *)params.store->map_;
+    uint64_t end = *(uint64_t *)(header + offsetof(ParamsStore::Header, commit_offset));
+    header[end - 5] ^= 0xff;
+    header[offsetof(ParamsStore::Header, boot_id)] = 0;
+
+    ParamsStore reopened(params.getParamPath() + ".store");
+    {
+      std::lock_guard lk(reopened.mutex_);
+      reopened.map("");
+    }
+    REQUIRE(reopened.get("IsMetric") == "1");
+    REQUIRE(reopened.get("CarParams").empty());
+    REQUIRE(reopened.stats().recovered_bytes > 0);
+  }
+
+  unsetenv("PARAMS_STORE");
+}
+
+TEST_CASE("param_watcher") {
+  char tmp_path[] = "/tmp/param_watcher_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  bool use_store = GENERATE(false, true);
+  if (use_store) setenv("PARAMS_STORE", "mmap", 1);
+
+  Params params(param_path);
+  params.put("IsMetric", "0");
+  ParamWatcher watcher(params, {"IsMetric", "CarParams"});
+  REQUIRE(watcher.fd() >= 0);
+  REQUIRE(watcher.wait(0).empty());
+
+  SECTION("changes are reported once") {
+    params.put("IsMetric", "1");
+    REQUIRE(watcher.wait(1000) == std::vector<std::string>{"IsMetric"});
+    REQUIRE(watcher.wait(0).empty());
+
+    // Other keys and writes of the same value are no changes
+    params.put("DongleId", "cafe");
+    params.put("IsMetric", "1");
+    REQUIRE(watcher.wait(50).empty());
+
+    params.put("CarParams", "abc");
+    params.remove("IsMetric");
+    REQUIRE(watcher.wait(1000) == std::vector<std::string>{"CarParams", "IsMetric"});
+  }
+
+  SECTION("wait wakes up on writes of other threads") {
+    std::thread writer([&]() {
+      util::sleep_for(50);
+      Params(param_path).put("CarParams", "abc");
+    });
+    double start = millis_since_boot();
+    REQUIRE(watcher.wait(5000) == std::vector<std::string>{"CarParams"});
+    REQUIRE(millis_since_boot() - start < 1000);
+    writer.join();
+  }
+
+  SECTION("blocking get") {
+    std::thread writer([&]() {
+      util::sleep_for(50);
+      Params(param_path).put("DongleId", "cafe");
+    });
+    REQUIRE(params.get("DongleId", true) == "cafe");
+    writer.join();
+  }
+
+  unsetenv("PARAMS_STORE");
+}
@@ -1,3 +1,4 @@
+#include <sys/wait.h>
 #include <zmq.h>
 
 #include <iostream>
@@ -75,6 +76,8 @@ TEST_CASE("swaglog") {
   setenv("MANAGER_DAEMON", daemon_name.c_str(), 1);
   setenv("DONGLE_ID", dongle_id.c_str(), 1);
   setenv("dirty", "1", 1);
+  // Every message has to arrive
+  cloudlog_set_limits({.site_rate = 0, .level_rate = 0, .dedup = false});
   const int thread_cnt = 5;
   const int thread_msg_cnt = 100;
 
@@ -86,3 +89,105 @@ TEST_CASE("swaglog") {
 
   recv_log(thread_cnt, thread_msg_cnt);
 }
+
+TEST_CASE("swaglog_stats") {
+  cloudlog_set_limits({.site_rate = 0, .level_rate = 0, .dedup = false});
+  const int thread_cnt = 4;
+  const int thread_msg_cnt = 2000;
+  auto before = cloudlog_stats();
+
+  // Bursts larger than the queue drop messages instead of blocking the callers
+  std::vector<std::thread> log_threads;
+  for (int i = 0; i < thread_cnt; ++i) {
+    log_threads.push_back(std::thread([=]() {
+      for (int j = 0; j < thread_msg_cnt; ++j) LOGD("%d %d", i, j);
+    }));
+  }
+  for (auto &t : log_threads) t.join();
+  cloudlog_flush();
+
+  auto stats = cloudlog_stats();
+  REQUIRE(stats.logged - before.logged + stats.dropped - before.dropped == thread_cnt * thread_msg_cnt);
+  REQUIRE(stats.logged > before.logged);
+}
+
+TEST_CASE("swaglog_limits") {
+  const int thread_cnt = 4;
+  const double storm_seconds = 0.5;
+
+  // Threads log distinct messages as fast as they can
+  auto storm = [&](int num_sites) {
+    auto before = cloudlog_stats();
+    double start = seconds_since_boot();
+    std::vector<std::thread> log_threads;
+    for (int i = 0; i < thread_cnt; ++i) {
+      log_threads.push_back(std::thread([=]() {
+        for (int j = 0; seconds_since_boot() - start < storm_seconds; ++j) {
+          cloudlog_e(CLOUDLOG_DEBUG, __FILE__, 1000 + j % num_sites, __func__, "%d %d", i, j);
+        }
+      }));
+    }
+    for (auto &t : log_threads) t.join();
+    cloudlog_flush();
+    double elapsed = seconds_since_boot() - start;
+    auto stats = cloudlog_stats();
+    REQUIRE(stats.suppressed > before.suppressed);
+    return std::make_pair(stats.logged - before.logged, elapsed);
+  };
+
+  SECTION("call site limit") {
+    cloudlog_set_limits({.site_rate = 100, .level_rate = 0, .dedup = false});
+    auto [logged, elapsed] = storm(1);
+    // One burst plus the rate
+    REQUIRE(logged >= 100);
+    REQUIRE(logged <= 100 + 100 * elapsed + 1);
+  }
+
+  SECTION("level limit") {
+    cloudlog_set_limits({.site_rate = 100, .level_rate = 1000, .dedup = false});
+    auto [logged, elapsed] = storm(200);
+    REQUIRE(logged >= 1000);
+    REQUIRE(logged <= 1000 + 1000 * elapsed + 1);
+  }
+
+  SECTION("repeats are collapsed") {
+    cloudlog_set_limits({.site_rate = 0, .level_rate = 0, .dedup = true});
+    auto before = cloudlog_stats();
+    // A different message from the same call site ends the repeats
+    for (int i = 0; i < 500; ++i) {
+      LOGD("%s message", i % 100 == 0 ? "other" : "same");
+    }
+    cloudlog_flush();
+    auto stats = cloudlog_stats();
+    REQUIRE(stats.logged - before.logged == 10);
+    REQUIRE(stats.repeated - before.repeated == 490);
+  }
+}
+
+TEST_CASE("swaglog_fork") {
+  cloudlog_set_limits({.site_rate = 0, .level_rate = 0, .dedup = false});
+  LOGD("before fork");
+  cloudlog_flush();
+
+  // The drainer isn't forked, the child logs on its own thread and a critical log doesn't hang
+  pid_t pid = fork();
+  if (pid == 0) {
+    alarm(5);
+    auto before = cloudlog_stats();
+    for (int i = 0; i < 2000; ++i) LOGD("child %d", i);
+    cloudlog(CLOUDLOG_CRITICAL, "child critical");
+    auto stats = cloudlog_stats();
+    _exit(stats.logged - before.logged == 2001 && stats.dropped == before.dropped ? 0 : 1);
+  }
+  REQUIRE(pid > 0);
+  int status = 0;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0);
+
+  // The parent's drainer still runs
+  auto before = cloudlog_stats();
+  LOGD("after fork");
+  cloudlog_flush();
+  REQUIRE(cloudlog_stats().logged == before.logged + 1);
+}
@@ -1,6 +1,6 @@
 # must be built with scons
 from msgq.ipc_pyx import Context, Poller, SubSocket, PubSocket, SocketEventHandle, toggle_fake_events, \
-                                set_fake_prefix, get_fake_prefix, delete_fake_prefix, wait_for_one_event
+                                set_fake_prefix, get_fake_prefix, delete_fake_prefix, wait_for_one_event, queue_stats
 from msgq.ipc_pyx import MultiplePublishersError, IpcError
 
 from typing import Optional, List
@@ -12,6 +12,7 @@ assert set_fake_prefix
 assert get_fake_prefix
 assert delete_fake_prefix
 assert wait_for_one_event
+assert queue_stats
 
 NO_TRAVERSAL_LIMIT = 2**64-1
 
@@ -26,9 +27,9 @@ def fake_event_handle(endpoint: str, identifier: Optional[str] = None, override:
 
   return handle
 
-def pub_sock(endpoint: str) -> PubSocket:
+def pub_sock(endpoint: str, segment_size: int = 0) -> PubSocket:
   sock = PubSocket()
-  sock.connect(context, endpoint)
+  sock.connect(context, endpoint, segment_size)
   return sock
 
 
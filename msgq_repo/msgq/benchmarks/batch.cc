@@ -0,0 +1,131 @@
+// Compares sending messages one by one against msgq_msg_send_batch. Messages are
+// produced at a fixed rate and either sent right away or collected into batches.
+// Reports publisher and reader CPU time per message and how often readers woke up.
+//
+// usage: batch [num_readers] [num_messages] [rate_hz] [msg_size]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "msgq/msgq.h"
+
+struct ReaderResult {
+  uint64_t received = 0;
+  uint64_t wakeups = 0;
+  uint64_t cpu_ns = 0;
+};
+
+static uint64_t nanos(clockid_t clock) {
+  struct timespec t;
+  clock_gettime(clock, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void run_reader(const std::string &endpoint, std::atomic<int> *ready, std::atomic<bool> *done, ReaderResult *r) {
+  msgq_queue_t q;
+  msgq_new_queue(&q, endpoint.c_str(), 0);
+  msgq_init_subscriber(&q);
+  (*ready)++;
+
+  msgq_pollitem_t items[1];
+  items[0].q = &q;
+
+  uint64_t cpu_start = nanos(CLOCK_THREAD_CPUTIME_ID);
+  while (!*done) {
+    if (msgq_poll(items, 1, 100) == 0) continue;
+    r->wakeups++;
+
+    msgq_msg_t msg;
+    while (msgq_msg_recv(&msg, &q) > 0) {
+      r->received++;
+      msgq_msg_close(&msg);
+    }
+  }
+  r->cpu_ns = nanos(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+  msgq_close_queue(&q);
+}
+
+static void run(size_t batch_size, int num_readers, uint64_t num_messages, int rate_hz, size_t msg_size) {
+  std::string endpoint = "msgq_bench_batch_" + std::to_string(getpid());
+
+  msgq_queue_t q;
+  msgq_new_queue(&q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&q);
+
+  std::atomic<int> ready(0);
+  std::atomic<bool> done(false);
+  std::vector<ReaderResult> results(num_readers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_readers; i++) {
+    threads.emplace_back(run_reader, endpoint, &ready, &done, &results[i]);
+  }
+  while (ready < num_readers) usleep(1000);
+  usleep(10 * 1000);
+
+  std::vector<msgq_msg_t> msgs(batch_size);
+  for (auto &m : msgs) msgq_msg_init_size(&m, msg_size);
+
+  uint32_t seq_start = *q.write_seq;
+  uint64_t period_ns = 1000000000ULL / rate_hz;
+  uint64_t cpu_ns = 0;
+  uint64_t start = nanos(CLOCK_MONOTONIC);
+  for (uint64_t sent = 0; sent < num_messages; sent += batch_size) {
+    // Wait until the last message of the batch is due
+    uint64_t due = start + (sent + batch_size - 1) * period_ns;
+    while (nanos(CLOCK_MONOTONIC) < due) {
+      struct timespec ts = {0, (long)std::min<uint64_t>(due - nanos(CLOCK_MONOTONIC), 1000000)};
+      nanosleep(&ts, NULL);
+    }
+
+    uint64_t cpu_start = nanos(CLOCK_THREAD_CPUTIME_ID);
+    if (batch_size == 1) {
+      msgq_msg_send(&msgs[0], &q);
+    } else {
+      msgq_msg_send_batch(msgs.data(), batch_size, &q);
+    }
+    cpu_ns += nanos(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+  }
+  uint32_t notifications = *q.write_seq - seq_start;
+
+  usleep(100 * 1000);
+  done = true;
+  for (auto &t : threads) t.join();
+
+  uint64_t received = 0, wakeups = 0, reader_cpu_ns = 0;
+  for (auto &r : results) {
+    received += r.received;
+    wakeups += r.wakeups;
+    reader_cpu_ns += r.cpu_ns;
+  }
+
+  printf("%6zu %10.0f %10.0f %12u %12.1f %12.2f %10.1f%%\n", batch_size,
+         (double)cpu_ns / num_messages, received ? (double)reader_cpu_ns / received : 0.0,
+         notifications, (double)wakeups / num_readers, received ? (double)wakeups / received : 0.0,
+         100.0 * received / (num_messages * num_readers));
+
+  for (auto &m : msgs) msgq_msg_close(&m);
+  msgq_close_queue(&q);
+  remove(("/dev/shm/" + endpoint).c_str());
+}
+
+int main(int argc, char *argv[]) {
+  int num_readers = argc > 1 ? atoi(argv[1]) : 4;
+  int num_messages = argc > 2 ? atoi(argv[2]) : 20000;
+  int rate_hz = argc > 3 ? atoi(argv[3]) : 10000;
+  size_t msg_size = argc > 4 ? atol(argv[4]) : 64;
+
+  printf("%d readers, %d messages of %zu bytes at %d Hz\n", num_readers, num_messages, msg_size, rate_hz);
+  printf("%6s %10s %10s %12s %12s %12s %11s\n", "batch", "pub ns/msg", "sub ns/msg", "wakes sent", "wakeups/rdr", "wakeups/msg", "received");
+  for (size_t batch_size : {1, 4, 16, 64}) {
+    run(batch_size, num_readers, num_messages / batch_size * batch_size, rate_hz, msg_size);
+  }
+  return 0;
+}
@@ -0,0 +1,194 @@
+// Throughput and latency of the msgq and ZMQ backends for a range of message
+// sizes, reader counts and conflate settings. Every reader runs in its own thread.
+//
+// usage: pubsub [--backend msgq|zmq] [--size N] [--readers N] [--conflate 0|1] [--count N] [--rate HZ]
+// options that are not given sweep over their default range
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "msgq/benchmarks/util.h"
+#include "msgq/impl_msgq.h"
+#include "msgq/impl_zmq.h"
+
+struct Config {
+  std::string backend;
+  size_t size;
+  int readers;
+  bool conflate;
+  int count;
+  int rate;
+};
+
+struct ReaderStats {
+  std::vector<double> latencies_us;
+  uint64_t received = 0;
+  uint64_t dropped = 0;
+};
+
+static uint64_t nanos_monotonic() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void reader_thread(SubSocket *sock, const std::vector<std::atomic<uint64_t>> *send_times, std::atomic<bool> *done, ReaderStats *stats) {
+  int64_t last_seq = -1;
+  while (true) {
+    std::unique_ptr<Message> msg(sock->receive());
+    if (!msg) {
+      if (*done) break;
+      continue;
+    }
+
+    uint64_t now = nanos_monotonic();
+    uint64_t seq;
+    memcpy(&seq, msg->getData(), sizeof(seq));
+
+    stats->received++;
+    stats->latencies_us.push_back((now - (*send_times)[seq]) / 1e3);
+    if ((int64_t)seq > last_seq + 1) {
+      stats->dropped += seq - last_seq - 1;
+    }
+    last_seq = seq;
+  }
+}
+
+static void run(const Config &cfg) {
+  bool zmq = cfg.backend == "zmq";
+  std::string endpoint = "msgq_bench_pubsub_" + std::to_string(getpid());
+
+  std::unique_ptr<Context> context(zmq ? (Context *)new ZMQContext() : (Context *)new MSGQContext());
+  std::unique_ptr<PubSocket> pub(zmq ? (PubSocket *)new ZMQPubSocket() : (PubSocket *)new MSGQPubSocket());
+
+  // Fit at least 16 messages in the queue
+  size_t segment_size = std::max((size_t)DEFAULT_SEGMENT_SIZE, 16 * ALIGN(cfg.size + sizeof(int64_t)));
+  if (pub->connect(context.get(), endpoint, true, segment_size) != 0) {
+    printf("failed to connect publisher\n");
+    return;
+  }
+
+  std::vector<std::unique_ptr<SubSocket>> subs;
+  for (int i = 0; i < cfg.readers; i++) {
+    SubSocket *sub = zmq ? (SubSocket *)new ZMQSubSocket() : (SubSocket *)new MSGQSubSocket();
+    if (sub->connect(context.get(), endpoint, "127.0.0.1", cfg.conflate) != 0) {
+      printf("failed to connect subscriber\n");
+      delete sub;
+      return;
+    }
+    sub->setTimeout(100);
+    subs.emplace_back(sub);
+  }
+
+  // ZMQ subscribers need time to connect
+  usleep(zmq ? 500 * 1000 : 10 * 1000);
+
+  msgq_queue_stats_t stats_before = {};
+  if (!zmq) msgq_queue_stats(endpoint.c_str(), &stats_before);
+
+  // Send times are shared with the reader threads, so even 8 byte messages can be timed
+  std::vector<std::atomic<uint64_t>> send_times(cfg.count);
+  std::atomic<bool> done(false);
+  std::vector<ReaderStats> reader_stats(cfg.readers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < cfg.readers; i++) {
+    threads.emplace_back(reader_thread, subs[i].get(), &send_times, &done, &reader_stats[i]);
+  }
+
+  std::vector<char> data(std::max(cfg.size, sizeof(uint64_t)));
+  uint64_t period_ns = cfg.rate > 0 ? 1000000000ULL / cfg.rate : 0;
+  uint64_t start = nanos_monotonic();
+  for (uint64_t seq = 0; seq < (uint64_t)cfg.count; seq++) {
+    if (period_ns > 0) {
+      while (nanos_monotonic() < start + seq * period_ns) {}
+    }
+    memcpy(data.data(), &seq, sizeof(seq));
+    send_times[seq] = nanos_monotonic();
+    pub->send(data.data(), data.size());
+  }
+  double elapsed = (nanos_monotonic() - start) / 1e9;
+
+  done = true;
+  for (auto &t : threads) t.join();
+
+  msgq_queue_stats_t stats_after = {};
+  if (!zmq) msgq_queue_stats(endpoint.c_str(), &stats_after);
+
+  std::vector<double> latencies;
+  uint64_t received = 0, dropped = 0;
+  for (auto &rs : reader_stats) {
+    latencies.insert(latencies.end(), rs.latencies_us.begin(), rs.latencies_us.end());
+    received += rs.received;
+    dropped += rs.dropped;
+  }
+
+  printf("%-5s %8zu %7d %8d %10.0f %12.0f %10.1f %10.1f %10.1f %10lu %12lu\n",
+         cfg.backend.c_str(), cfg.size, cfg.readers, cfg.conflate,
+         cfg.count / elapsed, received / elapsed / cfg.readers,
+         percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999),
+         dropped / cfg.readers, stats_after.num_invalidations - stats_before.num_invalidations);
+
+  subs.clear();
+  pub.reset();
+  if (!zmq) remove(("/dev/shm/" + endpoint).c_str());
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> backends = {"msgq", "zmq"};
+  std::vector<size_t> sizes = {8, 64, 1024, 16 * 1024, 128 * 1024, 1024 * 1024};
+  std::vector<int> readers = {1, 2, 4, 8, 15};
+  std::vector<bool> conflates = {false, true};
+  int count = 10000;
+  int rate = 0;
+
+  const struct option long_options[] = {
+    {"backend", required_argument, NULL, 'b'},
+    {"size", required_argument, NULL, 's'},
+    {"readers", required_argument, NULL, 'r'},
+    {"conflate", required_argument, NULL, 'c'},
+    {"count", required_argument, NULL, 'n'},
+    {"rate", required_argument, NULL, 'f'},
+    {NULL, 0, NULL, 0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "b:s:r:c:n:f:", long_options, NULL)) != -1) {
+    switch (opt) {
+      case 'b': backends = {optarg}; break;
+      case 's': sizes = {(size_t)atol(optarg)}; break;
+      case 'r': readers = {atoi(optarg)}; break;
+      case 'c': conflates = {atoi(optarg) != 0}; break;
+      case 'n': count = atoi(optarg); break;
+      case 'f': rate = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [--backend msgq|zmq] [--size N] [--readers N] [--conflate 0|1] [--count N] [--rate HZ]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  printf("%-5s %8s %7s %8s %10s %12s %10s %10s %10s %10s %12s\n", "", "size", "readers", "conflate",
+         "sent/s", "recv/s/rdr", "p50 us", "p99 us", "p999 us", "dropped", "invalidated");
+  for (auto &backend : backends) {
+    for (size_t size : sizes) {
+      for (int r : readers) {
+        for (bool conflate : conflates) {
+          // Limit the amount of data for large messages
+          int n = std::max(100, (int)std::min<size_t>(count, (size_t)2048 * 1024 * 1024 / std::max(size, (size_t)1) / 16));
+          run({backend, size, r, conflate, n, rate});
+        }
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+// Measures reader wakeup latency and CPU usage of blocking msgq receives,
+// comparing the futex wait against the signal based wakeup.
+//
+// usage: wakeup [num_subscribers] [num_messages] [rate_hz]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "msgq/benchmarks/util.h"
+#include "msgq/msgq.h"
+
+struct BenchMsg {
+  uint64_t seq;
+  uint64_t sent_ns;
+};
+
+struct SubResult {
+  uint64_t received;
+  double cpu_ms;
+  double p50_us, p99_us, max_us;
+};
+
+static uint64_t nanos_monotonic() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void run_subscriber(const std::string &endpoint, int fd) {
+  msgq_queue_t q;
+  msgq_new_queue(&q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  msgq_init_subscriber(&q);
+
+  std::vector<double> latencies;
+  msgq_pollitem_t items[1];
+  items[0].q = &q;
+
+  while (true) {
+    msgq_poll(items, 1, -1);
+
+    msgq_msg_t msg;
+    if (msgq_msg_recv(&msg, &q) <= 0) continue;
+
+    BenchMsg m = *(BenchMsg *)msg.data;
+    msgq_msg_close(&msg);
+    if (m.seq == UINT64_MAX) break;
+    latencies.push_back((nanos_monotonic() - m.sent_ns) / 1e3);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  SubResult r;
+  r.received = latencies.size();
+  r.cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+  r.p50_us = percentile(latencies, 0.5);
+  r.p99_us = percentile(latencies, 0.99);
+  r.max_us = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+  if (write(fd, &r, sizeof(r)) != sizeof(r)) {
+    perror("write");
+  }
+  msgq_close_queue(&q);
+}
+
+static void run(const char *mode, bool use_signal, int num_subscribers, int num_messages, int rate_hz) {
+  std::string endpoint = "msgq_bench_wakeup_" + std::to_string(getpid());
+
+  msgq_queue_t q;
+  msgq_new_queue(&q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&q);
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  std::vector<pid_t> children;
+  for (int i = 0; i < num_subscribers; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      if (use_signal) setenv("MSGQ_SIGNAL_WAKEUP", "1", 1);
+      close(fds[0]);
+      run_subscriber(endpoint, fds[1]);
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+
+  while (*q.num_readers < (uint64_t)num_subscribers) usleep(1000);
+  usleep(100 * 1000);
+
+  // Give readers time to go back to sleep between messages
+  struct timespec period = {0, 1000000000L / rate_hz};
+  for (int i = 0; i <= num_messages; i++) {
+    BenchMsg m = {i == num_messages ? UINT64_MAX : (uint64_t)i, nanos_monotonic()};
+    msgq_msg_t msg;
+    msgq_msg_init_data(&msg, (char *)&m, sizeof(m));
+    msgq_msg_send(&msg, &q);
+    msgq_msg_close(&msg);
+    nanosleep(&period, NULL);
+  }
+
+  close(fds[1]);
+  double cpu_ms = 0, p50 = 0, p99 = 0, max_us = 0;
+  uint64_t received = 0;
+  for (int i = 0; i < num_subscribers; i++) {
+    SubResult r;
+    if (read(fds[0], &r, sizeof(r)) != sizeof(r)) break;
+    received += r.received;
+    cpu_ms += r.cpu_ms;
+    p50 = std::max(p50, r.p50_us);
+    p99 = std::max(p99, r.p99_us);
+    max_us = std::max(max_us, r.max_us);
+  }
+  close(fds[0]);
+  for (pid_t pid : children) waitpid(pid, NULL, 0);
+
+  printf("%-8s received %8lu   latency p50 %8.1f us  p99 %8.1f us  max %8.1f us   cpu/subscriber %7.1f ms  cpu/msg %6.2f us\n",
+         mode, received, p50, p99, max_us, cpu_ms / num_subscribers, received ? cpu_ms * 1e3 / received : 0.0);
+
+  msgq_close_queue(&q);
+  remove(("/dev/shm/" + endpoint).c_str());
+}
+
+int main(int argc, char *argv[]) {
+  int num_subscribers = argc > 1 ? atoi(argv[1]) : 4;
+  int num_messages = argc > 2 ? atoi(argv[2]) : 2000;
+  int rate_hz = argc > 3 ? atoi(argv[3]) : 1000;
+
+  printf("%d subscribers, %d messages at %d Hz\n", num_subscribers, num_messages, rate_hz);
+  run("futex", false, num_subscribers, num_messages, rate_hz);
+  run("signal", true, num_subscribers, num_messages, rate_hz);
+  return 0;
+}
@@ -54,6 +54,16 @@ public:
 
     return TSubSocket::receive(non_blocking);
   }
+
+  MessageView *receive_view(bool non_blocking=false) override {
+    if (this->state->enabled) {
+      this->recv_called->set();
+      this->recv_ready->wait();
+      this->recv_ready->clear();
+    }
+
+    return TSubSocket::receive_view(non_blocking);
+  }
 };
 
 class FakePoller: public Poller {
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <cerrno>
+#include <chrono>
 
 #include "msgq/impl_msgq.h"
 
@@ -43,8 +44,9 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
   assert(context);
   assert(address == "127.0.0.1");
 
+  // The publisher decides the size of the queue, map whatever exists
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  int r = msgq_new_queue(q, endpoint.c_str(), 0);
   if (r != 0){
     return r;
   }
@@ -61,32 +63,64 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
 }
 
 
-Message * MSGQSubSocket::receive(bool non_blocking){
-  msgq_msg_t msg;
+void MSGQMessageView::init(msgq_queue_t *queue, const msgq_msg_view_t &v) {
+  q = queue;
+  view = v;
+}
 
-  MSGQMessage *r = NULL;
+bool MSGQMessageView::valid() {
+  return q != NULL && msgq_msg_view_valid(&view, q);
+}
+
+void MSGQMessageView::release() {
+  if (q != NULL){
+    msgq_msg_view_release(&view, q);
+  }
+  q = NULL;
+}
+
+MSGQMessageView::~MSGQMessageView() {
+  this->release();
+}
+
+template <typename RecvFn>
+int MSGQSubSocket::receive_blocking(RecvFn recv, bool non_blocking){
+  int rc = recv();
+  if (non_blocking){
+    return rc;
+  }
 
-  int rc = msgq_msg_recv(&msg, q);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  while (rc == 0){
+    int t = -1;
+    if (timeout != -1){
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0){
+        break;
+      }
+      t = remaining.count();
+    }
 
-  // Hack to implement blocking read with a poller. Don't use this
-  while (!non_blocking && rc == 0){
+    // Blocks on the queue's futex until the writer publishes. A ready queue can
+    // still yield no message (e.g. conflate or reader reset), so try again
     msgq_pollitem_t items[1];
     items[0].q = q;
+    msgq_poll(items, 1, t);
+    rc = recv();
+  }
 
-    int t = (timeout != -1) ? timeout : 100;
+  return rc;
+}
 
-    int n = msgq_poll(items, 1, t);
-    rc = msgq_msg_recv(&msg, q);
+Message * MSGQSubSocket::receive(bool non_blocking){
+  msgq_msg_t msg;
 
-    // The poll indicated a message was ready, but the receive failed. Try again
-    if (n == 1 && rc == 0){
-      continue;
-    }
+  MSGQMessage *r = NULL;
 
-    if (timeout != -1){
-      break;
-    }
-  }
+  // An outstanding view holds back the read pointer
+  view.release();
+
+  int rc = receive_blocking([&]() { return msgq_msg_recv(&msg, q); }, non_blocking);
 
   if (rc > 0){
     r = new MSGQMessage;
@@ -96,18 +130,33 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   return (Message*)r;
 }
 
+MessageView * MSGQSubSocket::receive_view(bool non_blocking){
+  msgq_msg_view_t v;
+
+  view.release();
+
+  int rc = receive_blocking([&]() { return msgq_msg_recv_view(&v, q); }, non_blocking);
+  if (rc <= 0){
+    return NULL;
+  }
+
+  view.init(q, v);
+  return &view;
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
 
 MSGQSubSocket::~MSGQSubSocket(){
+  view.release();
   if (q != NULL){
     msgq_close_queue(q);
     delete q;
   }
 }
 
-int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_endpoint){
+int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_endpoint, size_t segment_size){
   assert(context);
 
   // TODO
@@ -116,7 +165,7 @@ int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_en
   //}
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), DEFAULT_SEGMENT_SIZE);
+  int r = msgq_new_queue(q, endpoint.c_str(), segment_size > 0 ? segment_size : DEFAULT_SEGMENT_SIZE);
   if (r != 0){
     return r;
   }
@@ -134,6 +183,16 @@ int MSGQPubSocket::sendMessage(Message *message){
   return msgq_msg_send(&msg, q);
 }
 
+int MSGQPubSocket::send_batch(char **data, size_t *sizes, size_t num_msgs){
+  std::vector<msgq_msg_t> msgs(num_msgs);
+  for (size_t i = 0; i < num_msgs; i++){
+    msgs[i].data = data[i];
+    msgs[i].size = sizes[i];
+  }
+
+  return msgq_msg_send_batch(msgs.data(), num_msgs, q);
+}
+
 int MSGQPubSocket::send(char *data, size_t size){
   msgq_msg_t msg;
   msg.data = data;
@@ -142,6 +201,14 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+char *MSGQPubSocket::reserve(size_t size){
+  return msgq_msg_reserve(q, size);
+}
+
+int MSGQPubSocket::commit(){
+  return msgq_msg_commit(q);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
@@ -31,15 +31,31 @@ public:
   ~MSGQMessage();
 };
 
+class MSGQMessageView : public MessageView {
+private:
+  msgq_queue_t * q = NULL;
+  msgq_msg_view_t view = {};
+public:
+  void init(msgq_queue_t *queue, const msgq_msg_view_t &v);
+  size_t getSize(){return view.size;}
+  const char * getData(){return view.data;}
+  bool valid();
+  void release();
+  ~MSGQMessageView();
+};
+
 class MSGQSubSocket : public SubSocket {
 private:
   msgq_queue_t * q = NULL;
   int timeout;
+  MSGQMessageView view;
+  template <typename RecvFn> int receive_blocking(RecvFn recv, bool non_blocking);
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
   Message *receive(bool non_blocking=false);
+  MessageView *receive_view(bool non_blocking=false);
   ~MSGQSubSocket();
 };
 
@@ -47,9 +63,12 @@ class MSGQPubSocket : public PubSocket {
 private:
   msgq_queue_t * q = NULL;
 public:
-  int connect(Context *context, std::string endpoint, bool check_endpoint=true);
+  int connect(Context *context, std::string endpoint, bool check_endpoint=true, size_t segment_size=0);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int send_batch(char **data, size_t *sizes, size_t num_msgs);
+  char *reserve(size_t size);
+  int commit();
   bool all_readers_updated();
   ~MSGQPubSocket();
 };
@@ -56,6 +56,23 @@ ZMQMessage::~ZMQMessage() {
   this->close();
 }
 
+zmq_msg_t * ZMQMessageView::init() {
+  release();
+  assert(zmq_msg_init(&msg) == 0);
+  active = true;
+  return &msg;
+}
+
+void ZMQMessageView::release() {
+  if (active){
+    zmq_msg_close(&msg);
+  }
+  active = false;
+}
+
+ZMQMessageView::~ZMQMessageView() {
+  this->release();
+}
 
 int ZMQSubSocket::connect(Context *context, std::string endpoint, std::string address, bool conflate, bool check_endpoint){
   sock = zmq_socket(context->getRawContext(), ZMQ_SUB);
@@ -103,15 +120,28 @@ Message * ZMQSubSocket::receive(bool non_blocking){
   return r;
 }
 
+MessageView * ZMQSubSocket::receive_view(bool non_blocking){
+  // The view keeps the zmq message alive instead of copying it, so the data is not guaranteed to be aligned
+  int flags = non_blocking ? ZMQ_DONTWAIT : 0;
+  int rc = zmq_msg_recv(view.init(), sock, flags);
+  if (rc < 0){
+    view.release();
+    return NULL;
+  }
+
+  return &view;
+}
+
 void ZMQSubSocket::setTimeout(int timeout){
   zmq_setsockopt(sock, ZMQ_RCVTIMEO, &timeout, sizeof(int));
 }
 
 ZMQSubSocket::~ZMQSubSocket(){
+  view.release();
   zmq_close(sock);
 }
 
-int ZMQPubSocket::connect(Context *context, std::string endpoint, bool check_endpoint){
+int ZMQPubSocket::connect(Context *context, std::string endpoint, bool check_endpoint, size_t segment_size){
   sock = zmq_socket(context->getRawContext(), ZMQ_PUB);
   if (sock == NULL){
     return -1;
@@ -140,6 +170,26 @@ int ZMQPubSocket::send(char *data, size_t size) {
   return zmq_send(sock, data, size, ZMQ_DONTWAIT);
 }
 
+int ZMQPubSocket::send_batch(char **data, size_t *sizes, size_t num_msgs) {
+  assert(pid == getpid());
+  for (size_t i = 0; i < num_msgs; i++) {
+    if (zmq_send(sock, data[i], sizes[i], ZMQ_DONTWAIT) < 0) {
+      return -1;
+    }
+  }
+  return num_msgs;
+}
+
+// ZMQ copies the message anyway, so this only saves the caller from managing a buffer
+char *ZMQPubSocket::reserve(size_t size) {
+  reserved.resize(size);
+  return reserved.data();
+}
+
+int ZMQPubSocket::commit() {
+  return send(reserved.data(), reserved.size());
+}
+
 bool ZMQPubSocket::all_readers_updated() {
   assert(false); // TODO not implemented
   return false;
@@ -30,15 +30,30 @@ public:
   ~ZMQMessage();
 };
 
+class ZMQMessageView : public MessageView {
+private:
+  zmq_msg_t msg;
+  bool active = false;
+public:
+  zmq_msg_t *init();
+  size_t getSize(){return active ? zmq_msg_size(&msg) : 0;}
+  const char * getData(){return active ? (const char*)zmq_msg_data(&msg) : NULL;}
+  bool valid(){return active;}
+  void release();
+  ~ZMQMessageView();
+};
+
 class ZMQSubSocket : public SubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  ZMQMessageView view;
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return sock;}
   Message *receive(bool non_blocking=false);
+  MessageView *receive_view(bool non_blocking=false);
   ~ZMQSubSocket();
 };
 
@@ -47,10 +62,14 @@ private:
   void * sock;
   std::string full_endpoint;
   int pid = -1;
+  std::vector<char> reserved;
 public:
-  int connect(Context *context, std::string endpoint, bool check_endpoint=true);
+  int connect(Context *context, std::string endpoint, bool check_endpoint=true, size_t segment_size=0);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  int send_batch(char **data, size_t *sizes, size_t num_msgs);
+  char *reserve(size_t size);
+  int commit();
   bool all_readers_updated();
   ~ZMQPubSocket();
 };
@@ -82,9 +82,9 @@ PubSocket * PubSocket::create(){
   return s;
 }
 
-PubSocket * PubSocket::create(Context * context, std::string endpoint, bool check_endpoint){
+PubSocket * PubSocket::create(Context * context, std::string endpoint, bool check_endpoint, size_t segment_size){
   PubSocket *s = PubSocket::create();
-  int r = s->connect(context, endpoint, check_endpoint);
+  int r = s->connect(context, endpoint, check_endpoint, segment_size);
 
   if (r == 0) {
     return s;
@@ -34,12 +34,24 @@ public:
   virtual ~Message(){}
 };
 
+// Read-only message borrowed from the socket. It stays alive until the next
+// receive on the same socket, or until release() is called. Check valid()
+// after parsing, the publisher may have overwritten the data in the meantime.
+class MessageView {
+public:
+  virtual size_t getSize() = 0;
+  virtual const char * getData() = 0;
+  virtual bool valid() = 0;
+  virtual void release() = 0;
+  virtual ~MessageView(){}
+};
 
 class SubSocket {
 public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  virtual MessageView *receive_view(bool non_blocking=false) = 0;
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
@@ -48,12 +60,16 @@ public:
 
 class PubSocket {
 public:
-  virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true) = 0;
+  virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true, size_t segment_size=0) = 0;
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
+  virtual int send_batch(char **data, size_t *sizes, size_t num_msgs) = 0;
+  // Build a message in place: fill the buffer returned by reserve, then send it with commit
+  virtual char *reserve(size_t size) = 0;
+  virtual int commit() = 0;
   virtual bool all_readers_updated() = 0;
   static PubSocket * create();
-  static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
+  static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true, size_t segment_size=0);
   static PubSocket * create(Context * context, std::string endpoint, int port, bool check_endpoint=true);
   virtual ~PubSocket(){}
 };
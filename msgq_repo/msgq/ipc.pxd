@@ -4,6 +4,7 @@
 from libcpp.string cimport string
 from libcpp.vector cimport vector
 from libcpp cimport bool
+from libc.stdint cimport uint64_t
 
 
 cdef extern from "msgq/impl_fake.h":
@@ -56,9 +57,10 @@ cdef extern from "msgq/ipc.h":
   cdef cppclass PubSocket:
     @staticmethod
     PubSocket * create()
-    int connect(Context *, string)
+    int connect(Context *, string, bool, size_t)
     int sendMessage(Message *)
     int send(char *, size_t)
+    int send_batch(char **, size_t *, size_t)
     bool all_readers_updated()
 
   cdef cppclass Poller:
@@ -66,3 +68,16 @@ cdef extern from "msgq/ipc.h":
     Poller * create()
     void registerSocket(SubSocket *)
     vector[SubSocket*] poll(int) nogil
+
+
+cdef extern from "msgq/msgq.h":
+  cdef struct msgq_queue_stats_t:
+    uint64_t segment_size
+    uint64_t peak_used
+    uint64_t max_msg_size
+    uint64_t num_readers
+    uint64_t num_evictions
+    uint64_t num_reclaims
+    uint64_t num_invalidations
+
+  int msgq_queue_stats(const char *, msgq_queue_stats_t *)
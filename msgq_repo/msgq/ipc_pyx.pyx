@@ -16,6 +16,7 @@ from .ipc cimport PubSocket as cppPubSocket
 from .ipc cimport Poller as cppPoller
 from .ipc cimport Message as cppMessage
 from .ipc cimport Event as cppEvent, SocketEventHandle as cppSocketEventHandle
+from .ipc cimport msgq_queue_stats_t, msgq_queue_stats
 
 
 class IpcError(Exception):
@@ -45,6 +46,22 @@ def delete_fake_prefix():
   cppSocketEventHandle.set_fake_prefix(b"")
 
 
+def queue_stats(string endpoint):
+  cdef msgq_queue_stats_t stats
+  if msgq_queue_stats(endpoint.c_str(), &stats) != 0:
+    return None
+
+  return {
+    'segment_size': stats.segment_size,
+    'peak_used': stats.peak_used,
+    'max_msg_size': stats.max_msg_size,
+    'num_readers': stats.num_readers,
+    'num_evictions': stats.num_evictions,
+    'num_reclaims': stats.num_reclaims,
+    'num_invalidations': stats.num_invalidations,
+  }
+
+
 def wait_for_one_event(list events, int timeout=-1):
   cdef vector[cppEvent] items
   for event in events:
@@ -228,8 +245,8 @@ cdef class PubSocket:
   def __dealloc__(self):
     del self.socket
 
-  def connect(self, Context context, string endpoint):
-    r = self.socket.connect(context.context, endpoint)
+  def connect(self, Context context, string endpoint, size_t segment_size=0):
+    r = self.socket.connect(context.context, endpoint, True, segment_size)
 
     if r != 0:
       if errno.errno == errno.EADDRINUSE:
@@ -247,5 +264,21 @@ cdef class PubSocket:
       else:
         raise IpcError
 
+  def send_batch(self, list msgs):
+    cdef vector[char*] data
+    cdef vector[size_t] sizes
+    cdef bytes m
+    for m in msgs:
+      data.push_back(<char*>m)
+      sizes.push_back(len(m))
+
+    r = self.socket.send_batch(data.data(), sizes.data(), len(msgs))
+
+    if r != len(msgs):
+      if errno.errno == errno.EADDRINUSE:
+        raise MultiplePublishersError
+      else:
+        raise IpcError
+
   def all_readers_updated(self):
     return self.socket.all_readers_updated()
@@ -21,6 +21,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
 #include <stdio.h>
 
 #include "msgq/msgq.h"
@@ -29,6 +33,49 @@ void sigusr2_handler(int signal) {
   assert(signal == SIGUSR2);
 }
 
+#ifdef __linux__
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+#ifndef FUTEX_32
+#define FUTEX_32 2
+#endif
+
+// Matches struct futex_waitv from linux/futex.h, which older kernel headers don't have
+struct msgq_futex_waitv {
+  uint64_t val;
+  uint64_t uaddr;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+static std::atomic<bool> futex_waitv_supported(true);
+
+static int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, const struct timespec *deadline) {
+  // Not FUTEX_PRIVATE_FLAG, the futex word lives in shared memory
+  return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET, expected, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static int futex_wait_multiple(msgq_futex_waitv *waiters, size_t n, const struct timespec *deadline) {
+  return syscall(SYS_futex_waitv, waiters, n, 0, deadline, CLOCK_MONOTONIC);
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, std::numeric_limits<int>::max(), NULL, NULL, 0);
+}
+#endif
+
+// Force the signal based wakeup, useful for comparing against the futex path
+static bool msgq_use_signal_wakeup() {
+#ifdef __linux__
+  static const bool use_signal = std::getenv("MSGQ_SIGNAL_WAKEUP") != nullptr;
+  return use_signal;
+#else
+  return true;
+#endif
+}
+
 uint64_t msgq_get_uid(void){
   std::random_device rd("/dev/urandom");
   std::uniform_int_distribution<uint64_t> distribution(0, std::numeric_limits<uint32_t>::max());
@@ -83,16 +130,20 @@ void msgq_wait_for_subscriber(msgq_queue_t *q){
   return;
 }
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
-  assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
-  std::signal(SIGUSR2, sigusr2_handler);
-
+static std::string msgq_full_path(const std::string &path){
   std::string full_path = "/dev/shm/";
   const char* prefix = std::getenv("OPENPILOT_PREFIX");
   if (prefix) {
     full_path += std::string(prefix) + "/";
   }
   full_path += path;
+  return full_path;
+}
+
+// Maps the queue file, growing it to at least size bytes of data. Queues never
+// shrink while in use, other processes may still map the old size.
+static int msgq_map_queue(msgq_queue_t * q, size_t size, bool remap){
+  std::string full_path = msgq_full_path(q->endpoint);
 
   auto fd = open(full_path.c_str(), O_RDWR | O_CREAT, 0664);
   if (fd < 0) {
@@ -100,17 +151,33 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
     return -1;
   }
 
-  int rc = ftruncate(fd, size + sizeof(msgq_header_t));
-  if (rc < 0){
+  struct stat st;
+  if (fstat(fd, &st) < 0){
     close(fd);
     return -1;
   }
+
+  size_t existing_size = (size_t)st.st_size > sizeof(msgq_header_t) ? st.st_size - sizeof(msgq_header_t) : 0;
+  size = std::max(size, existing_size);
+  assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
+
+  if ((size_t)st.st_size < size + sizeof(msgq_header_t)){
+    int rc = ftruncate(fd, size + sizeof(msgq_header_t));
+    if (rc < 0){
+      close(fd);
+      return -1;
+    }
+  }
   char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
   close(fd);
 
   if (mem == MAP_FAILED){
     return -1;
   }
+
+  if (remap){
+    msgq_close_queue(q);
+  }
   q->mmap_p = mem;
 
   msgq_header_t *header = (msgq_header_t *)mem;
@@ -119,21 +186,45 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
-
-  for (size_t i = 0; i < NUM_READERS; i++){
+  q->write_seq = reinterpret_cast<std::atomic<uint32_t>*>(&header->write_seq);
+  q->num_waiters = reinterpret_cast<std::atomic<uint32_t>*>(&header->num_waiters);
+  q->segment_size = reinterpret_cast<std::atomic<uint64_t>*>(&header->segment_size);
+  q->peak_used = reinterpret_cast<std::atomic<uint64_t>*>(&header->peak_used);
+  q->max_msg_size = reinterpret_cast<std::atomic<uint64_t>*>(&header->max_msg_size);
+  q->num_invalidations = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_invalidations);
+  q->max_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->max_readers);
+  q->num_evictions = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_evictions);
+  q->num_reclaims = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_reclaims);
+
+  for (size_t i = 0; i < MAX_READERS; i++){
     q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
     q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
     q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
+    q->read_waiting[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_waiting[i]);
+    q->read_active[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_active[i]);
   }
 
   q->data = mem + sizeof(msgq_header_t);
   q->size = size;
-  q->reader_id = -1;
+
+  // Let readers that map a smaller size know they have to remap
+  uint64_t cur_size = *q->segment_size;
+  while (cur_size < size && !std::atomic_compare_exchange_strong(q->segment_size, &cur_size, (uint64_t)size)){}
+
+  return 0;
+}
+
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
+  std::signal(SIGUSR2, sigusr2_handler);
 
   q->endpoint = path;
   q->read_conflate = false;
+  q->reader_id = -1;
+  q->reserved = NULL;
+  q->reserved_size = 0;
+  q->num_resets = 0;
 
-  return 0;
+  return msgq_map_queue(q, size, false);
 }
 
 void msgq_close_queue(msgq_queue_t *q){
@@ -150,9 +241,10 @@ void msgq_init_publisher(msgq_queue_t * q) {
   *q->write_uid = uid;
   *q->num_readers = 0;
 
-  for (size_t i = 0; i < NUM_READERS; i++){
+  for (size_t i = 0; i < MAX_READERS; i++){
     *q->read_valids[i] = false;
     *q->read_uids[i] = 0;
+    *q->read_waiting[i] = false;
   }
 
   q->write_uid_local = uid;
@@ -167,33 +259,120 @@ static void thread_signal(uint32_t tid) {
   #endif
 }
 
+static void msgq_notify_readers(msgq_queue_t *q, uint64_t num_readers) {
+  // Bump the sequence first, a reader that is about to wait will see the change and return immediately
+  q->write_seq->fetch_add(1);
+
+#ifdef __linux__
+  if (*q->num_waiters > 0){
+    futex_wake(q->write_seq);
+  }
+#endif
+
+  // Readers without futex support sleep in the poll and need a signal
+  for (uint64_t i = 0; i < num_readers; i++){
+    if (*q->read_waiting[i]){
+      uint64_t reader_uid = *q->read_uids[i];
+      thread_signal(reader_uid & 0xFFFFFFFF);
+    }
+  }
+}
+
+static bool thread_alive(uint32_t tid) {
+  #ifndef SYS_tkill
+    int r = kill(tid, 0);
+  #else
+    int r = syscall(SYS_tkill, tid, 0);
+  #endif
+  return r == 0 || errno != ESRCH;
+}
+
+void msgq_set_max_readers(msgq_queue_t * q, uint64_t max_readers) {
+  *q->max_readers = std::clamp<uint64_t>(max_readers, 1, MAX_READERS);
+}
+
+uint64_t msgq_get_max_readers(msgq_queue_t * q) {
+  uint64_t max_readers = *q->max_readers;
+  return max_readers == 0 ? NUM_READERS : max_readers;
+}
+
+// Pick the slot to give to a new reader when all slots are taken. Slots of
+// readers that exited are reused first, then readers that fell behind and
+// were invalidated, then the reader that received least recently.
+static int msgq_find_reclaimable_slot(msgq_queue_t * q, uint64_t num_readers, bool *live) {
+  uint32_t write_seq = *q->write_seq;
+  int best = -1;
+  bool best_valid = true;
+  uint32_t best_age = 0;
+
+  for (uint64_t i = 0; i < num_readers; i++){
+    uint64_t reader_uid = *q->read_uids[i];
+    if (reader_uid == 0 || !thread_alive(reader_uid & 0xFFFFFFFF)){
+      *live = false;
+      return i;
+    }
+
+    bool valid = *q->read_valids[i];
+    uint32_t age = write_seq - (uint32_t)*q->read_active[i];
+    if (best == -1 || (best_valid && !valid) || (best_valid == valid && age > best_age)){
+      best = i;
+      best_valid = valid;
+      best_age = age;
+    }
+  }
+
+  *live = true;
+  return best;
+}
+
 void msgq_init_subscriber(msgq_queue_t * q) {
   assert(q != NULL);
   assert(q->num_readers != NULL);
 
+  // The publisher grew the queue
+  if (q->size != *q->segment_size){
+    int r = msgq_map_queue(q, 0, true);
+    assert(r == 0);
+    UNUSED(r);
+  }
+
   uint64_t uid = msgq_get_uid();
+  int id = -1;
 
   // Get reader id
   while (true){
     uint64_t cur_num_readers = *q->num_readers;
     uint64_t new_num_readers = cur_num_readers + 1;
 
-    // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
-      //std::cout << "Warning, evicting all subscribers!" << std::endl;
-      *q->num_readers = 0;
-
-      for (size_t i = 0; i < NUM_READERS; i++){
-        *q->read_valids[i] = false;
-
-        uint64_t old_uid = *q->read_uids[i];
-        *q->read_uids[i] = 0;
+    // No more slots available. Take over the slot of a dead or inactive reader
+    if (new_num_readers > msgq_get_max_readers(q)){
+      bool live = false;
+      id = msgq_find_reclaimable_slot(q, std::min<uint64_t>(cur_num_readers, MAX_READERS), &live);
+      uint64_t old_uid = *q->read_uids[id];
 
-        // Wake up reader in case they are in a poll
-        thread_signal(old_uid & 0xFFFFFFFF);
+      // Another subscriber may be claiming the same slot
+      if (!std::atomic_compare_exchange_strong(q->read_uids[id], &old_uid, uid)){
+        continue;
       }
 
-      continue;
+      if (live){
+        //std::cout << "Warning, evicting subscriber " << id << " " << q->endpoint << std::endl;
+        (*q->num_evictions)++;
+
+        // Wake up the evicted reader in case it is in a poll, so it can reconnect
+        if (*q->read_waiting[id]){
+          thread_signal(old_uid & 0xFFFFFFFF);
+        }
+        q->write_seq->fetch_add(1);
+#ifdef __linux__
+        if (*q->num_waiters > 0){
+          futex_wake(q->write_seq);
+        }
+#endif
+      } else {
+        (*q->num_reclaims)++;
+      }
+      break;
     }
 
     // Use atomic compare and swap to handle race condition
@@ -201,41 +380,53 @@ void msgq_init_subscriber(msgq_queue_t * q) {
     if (std::atomic_compare_exchange_strong(q->num_readers,
                                             &cur_num_readers,
                                             new_num_readers)){
-      q->reader_id = cur_num_readers;
-      q->read_uid_local = uid;
-
-      // We start with read_valid = false,
-      // on the first read the read pointer will be synchronized with the write pointer
-      *q->read_valids[cur_num_readers] = false;
-      *q->read_pointers[cur_num_readers] = 0;
-      *q->read_uids[cur_num_readers] = uid;
+      id = cur_num_readers;
+      *q->read_uids[id] = uid;
       break;
     }
   }
 
+  q->reader_id = id;
+  q->read_uid_local = uid;
+
+  // We start with read_valid = false,
+  // on the first read the read pointer will be synchronized with the write pointer
+  *q->read_valids[id] = false;
+  *q->read_pointers[id] = 0;
+  *q->read_waiting[id] = false;
+  *q->read_active[id] = *q->write_seq;
+
   //std::cout << "New subscriber id: " << q->reader_id << " uid: " << q->read_uid_local << " " << q->endpoint << std::endl;
   msgq_reset_reader(q);
 }
 
-int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+static void msgq_invalidate_reader(msgq_queue_t *q, uint64_t i){
+  // Count readers that lose messages, not readers that were already invalid
+  if (q->read_valids[i]->exchange(false)){
+    (*q->num_invalidations)++;
+  }
+}
+
+static bool msgq_check_publisher(msgq_queue_t *q){
   // Die if we are no longer the active publisher
   if (q->write_uid_local != *q->write_uid){
     std::cout << "Killing old publisher: " << q->endpoint << std::endl;
     errno = EADDRINUSE;
-    return -1;
+    return false;
   }
+  return true;
+}
 
-  uint64_t total_msg_size = ALIGN(msg->size + sizeof(int64_t));
+// Makes room for a message of the given size at the local write pointer, wrapping around
+// and invalidating readers as needed. Returns where the size tag of the message goes.
+// The shared write pointer is only updated on wraparound, the caller publishes the final position.
+static char *msgq_msg_prepare(size_t size, msgq_queue_t *q, uint64_t num_readers, uint32_t &write_cycles, uint32_t &write_pointer){
+  uint64_t total_msg_size = ALIGN(size + sizeof(int64_t));
 
   // We need to fit at least three messages in the queue,
   // then we can always safely access the last message
   assert(3 * total_msg_size <= q->size);
 
-  uint64_t num_readers = *q->num_readers;
-
-  uint32_t write_cycles, write_pointer;
-  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
-
   char *p = q->data + write_pointer; // add base offset
 
   // Check remaining space
@@ -253,7 +444,7 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
       read_pointer &= 0xFFFFFFFF;
 
       if ((read_pointer > write_pointer) && (read_cycles != write_cycles)) {
-        *q->read_valids[i] = false;
+        msgq_invalidate_reader(q, i);
       }
     }
 
@@ -268,17 +459,35 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
 
   // Invalidate readers that are in the area that will be written
   uint64_t start = write_pointer;
-  uint64_t end = ALIGN(start + sizeof(int64_t) + msg->size);
+  uint64_t end = ALIGN(start + sizeof(int64_t) + size);
+
+  uint64_t used = 0;
 
   for (uint64_t i = 0; i < num_readers; i++){
     uint32_t read_cycles, read_pointer;
     UNPACK64(read_cycles, read_pointer, *q->read_pointers[i]);
 
     if ((read_pointer >= start) && (read_pointer < end) && (read_cycles != write_cycles)) {
-      *q->read_valids[i] = false;
+      msgq_invalidate_reader(q, i);
+    } else if (*q->read_valids[i] && (write_cycles - read_cycles) <= 1) {
+      // Bytes this reader still has to read after this message, used to tune the segment size
+      used = std::max(used, (uint64_t)(write_cycles - read_cycles) * q->size + end - read_pointer);
     }
   }
 
+  if (used > *q->peak_used){
+    *q->peak_used = used;
+  }
+  if (size > *q->max_msg_size){
+    *q->max_msg_size = size;
+  }
+
+  return p;
+}
+
+// Writes a message at the local write pointer and advances it
+static void msgq_msg_write(msgq_msg_t *msg, msgq_queue_t *q, uint64_t num_readers, uint32_t &write_cycles, uint32_t &write_pointer){
+  char *p = msgq_msg_prepare(msg->size, q, num_readers, write_cycles, write_pointer);
 
   // Write size tag
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
@@ -288,26 +497,94 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
   memcpy(p + sizeof(int64_t), msg->data, msg->size);
   __sync_synchronize();
 
+  write_pointer = ALIGN(write_pointer + msg->size + sizeof(int64_t));
+}
+
+int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  if (!msgq_check_publisher(q)){
+    return -1;
+  }
+
+  uint64_t num_readers = *q->num_readers;
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  msgq_msg_write(msg, q, num_readers, write_cycles, write_pointer);
+
   // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
-  PACK64(*q->write_pointer, write_cycles, new_ptr);
+  PACK64(*q->write_pointer, write_cycles, write_pointer);
 
   // Notify readers
-  for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
-  }
+  msgq_notify_readers(q, num_readers);
 
   return msg->size;
 }
 
+int msgq_msg_send_batch(msgq_msg_t *msgs, size_t num_msgs, msgq_queue_t *q){
+  if (!msgq_check_publisher(q)){
+    return -1;
+  }
+
+  uint64_t num_readers = *q->num_readers;
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  for (size_t i = 0; i < num_msgs; i++){
+    msgq_msg_write(&msgs[i], q, num_readers, write_cycles, write_pointer);
+  }
+
+  // Readers see the whole batch at once
+  PACK64(*q->write_pointer, write_cycles, write_pointer);
+  msgq_notify_readers(q, num_readers);
+
+  return num_msgs;
+}
+
+char *msgq_msg_reserve(msgq_queue_t *q, size_t size){
+  assert(q->reserved == NULL);
+  if (!msgq_check_publisher(q)){
+    return NULL;
+  }
+
+  uint64_t num_readers = *q->num_readers;
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  q->reserved = msgq_msg_prepare(size, q, num_readers, write_cycles, write_pointer);
+  q->reserved_size = size;
+  return q->reserved + sizeof(int64_t);
+}
+
+int msgq_msg_commit(msgq_queue_t *q){
+  assert(q->reserved != NULL);
+  size_t size = q->reserved_size;
+
+  // Write size tag after the data, readers can't see either until the write pointer moves
+  std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(q->reserved);
+  *size_p = size;
+  __sync_synchronize();
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+  write_pointer = ALIGN((q->reserved - q->data) + size + sizeof(int64_t));
+  q->reserved = NULL;
+
+  PACK64(*q->write_pointer, write_cycles, write_pointer);
+  msgq_notify_readers(q, *q->num_readers);
+
+  return size;
+}
+
 
 int msgq_msg_ready(msgq_queue_t * q){
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
 
-  if (q->read_uid_local != *q->read_uids[id]){
+  if (q->read_uid_local != *q->read_uids[id] || q->size != *q->segment_size){
     //std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
     msgq_init_subscriber(q);
     goto start;
@@ -315,6 +592,7 @@ int msgq_msg_ready(msgq_queue_t * q){
 
   // Check valid
   if (!*q->read_valids[id]){
+    q->num_resets++;
     msgq_reset_reader(q);
     goto start;
   }
@@ -331,12 +609,12 @@ int msgq_msg_ready(msgq_queue_t * q){
   return (read_pointer != write_pointer);
 }
 
-int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+int msgq_msg_recv_view(msgq_msg_view_t * view, msgq_queue_t * q){
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
 
-  if (q->read_uid_local != *q->read_uids[id]){
+  if (q->read_uid_local != *q->read_uids[id] || q->size != *q->segment_size){
     //std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
     msgq_init_subscriber(q);
     goto start;
@@ -344,10 +622,14 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
 
   // Check valid
   if (!*q->read_valids[id]){
+    q->num_resets++;
     msgq_reset_reader(q);
     goto start;
   }
 
+  // Used to find the least recently active reader when slots run out
+  *q->read_active[id] = *q->write_seq;
+
   uint32_t read_cycles, read_pointer;
   UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
 
@@ -359,7 +641,8 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
 
   // Check if new message is available
   if (read_pointer == write_pointer) {
-    msg->size = 0;
+    view->size = 0;
+    view->data = NULL;
     return 0;
   }
 
@@ -369,6 +652,7 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
 
   // Check if the size that was read is valid
   if (!*q->read_valids[id]){
+    q->num_resets++;
     msgq_reset_reader(q);
     goto start;
   }
@@ -396,34 +680,88 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
     }
   }
 
+  // The read pointer is left on this message until the view is released
+  view->size = size;
+  view->data = p + sizeof(int64_t);
+  PACK64(view->generation, read_cycles, read_pointer);
+  PACK64(view->next_read_pointer, read_cycles, new_read_pointer);
+  __sync_synchronize();
+
+  return view->size;
+}
+
+bool msgq_msg_view_valid(const msgq_msg_view_t * view, msgq_queue_t * q){
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+
+  // The writer clears the validity flag before it overwrites the area under the read pointer
+  __sync_synchronize();
+  return view->size > 0 &&
+         q->read_uid_local == *q->read_uids[id] &&
+         *q->read_valids[id] &&
+         *q->read_pointers[id] == view->generation;
+}
+
+void msgq_msg_view_release(msgq_msg_view_t * view, msgq_queue_t * q){
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+
+  // Only advance if the reader was not reset or evicted in the meantime
+  if (view->size > 0 && q->read_uid_local == *q->read_uids[id]){
+    uint64_t expected = view->generation;
+    std::atomic_compare_exchange_strong(q->read_pointers[id], &expected, view->next_read_pointer);
+  }
+
+  view->size = 0;
+  view->data = NULL;
+}
+
+int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  msgq_msg_view_t view;
+
+ start:
+  int r = msgq_msg_recv_view(&view, q);
+  if (r <= 0) {
+    msg->size = 0;
+    return r;
+  }
+
   // Copy message
-  if (msgq_msg_init_size(msg, size) < 0)
+  if (msgq_msg_init_size(msg, view.size) < 0)
     return -1;
 
   __sync_synchronize();
-  memcpy(msg->data, p + sizeof(int64_t), size);
-  __sync_synchronize();
-
-  // Update read pointer
-  PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+  memcpy(msg->data, view.data, view.size);
 
   // Check if the actual data that was copied is valid
-  if (!*q->read_valids[id]){
+  // The reader is reset or reconnected by the next receive
+  if (!msgq_msg_view_valid(&view, q)){
     msgq_msg_close(msg);
-    msgq_reset_reader(q);
     goto start;
   }
 
+  // Update read pointer
+  msgq_msg_view_release(&view, q);
 
   return msg->size;
 }
 
 
 
-int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
+static void msgq_set_waiting(msgq_pollitem_t * items, size_t nitems, bool waiting){
+  for (size_t i = 0; i < nitems; i++) {
+    int id = items[i].q->reader_id;
+    if (id >= 0) {
+      *items[i].q->read_waiting[id] = waiting;
+    }
+  }
+}
+
+static int msgq_poll_signal(msgq_pollitem_t * items, size_t nitems, int timeout){
   int num = 0;
 
-  // Check if messages ready
+  // Ask the writer for a signal, then check again so a message sent in between isn't missed
+  msgq_set_waiting(items, nitems, true);
   for (size_t i = 0; i < nitems; i++) {
     items[i].revents = msgq_msg_ready(items[i].q);
     if (items[i].revents) num++;
@@ -454,15 +792,134 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
     }
   }
 
+  msgq_set_waiting(items, nitems, false);
   return num;
 }
 
+int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
+  int num = 0;
+
+  // Check if messages ready
+  for (size_t i = 0; i < nitems; i++) {
+    items[i].revents = msgq_msg_ready(items[i].q);
+    if (items[i].revents) num++;
+  }
+
+  if (num > 0 || timeout == 0 || nitems == 0) {
+    return num;
+  }
+
+#ifdef __linux__
+  bool use_futex = !msgq_use_signal_wakeup() && nitems <= MSGQ_MAX_POLL_ITEMS && (nitems == 1 || futex_waitv_supported);
+  if (!use_futex) {
+    return msgq_poll_signal(items, nitems, timeout);
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  if (timeout > 0) {
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+  }
+
+  msgq_futex_waitv waiters[MSGQ_MAX_POLL_ITEMS];
+
+  while (num == 0) {
+    // Register as waiter and sample the sequence before checking, the writer
+    // bumps the sequence after publishing so no wakeup can be missed
+    for (size_t i = 0; i < nitems; i++) {
+      msgq_queue_t *q = items[i].q;
+      q->num_waiters->fetch_add(1);
+      waiters[i] = {.val = *q->write_seq, .uaddr = (uint64_t)(uintptr_t)q->write_seq, .flags = FUTEX_32, .reserved = 0};
+    }
+
+    for (size_t i = 0; i < nitems; i++) {
+      items[i].revents = msgq_msg_ready(items[i].q);
+      if (items[i].revents) num++;
+    }
+
+    int ret = 0;
+    if (num == 0) {
+      const struct timespec *t = (timeout == -1) ? NULL : &deadline;
+      if (nitems == 1) {
+        ret = futex_wait(items[0].q->write_seq, (uint32_t)waiters[0].val, t);
+      } else {
+        ret = futex_wait_multiple(waiters, nitems, t);
+      }
+    }
+    int err = errno;
+
+    for (size_t i = 0; i < nitems; i++) {
+      items[i].q->num_waiters->fetch_sub(1);
+    }
+
+    if (ret < 0 && err == ENOSYS) {
+      futex_waitv_supported = false;
+      return msgq_poll_signal(items, nitems, timeout);
+    }
+
+    if (ret < 0 && err == ETIMEDOUT) {
+      break;
+    }
+  }
+
+  return num;
+#else
+  return msgq_poll_signal(items, nitems, timeout);
+#endif
+}
+
+// Readers that exited keep their slot until a new reader reclaims it, they are skipped
 bool msgq_all_readers_updated(msgq_queue_t *q) {
   uint64_t num_readers = *q->num_readers;
+  uint64_t num_live = 0;
   for (uint64_t i = 0; i < num_readers; i++) {
+    uint64_t reader_uid = *q->read_uids[i];
+    if (reader_uid == 0) continue;
     if (*q->read_valids[i] && *q->write_pointer != *q->read_pointers[i]) {
-      return false;
+      if (thread_alive(reader_uid & 0xFFFFFFFF)) return false;
+      continue;
     }
+    num_live++;
   }
-  return num_readers > 0;
+  return num_live > 0;
+}
+
+int msgq_queue_stats(const char * path, msgq_queue_stats_t * stats){
+  std::string full_path = msgq_full_path(path);
+
+  // Only look at existing queues, never create one
+  auto fd = open(full_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(msgq_header_t)){
+    close(fd);
+    return -1;
+  }
+
+  char * mem = (char*)mmap(NULL, sizeof(msgq_header_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED){
+    return -1;
+  }
+
+  msgq_header_t *header = (msgq_header_t *)mem;
+  stats->segment_size = st.st_size - sizeof(msgq_header_t);
+  stats->peak_used = header->peak_used;
+  stats->max_msg_size = header->max_msg_size;
+  stats->num_readers = header->num_readers;
+  stats->num_evictions = header->num_evictions;
+  stats->num_reclaims = header->num_reclaims;
+  stats->num_invalidations = header->num_invalidations;
+
+  munmap(mem, sizeof(msgq_header_t));
+  return 0;
 }
@@ -7,6 +7,8 @@
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
 #define NUM_READERS 15
+#define MAX_READERS 32
+#define MSGQ_MAX_POLL_ITEMS 128
 #define ALIGN(n) ((n + (8 - 1)) & -8)
 
 #define UNUSED(x) (void)x
@@ -17,18 +19,40 @@ struct  msgq_header_t {
   uint64_t num_readers;
   uint64_t write_pointer;
   uint64_t write_uid;
-  uint64_t read_pointers[NUM_READERS];
-  uint64_t read_valids[NUM_READERS];
-  uint64_t read_uids[NUM_READERS];
+  uint32_t write_seq;
+  uint32_t num_waiters;
+  uint64_t segment_size;
+  uint64_t peak_used;
+  uint64_t max_msg_size;
+  uint64_t num_invalidations;
+  uint64_t max_readers;
+  uint64_t num_evictions;
+  uint64_t num_reclaims;
+  uint64_t read_pointers[MAX_READERS];
+  uint64_t read_valids[MAX_READERS];
+  uint64_t read_uids[MAX_READERS];
+  uint64_t read_waiting[MAX_READERS];
+  uint64_t read_active[MAX_READERS];
 };
 
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
   std::atomic<uint64_t> *write_pointer;
   std::atomic<uint64_t> *write_uid;
-  std::atomic<uint64_t> *read_pointers[NUM_READERS];
-  std::atomic<uint64_t> *read_valids[NUM_READERS];
-  std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::atomic<uint32_t> *write_seq;
+  std::atomic<uint32_t> *num_waiters;
+  std::atomic<uint64_t> *segment_size;
+  std::atomic<uint64_t> *peak_used;
+  std::atomic<uint64_t> *max_msg_size;
+  std::atomic<uint64_t> *num_invalidations;
+  std::atomic<uint64_t> *max_readers;
+  std::atomic<uint64_t> *num_evictions;
+  std::atomic<uint64_t> *num_reclaims;
+  std::atomic<uint64_t> *read_pointers[MAX_READERS];
+  std::atomic<uint64_t> *read_valids[MAX_READERS];
+  std::atomic<uint64_t> *read_uids[MAX_READERS];
+  std::atomic<uint64_t> *read_waiting[MAX_READERS];
+  std::atomic<uint64_t> *read_active[MAX_READERS];
   char * mmap_p;
   char * data;
   size_t size;
@@ -36,6 +60,13 @@ struct msgq_queue_t {
   uint64_t read_uid_local;
   uint64_t write_uid_local;
 
+  // Times this reader fell behind, lost messages and skipped ahead to the writer
+  uint64_t num_resets;
+
+  // Message handed out by msgq_msg_reserve and not yet committed
+  char * reserved;
+  size_t reserved_size;
+
   bool read_conflate;
   std::string endpoint;
 };
@@ -45,6 +76,26 @@ struct msgq_msg_t {
   char * data;
 };
 
+// Read-only view into the ring buffer. The read pointer stays on the message
+// until the view is released, so the writer invalidates the reader before
+// overwriting the data. generation is the packed read pointer of the message.
+struct msgq_msg_view_t {
+  size_t size;
+  const char * data;
+  uint64_t generation;
+  uint64_t next_read_pointer;
+};
+
+struct msgq_queue_stats_t {
+  uint64_t segment_size;
+  uint64_t peak_used;
+  uint64_t max_msg_size;
+  uint64_t num_readers;
+  uint64_t num_evictions;
+  uint64_t num_reclaims;
+  uint64_t num_invalidations;
+};
+
 struct msgq_pollitem_t {
   msgq_queue_t *q;
   int revents;
@@ -61,10 +112,21 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
 void msgq_init_subscriber(msgq_queue_t * q);
+void msgq_set_max_readers(msgq_queue_t * q, uint64_t max_readers);
+uint64_t msgq_get_max_readers(msgq_queue_t * q);
 
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+int msgq_msg_send_batch(msgq_msg_t *msgs, size_t num_msgs, msgq_queue_t *q);
+// Returns a buffer of the given size inside the queue to build a message in place,
+// readers see nothing until msgq_msg_commit publishes it. Returns NULL if the publisher was replaced.
+char * msgq_msg_reserve(msgq_queue_t *q, size_t size);
+int msgq_msg_commit(msgq_queue_t *q);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
+int msgq_msg_recv_view(msgq_msg_view_t *view, msgq_queue_t *q);
+bool msgq_msg_view_valid(const msgq_msg_view_t *view, msgq_queue_t *q);
+void msgq_msg_view_release(msgq_msg_view_t *view, msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
 
 bool msgq_all_readers_updated(msgq_queue_t *q);
+int msgq_queue_stats(const char * path, msgq_queue_stats_t * stats);
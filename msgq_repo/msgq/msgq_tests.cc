@@ -1,3 +1,9 @@
+#include <chrono>
+#include <thread>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include "catch2/catch.hpp"
 #include "msgq/msgq.h"
 
@@ -208,6 +214,7 @@ TEST_CASE("msgq_msg_send test invalidation")
   msgq_msg_send(&msg, &q_pub);
 
   REQUIRE(*q_sub.read_valids[0] == false);
+  REQUIRE(*q_pub.num_invalidations == 1);
 
   msgq_msg_close(&msg);
 }
@@ -387,6 +394,8 @@ TEST_CASE("1 publisher, 1 slow subscriber", "[integration]")
   // TODO: verify these numbers by hand
   REQUIRE(n_received == 8572);
   REQUIRE(n_skipped == 1428);
+  REQUIRE(reader.num_resets > 0);
+  REQUIRE(writer.num_resets == 0);
 }
 
 TEST_CASE("1 publisher, 2 subscribers", "[integration]")
@@ -422,3 +431,373 @@ TEST_CASE("1 publisher, 2 subscribers", "[integration]")
     msgq_msg_close(&msg2);
   }
 }
+
+TEST_CASE("msgq_msg_recv_view", "[integration]")
+{
+  remove("/dev/shm/test_queue");
+  const size_t msg_size = 120;
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  msgq_msg_t outgoing_msg;
+  msgq_msg_init_size(&outgoing_msg, msg_size);
+  for (size_t i = 0; i < msg_size; i++)
+  {
+    outgoing_msg.data[i] = i;
+  }
+  REQUIRE(msgq_msg_send(&outgoing_msg, &writer) == msg_size);
+
+  msgq_msg_view_t view;
+  REQUIRE(msgq_msg_recv_view(&view, &reader) == msg_size);
+  REQUIRE(view.data == reader.data + sizeof(int64_t)); // Points into the ring buffer
+  REQUIRE(memcmp(view.data, outgoing_msg.data, msg_size) == 0);
+  REQUIRE(msgq_msg_view_valid(&view, &reader));
+
+  SECTION("Release advances read pointer")
+  {
+    msgq_msg_view_release(&view, &reader);
+    REQUIRE(*reader.read_pointers[0] == *writer.write_pointer);
+    REQUIRE(msgq_msg_recv_view(&view, &reader) == 0);
+  }
+  SECTION("Writer overrun invalidates view")
+  {
+    for (int i = 0; i < 8; i++)
+    {
+      msgq_msg_send(&outgoing_msg, &writer);
+    }
+    REQUIRE(!msgq_msg_view_valid(&view, &reader));
+
+    // Releasing an invalid view doesn't move the reader, the next receive resets it
+    msgq_msg_view_release(&view, &reader);
+    REQUIRE(msgq_msg_recv_view(&view, &reader) == 0);
+  }
+
+  msgq_msg_close(&outgoing_msg);
+}
+
+TEST_CASE("msgq_msg_send_batch", "[integration]")
+{
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  const size_t num_msgs = 5;
+  msgq_msg_t msgs[num_msgs];
+  for (size_t i = 0; i < num_msgs; i++){
+    msgq_msg_init_size(&msgs[i], 16 * (i + 1));
+    memset(msgs[i].data, i, msgs[i].size);
+  }
+
+  uint32_t write_seq = *writer.write_seq;
+
+  SECTION("Reader gets all messages in order"){
+    REQUIRE(msgq_msg_send_batch(msgs, num_msgs, &writer) == num_msgs);
+
+    // Write pointer advanced past all messages with a single wakeup
+    REQUIRE(*writer.write_seq == write_seq + 1);
+    REQUIRE(*writer.write_pointer == 16 * 1 + 16 * 2 + 16 * 3 + 16 * 4 + 16 * 5 + num_msgs * 8);
+
+    for (size_t i = 0; i < num_msgs; i++){
+      msgq_msg_t incoming;
+      REQUIRE(msgq_msg_recv(&incoming, &reader) == msgs[i].size);
+      REQUIRE(memcmp(incoming.data, msgs[i].data, msgs[i].size) == 0);
+      msgq_msg_close(&incoming);
+    }
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+  }
+  SECTION("Conflate reader gets last message"){
+    reader.read_conflate = true;
+    REQUIRE(msgq_msg_send_batch(msgs, num_msgs, &writer) == num_msgs);
+
+    msgq_msg_t incoming;
+    REQUIRE(msgq_msg_recv(&incoming, &reader) == msgs[num_msgs - 1].size);
+    REQUIRE(memcmp(incoming.data, msgs[num_msgs - 1].data, incoming.size) == 0);
+    msgq_msg_close(&incoming);
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+  }
+  SECTION("Batch wraps around"){
+    for (int i = 0; i < 4; i++){
+      REQUIRE(msgq_msg_send_batch(msgs, num_msgs, &writer) == num_msgs);
+      for (size_t j = 0; j < num_msgs; j++){
+        msgq_msg_t incoming;
+        REQUIRE(msgq_msg_recv(&incoming, &reader) == msgs[j].size);
+        REQUIRE(memcmp(incoming.data, msgs[j].data, msgs[j].size) == 0);
+        msgq_msg_close(&incoming);
+      }
+    }
+    REQUIRE(*writer.write_pointer >> 32 == 1);
+  }
+
+  for (size_t i = 0; i < num_msgs; i++){
+    msgq_msg_close(&msgs[i]);
+  }
+}
+
+TEST_CASE("msgq_msg_reserve", "[integration]")
+{
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  SECTION("Message is only visible after commit"){
+    char *buf = msgq_msg_reserve(&writer, 100);
+    REQUIRE(buf != NULL);
+    memset(buf, 0xab, 100);
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+
+    uint32_t write_seq = *writer.write_seq;
+    REQUIRE(msgq_msg_commit(&writer) == 100);
+    REQUIRE(*writer.write_seq == write_seq + 1);
+
+    msgq_msg_t incoming;
+    REQUIRE(msgq_msg_recv(&incoming, &reader) == 100);
+    for (size_t i = 0; i < incoming.size; i++){
+      REQUIRE((unsigned char)incoming.data[i] == 0xab);
+    }
+    msgq_msg_close(&incoming);
+    REQUIRE(msgq_msg_ready(&reader) == 0);
+  }
+  SECTION("Reserved messages wrap around"){
+    for (int i = 0; i < 20; i++){
+      char *buf = msgq_msg_reserve(&writer, 200);
+      REQUIRE(buf != NULL);
+      memset(buf, i, 200);
+      REQUIRE(msgq_msg_commit(&writer) == 200);
+
+      msgq_msg_t incoming;
+      REQUIRE(msgq_msg_recv(&incoming, &reader) == 200);
+      REQUIRE(incoming.data[0] == i);
+      REQUIRE(incoming.data[199] == i);
+      msgq_msg_close(&incoming);
+    }
+    REQUIRE(*writer.write_pointer >> 32 > 0);
+  }
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("msgq_poll wakes up on send", "[integration]")
+{
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  msgq_pollitem_t items[1];
+  items[0].q = &reader;
+
+  SECTION("Timeout without message")
+  {
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(msgq_poll(items, 1, 50) == 0);
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+  }
+  SECTION("Message sent while waiting")
+  {
+    std::thread t([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      msgq_msg_t msg;
+      msgq_msg_init_size(&msg, 8);
+      msgq_msg_send(&msg, &writer);
+      msgq_msg_close(&msg);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(msgq_poll(items, 1, 5000) == 1);
+    REQUIRE(items[0].revents == 1);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1000));
+    REQUIRE(*writer.num_waiters == 0);
+    t.join();
+  }
+}
+
+TEST_CASE("msgq_poll multiple queues", "[integration]")
+{
+  remove("/dev/shm/test_queue");
+  remove("/dev/shm/test_queue2");
+  msgq_queue_t writer, reader1, reader2;
+
+  msgq_new_queue(&writer, "test_queue2", 1024);
+  msgq_new_queue(&reader1, "test_queue", 1024);
+  msgq_new_queue(&reader2, "test_queue2", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader1);
+  msgq_init_subscriber(&reader2);
+
+  msgq_pollitem_t items[2];
+  items[0].q = &reader1;
+  items[1].q = &reader2;
+
+  std::thread t([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    msgq_msg_t msg;
+    msgq_msg_init_size(&msg, 8);
+    msgq_msg_send(&msg, &writer);
+    msgq_msg_close(&msg);
+  });
+
+  REQUIRE(msgq_poll(items, 2, 5000) == 1);
+  REQUIRE(items[0].revents == 0);
+  REQUIRE(items[1].revents == 1);
+  t.join();
+}
+
+TEST_CASE("msgq_init_subscriber all slots taken")
+{
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader1, reader2, reader3;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader1, "test_queue", 1024);
+  msgq_new_queue(&reader2, "test_queue", 1024);
+  msgq_new_queue(&reader3, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  msgq_set_max_readers(&writer, 2);
+  REQUIRE(msgq_get_max_readers(&reader1) == 2);
+
+  msgq_init_subscriber(&reader1);
+  msgq_init_subscriber(&reader2);
+
+  SECTION("Evict least recently active reader")
+  {
+    // Only reader1 keeps up with the writer
+    msgq_msg_t msg;
+    msgq_msg_init_size(&msg, 8);
+    msgq_msg_send(&msg, &writer);
+    msgq_msg_close(&msg);
+    msgq_msg_recv(&msg, &reader1);
+    msgq_msg_close(&msg);
+
+    msgq_init_subscriber(&reader3);
+    REQUIRE(reader3.reader_id == reader2.reader_id);
+    REQUIRE(*writer.num_evictions == 1);
+    REQUIRE(*writer.num_reclaims == 0);
+  }
+  SECTION("Reuse slot of exited reader")
+  {
+    uint64_t dead_tid = 0;
+    std::thread t([&]() { dead_tid = syscall(SYS_gettid); });
+    t.join();
+    *writer.read_uids[reader1.reader_id] = ((uint64_t)1 << 32) | dead_tid;
+
+    msgq_init_subscriber(&reader3);
+    REQUIRE(reader3.reader_id == reader1.reader_id);
+    REQUIRE(*writer.num_evictions == 0);
+    REQUIRE(*writer.num_reclaims == 1);
+  }
+
+  REQUIRE(*writer.num_readers == 2);
+  REQUIRE(*writer.read_uids[reader3.reader_id] == reader3.read_uid_local);
+}
+
+TEST_CASE("msgq_all_readers_updated")
+{
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader1, reader2;
+  msgq_new_queue(&writer, "test_queue", 1024);
+  msgq_new_queue(&reader1, "test_queue", 1024);
+  msgq_new_queue(&reader2, "test_queue", 1024);
+
+  msgq_init_publisher(&writer);
+  REQUIRE_FALSE(msgq_all_readers_updated(&writer));
+  msgq_init_subscriber(&reader1);
+  msgq_init_subscriber(&reader2);
+  REQUIRE(msgq_all_readers_updated(&writer));
+
+  msgq_msg_t msg;
+  msgq_msg_init_size(&msg, 8);
+  msgq_msg_send(&msg, &writer);
+  msgq_msg_close(&msg);
+  msgq_msg_recv(&msg, &reader1);
+  msgq_msg_close(&msg);
+  REQUIRE_FALSE(msgq_all_readers_updated(&writer));
+
+  SECTION("Reader catches up")
+  {
+    msgq_msg_recv(&msg, &reader2);
+    msgq_msg_close(&msg);
+    REQUIRE(msgq_all_readers_updated(&writer));
+  }
+  SECTION("Reader exited")
+  {
+    uint64_t dead_tid = 0;
+    std::thread t([&]() { dead_tid = syscall(SYS_gettid); });
+    t.join();
+    *writer.read_uids[reader2.reader_id] = ((uint64_t)1 << 32) | dead_tid;
+    REQUIRE(msgq_all_readers_updated(&writer));
+
+    // Without live readers nobody is updated
+    *writer.read_uids[reader1.reader_id] = ((uint64_t)1 << 32) | dead_tid;
+    msgq_msg_init_size(&msg, 8);
+    msgq_msg_send(&msg, &writer);
+    msgq_msg_close(&msg);
+    REQUIRE_FALSE(msgq_all_readers_updated(&writer));
+  }
+}
+
+TEST_CASE("Subscriber remaps queue sized by publisher", "[integration]")
+{
+  remove("/dev/shm/test_queue");
+  msgq_queue_t writer, reader;
+
+  // Subscriber starts first and doesn't know the size
+  msgq_new_queue(&reader, "test_queue", 0);
+  msgq_init_subscriber(&reader);
+  REQUIRE(reader.size == 0);
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 0);
+
+  msgq_new_queue(&writer, "test_queue", 2048);
+  msgq_init_publisher(&writer);
+  REQUIRE(*writer.segment_size == 2048);
+
+  msgq_msg_t outgoing_msg;
+  msgq_msg_init_size(&outgoing_msg, 128);
+  msgq_msg_send(&outgoing_msg, &writer);
+
+  // The first receive reconnects with the new size
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 0);
+  REQUIRE(reader.size == 2048);
+
+  msgq_msg_send(&outgoing_msg, &writer);
+  msgq_msg_send(&outgoing_msg, &writer);
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 128);
+  msgq_msg_close(&msg);
+
+  // A publisher asking for a smaller size keeps the existing one
+  msgq_queue_t writer2;
+  msgq_new_queue(&writer2, "test_queue", 1024);
+  REQUIRE(writer2.size == 2048);
+
+  msgq_queue_stats_t stats;
+  REQUIRE(msgq_queue_stats("test_queue", &stats) == 0);
+  REQUIRE(stats.segment_size == 2048);
+  REQUIRE(stats.max_msg_size == 128);
+  REQUIRE(stats.peak_used == 2 * (128 + sizeof(int64_t)));
+  REQUIRE(stats.num_readers == 1);
+  REQUIRE(msgq_queue_stats("test_queue_missing", &stats) == -1);
+
+  msgq_msg_close(&outgoing_msg);
+}
@@ -34,6 +34,18 @@ class TestPubSubSockets:
       recvd = sub_sock.receive()
       assert msg == recvd
 
+  def test_send_batch(self):
+    sock = random_sock()
+    pub_sock = msgq.pub_sock(sock)
+    sub_sock = msgq.sub_sock(sock, conflate=False, timeout=None)
+    zmq_sleep(3)
+
+    for _ in range(100):
+      msgs = [random_bytes(random.randint(1, 1000)) for _ in range(random.randint(1, 10))]
+      pub_sock.send_batch(msgs)
+      for msg in msgs:
+        assert sub_sock.receive() == msg
+
   def test_conflate(self):
     sock = random_sock()
     pub_sock = msgq.pub_sock(sock)
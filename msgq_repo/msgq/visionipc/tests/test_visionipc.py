@@ -97,3 +97,29 @@ class TestVisionIpc:
     assert recv_buf is None
     del self.client
     del self.server
+
+  def test_lease(self):
+    self.setup_vipc("camerad", VisionStreamType.VISION_STREAM_ROAD)
+
+    buf = np.zeros(self.client.buffer_len, dtype=np.uint8)
+    assert self.server.send(VisionStreamType.VISION_STREAM_ROAD, buf, frame_id=1)
+    assert self.client.recv() is not None
+    assert self.client.buf_valid()
+
+    # The only buffer is held by the client, it is overwritten unless a lease timeout is set
+    assert self.server.send(VisionStreamType.VISION_STREAM_ROAD, buf, frame_id=2)
+    assert not self.client.buf_valid()
+    assert self.client.recv() is not None
+    assert self.client.buf_valid()
+    self.server.set_lease_timeout(0)
+    assert not self.server.send(VisionStreamType.VISION_STREAM_ROAD, buf, frame_id=3)
+    self.client.release()
+    assert self.server.send(VisionStreamType.VISION_STREAM_ROAD, buf, frame_id=4)
+
+    stats = self.server.stats(VisionStreamType.VISION_STREAM_ROAD)
+    assert stats['num_overwrites'] == 1
+    assert stats['num_drops'] == 1
+    assert len(stats['clients']) == 1
+    assert stats['clients'][0]['num_leases'] == 2
+    del self.client
+    del self.server
@@ -5,6 +5,9 @@
 #include <assert.h>
 #include <errno.h>
 
+#include <atomic>
+
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -119,3 +122,29 @@ int ipc_sendrecv_with_fds(bool send, int fd, void *buf, size_t buf_size, int* fd
     return r;
   }
 }
+
+void *ipc_shm_alloc(size_t len, int *fd) {
+  static std::atomic<int> counter = 0;
+  char full_path[0x100];
+
+#ifdef __APPLE__
+  snprintf(full_path, sizeof(full_path)-1, "/tmp/visionipc_shm_%d_%d", getpid(), counter++);
+#else
+  snprintf(full_path, sizeof(full_path)-1, "/dev/shm/visionipc_shm_%d_%d", getpid(), counter++);
+#endif
+
+  *fd = open(full_path, O_RDWR | O_CREAT | O_TRUNC, 0664);
+  assert(*fd >= 0);
+  unlink(full_path);
+
+  int err = ftruncate(*fd, len);
+  assert(err == 0);
+
+  return ipc_shm_map(*fd, len);
+}
+
+void *ipc_shm_map(int fd, size_t len) {
+  void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(addr != MAP_FAILED);
+  return addr;
+}
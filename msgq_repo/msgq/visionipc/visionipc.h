@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
 
@@ -8,8 +9,23 @@ int ipc_connect(const char* socket_path);
 int ipc_bind(const char* socket_path);
 int ipc_sendrecv_with_fds(bool send, int fd, void *buf, size_t buf_size, int* fds, int num_fds,
                           int *out_num_fds);
+void *ipc_shm_alloc(size_t len, int *fd);
+void *ipc_shm_map(int fd, size_t len);
 
 constexpr int VISIONIPC_MAX_FDS = 128;
+constexpr int VISIONIPC_MAX_CLIENTS = 32;
+
+// Bucket i counts latencies in [2^i, 2^(i+1)) us, the last bucket everything above
+constexpr int VISIONIPC_LATENCY_BUCKETS = 16;
+inline int visionipc_latency_bucket(uint64_t latency_ns) {
+  uint64_t us = latency_ns / 1000;
+  int bucket = 0;
+  while (us > 1 && bucket < VISIONIPC_LATENCY_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
 
 struct VisionIpcBufExtra {
   uint32_t frame_id;
@@ -21,5 +37,35 @@ struct VisionIpcBufExtra {
 struct VisionIpcPacket {
   uint64_t server_id;
   size_t idx;
+  uint64_t gen;
+  uint64_t sent_ns;
   struct VisionIpcBufExtra extra;
 };
+
+// Slot of a client in the lease table, written by the client
+struct VisionIpcLease {
+  std::atomic<uint64_t> owner; // pid << 32 | client id, 0 if free
+  std::atomic<int32_t> held_idx; // buffer the client is reading, -1 if none
+  std::atomic<uint64_t> held_since_ns;
+
+  std::atomic<uint64_t> num_leases;
+  std::atomic<uint64_t> total_hold_ns;
+  std::atomic<uint64_t> max_hold_ns;
+  std::atomic<uint64_t> num_dropped; // buffer was being rewritten when received
+  std::atomic<uint64_t> num_replaced; // buffer already held a newer frame when received
+
+  // Telemetry
+  char name[16];
+  std::atomic<uint64_t> num_frames;
+  std::atomic<uint64_t> num_skipped; // gaps in frame_id
+  std::atomic<uint64_t> total_sync_ns;
+  std::atomic<uint64_t> max_sync_ns;
+  std::atomic<uint64_t> latency_hist[VISIONIPC_LATENCY_BUCKETS]; // send to receive
+};
+
+// Shared between the server and all clients of a stream type. The server makes the
+// generation of a buffer odd while it is being written, and even again when it is sent.
+struct VisionIpcLeaseTable {
+  std::atomic<uint64_t> gen[VISIONIPC_MAX_FDS];
+  VisionIpcLease clients[VISIONIPC_MAX_CLIENTS];
+};
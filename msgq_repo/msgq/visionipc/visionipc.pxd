@@ -41,6 +41,30 @@ cdef extern from "msgq/visionipc/visionipc.h":
 cdef extern from "msgq/visionipc/visionipc_server.h":
   string get_endpoint_name(string, VisionStreamType)
 
+  struct VisionIpcClientStats:
+    uint32_t pid
+    string name
+    bool holding
+    uint64_t num_leases
+    uint64_t total_hold_ns
+    uint64_t max_hold_ns
+    uint64_t num_dropped
+    uint64_t num_replaced
+    uint64_t num_frames
+    uint64_t num_skipped
+    uint64_t total_sync_ns
+    uint64_t max_sync_ns
+    vector[uint64_t] latency_hist
+
+  struct VisionIpcStats:
+    uint64_t num_sent
+    uint64_t num_stalls
+    uint64_t num_drops
+    uint64_t num_overwrites
+    uint64_t total_sync_ns
+    uint64_t max_sync_ns
+    vector[VisionIpcClientStats] clients
+
   cdef cppclass VisionIpcServer:
     VisionIpcServer(string, void*, void*)
     void create_buffers(VisionStreamType, size_t, size_t, size_t)
@@ -48,6 +72,8 @@ cdef extern from "msgq/visionipc/visionipc_server.h":
     VisionBuf * get_buffer(VisionStreamType)
     void send(VisionBuf *, VisionIpcBufExtra *, bool)
     void start_listener()
+    void set_lease_timeout(int)
+    VisionIpcStats get_stats(VisionStreamType)
 
 cdef extern from "msgq/visionipc/visionipc_client.h":
   cdef cppclass VisionIpcClient:
@@ -56,6 +82,8 @@ cdef extern from "msgq/visionipc/visionipc_client.h":
     VisionIpcClient(string, VisionStreamType, bool, void*, void*)
     VisionBuf * recv(VisionIpcBufExtra *, int)
     bool connect(bool)
+    void release()
+    bool valid(VisionBuf *)
     bool is_connected()
     @staticmethod
     set[VisionStreamType] getAvailableStreams(string, bool)
@@ -1,8 +1,12 @@
 #include <chrono>
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 #include <iostream>
 #include <thread>
 
+#include <signal.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include "msgq/visionipc/visionipc.h"
 #include "msgq/visionipc/visionipc_client.h"
@@ -20,6 +24,18 @@ static int connect_to_vipc_server(const std::string &name, bool blocking) {
   return socket_fd;
 }
 
+static uint64_t nanos_monotonic() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void get_process_name(char *name, size_t len) {
+#ifdef __APPLE__
+  snprintf(name, len, "%s", getprogname());
+#else
+  snprintf(name, len, "%s", program_invocation_short_name);
+#endif
+}
+
 VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id, cl_context ctx) : name(name), type(type), device_id(device_id), ctx(ctx) {
   msg_ctx = Context::create();
   sock = SubSocket::create(msg_ctx, get_endpoint_name(name, type), "127.0.0.1", conflate, false);
@@ -40,6 +56,8 @@ bool VisionIpcClient::connect(bool blocking){
   }
 
   num_buffers = 0;
+  last_frame_id = -1;
+  unmap_lease_table();
 
   int socket_fd = connect_to_vipc_server(name, blocking);
   if (socket_fd < 0) {
@@ -49,10 +67,11 @@ bool VisionIpcClient::connect(bool blocking){
   int r = ipc_sendrecv_with_fds(true, socket_fd, &type, sizeof(type), nullptr, 0, nullptr);
   assert(r == sizeof(type));
 
-  // Get FDs
+  // Get FDs, the last one is the lease table
   int fds[VISIONIPC_MAX_FDS];
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
+  int num_fds = 0;
+  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_fds);
   if (r < 0) {
     // only expected error is server shutting down
     assert(errno == ECONNRESET);
@@ -60,9 +79,35 @@ bool VisionIpcClient::connect(bool blocking){
     return false;
   }
 
-  assert(num_buffers >= 0);
+  assert(num_fds > 0);
+  num_buffers = num_fds - 1;
   assert(r == sizeof(VisionBuf) * num_buffers);
 
+  lease_table = (VisionIpcLeaseTable *)ipc_shm_map(fds[num_buffers], sizeof(VisionIpcLeaseTable));
+  close(fds[num_buffers]);
+
+  // Claim a free slot in the lease table, or one of a client that died
+  static std::atomic<uint32_t> client_id = 0;
+  uint64_t owner = ((uint64_t)getpid() << 32) | client_id++;
+  for (VisionIpcLease &l : lease_table->clients) {
+    uint64_t prev_owner = l.owner;
+    if (prev_owner != 0 && (kill(prev_owner >> 32, 0) == 0 || errno != ESRCH)) continue;
+
+    if (l.owner.compare_exchange_strong(prev_owner, owner)) {
+      l.held_idx = -1;
+      l.num_leases = l.total_hold_ns = l.max_hold_ns = 0;
+      l.num_dropped = l.num_replaced = 0;
+      l.num_frames = l.num_skipped = l.total_sync_ns = l.max_sync_ns = 0;
+      for (auto &bucket : l.latency_hist) bucket = 0;
+      get_process_name(l.name, sizeof(l.name));
+      lease = &l;
+      break;
+    }
+  }
+  if (lease == nullptr) {
+    LOGW("No free lease slot, buffers are not protected from being overwritten");
+  }
+
   // Import buffers
   for (size_t i = 0; i < num_buffers; i++){
     buffers[i] = bufs[i];
@@ -79,6 +124,8 @@ bool VisionIpcClient::connect(bool blocking){
 }
 
 VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_ms){
+  release();
+
   auto p = poller->poll(timeout_ms);
 
   if (!p.size()){
@@ -103,6 +150,25 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     return nullptr;
   }
 
+  uint64_t recv_ns = nanos_monotonic();
+  uint64_t gen = lease_table ? lease_table->gen[packet->idx].load() : 0;
+  recv_buf = nullptr;
+  if (lease) {
+    lease->held_since_ns = recv_ns;
+    lease->held_idx = packet->idx;
+
+    if (gen & 1) {
+      // The server is writing a new frame into this buffer
+      lease->held_idx = -1;
+      lease->num_dropped++;
+      delete r;
+      return nullptr;
+    } else if (gen != packet->gen) {
+      // Not torn, but the buffer already contains a newer frame
+      lease->num_replaced++;
+    }
+  }
+
   if (extra) {
     *extra = packet->extra;
   }
@@ -111,10 +177,70 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     LOGE("Failed to sync buffer");
   }
 
+  if (lease) {
+    uint64_t sync_ns = nanos_monotonic() - recv_ns;
+    lease->total_sync_ns += sync_ns;
+    if (sync_ns > lease->max_sync_ns) {
+      lease->max_sync_ns = sync_ns;
+    }
+
+    lease->num_frames++;
+    lease->latency_hist[visionipc_latency_bucket(recv_ns - packet->sent_ns)]++;
+
+    // A frame_id that goes backwards is a restarted or seeking producer, not a gap
+    int64_t frame_id = packet->extra.frame_id;
+    if (last_frame_id >= 0 && frame_id > last_frame_id + 1) {
+      lease->num_skipped += frame_id - last_frame_id - 1;
+    }
+    last_frame_id = frame_id;
+  }
+
+  recv_buf = buf;
+  recv_gen = gen;
+  recv_torn = false;
   delete r;
   return buf;
 }
 
+bool VisionIpcClient::valid(VisionBuf * buf){
+  if (buf == nullptr || buf != recv_buf) return false;
+  if (lease_table == nullptr) return true;
+
+  // The frame was read before the generation is loaded again
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (lease_table->gen[buf->idx].load(std::memory_order_relaxed) == recv_gen) return true;
+
+  if (lease && !recv_torn) {
+    lease->num_dropped++;
+  }
+  recv_torn = true;
+  return false;
+}
+
+void VisionIpcClient::release(){
+  if (lease == nullptr || lease->held_idx < 0) return;
+
+  uint64_t hold_ns = nanos_monotonic() - lease->held_since_ns;
+  lease->held_idx = -1;
+  lease->num_leases++;
+  lease->total_hold_ns += hold_ns;
+  if (hold_ns > lease->max_hold_ns) {
+    lease->max_hold_ns = hold_ns;
+  }
+}
+
+void VisionIpcClient::unmap_lease_table(){
+  if (lease_table == nullptr) return;
+
+  release();
+  if (lease) {
+    lease->owner = 0;
+    lease = nullptr;
+  }
+  munmap(lease_table, sizeof(VisionIpcLeaseTable));
+  lease_table = nullptr;
+}
+
 std::set<VisionStreamType> VisionIpcClient::getAvailableStreams(const std::string &name, bool blocking) {
   int socket_fd = connect_to_vipc_server(name, blocking);
   if (socket_fd < 0) {
@@ -146,6 +272,8 @@ VisionIpcClient::~VisionIpcClient(){
     }
   }
 
+  unmap_lease_table();
+
   delete sock;
   delete poller;
   delete msg_ctx;
@@ -17,6 +17,14 @@ private:
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
+  VisionIpcLeaseTable *lease_table = nullptr;
+  VisionIpcLease *lease = nullptr;
+  int64_t last_frame_id = -1;
+  VisionBuf *recv_buf = nullptr;
+  uint64_t recv_gen = 0;
+  bool recv_torn = false;
+  void unmap_lease_table();
+
 public:
   bool connected = false;
   VisionStreamType type;
@@ -24,7 +32,12 @@ public:
   VisionBuf buffers[VISIONIPC_MAX_FDS];
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
+  // The returned buffer is leased until the next recv or release
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
+  void release();
+  // False if the server started writing another frame into buf since recv returned it.
+  // Call it after reading the frame, the data read before is torn when it returns false.
+  bool valid(VisionBuf * buf);
   bool connect(bool blocking=true);
   bool is_connected() { return connected; }
   static std::set<VisionStreamType> getAvailableStreams(const std::string &name, bool blocking = true);
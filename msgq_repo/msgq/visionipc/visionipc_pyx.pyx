@@ -78,6 +78,9 @@ cdef class VisionIpcServer:
 
   def send(self, VisionStreamType tp, const unsigned char[:] data, uint32_t frame_id=0, uint64_t timestamp_sof=0, uint64_t timestamp_eof=0):
     cdef cppVisionBuf * buf = self.server.get_buffer(tp)
+    if buf == NULL:
+      # All buffers are held by clients and none was released within the lease timeout
+      return False
 
     # Populate buffer
     assert buf.len == len(data)
@@ -90,10 +93,17 @@ cdef class VisionIpcServer:
     extra.timestamp_eof = timestamp_eof
 
     self.server.send(buf, &extra, False)
+    return True
 
   def start_listener(self):
     self.server.start_listener()
 
+  def set_lease_timeout(self, int timeout_ms):
+    self.server.set_lease_timeout(timeout_ms)
+
+  def stats(self, VisionStreamType tp):
+    return self.server.get_stats(tp)
+
   def __dealloc__(self):
     del self.server
 
@@ -101,6 +111,7 @@ cdef class VisionIpcServer:
 cdef class VisionIpcClient:
   cdef cppVisionIpcClient * client
   cdef VisionIpcBufExtra extra
+  cdef cppVisionBuf * buf
 
   def __cinit__(self, string name, VisionStreamType stream, bool conflate, CLContext context = None):
     if context:
@@ -152,14 +163,21 @@ cdef class VisionIpcClient:
     return self.extra.valid
 
   def recv(self, int timeout_ms=100):
-    buf = self.client.recv(&self.extra, timeout_ms)
-    if not buf:
+    self.buf = self.client.recv(&self.extra, timeout_ms)
+    if not self.buf:
       return None
-    return VisionBuf.create(buf)
+    return VisionBuf.create(self.buf)
+
+  def buf_valid(self):
+    # False if the last received buffer was overwritten while it was read
+    return self.client.valid(self.buf)
 
   def connect(self, bool blocking):
     return self.client.connect(blocking)
 
+  def release(self):
+    self.client.release()
+
   def is_connected(self):
     return self.client.is_connected()
 
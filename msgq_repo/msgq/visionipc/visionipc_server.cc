@@ -3,8 +3,12 @@
 #include <cassert>
 #include <random>
 #include <limits>
+#include <cstring>
+#include <thread>
 
 #include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -22,6 +26,10 @@ std::string get_endpoint_name(std::string name, VisionStreamType type){
   }
 }
 
+static bool process_alive(uint32_t pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
 std::string get_ipc_path(const std::string& name) {
   std::string path = "/tmp/";
   if (char* prefix = std::getenv("OPENPILOT_PREFIX")) {
@@ -70,6 +78,12 @@ void VisionIpcServer::create_buffers_with_sizes(VisionStreamType type, size_t nu
 
   cur_idx[type] = 0;
 
+  // Shared table where clients mark the buffer they are reading
+  if (leases.count(type) == 0) {
+    leases[type] = (VisionIpcLeaseTable *)ipc_shm_alloc(sizeof(VisionIpcLeaseTable), &lease_fds[type]);
+    counters[type];
+  }
+
   // Create msgq publisher for each of the `name` + type combos
   // TODO: compute port number directly if using zmq
   sockets[type] = PubSocket::create(msg_ctx, get_endpoint_name(name, type), false);
@@ -88,7 +102,17 @@ void VisionIpcServer::listener(){
   int sock = ipc_bind(ipc_path.c_str());
   assert(sock >= 0);
 
+  auto last_stats = std::chrono::steady_clock::now();
   while (!should_exit){
+    if (stats_callback && std::chrono::steady_clock::now() - last_stats >= std::chrono::milliseconds(stats_interval_ms)) {
+      last_stats = std::chrono::steady_clock::now();
+      std::map<VisionStreamType, VisionIpcStats> stats;
+      for (auto &[type, _] : buffers) {
+        stats[type] = get_stats(type);
+      }
+      stats_callback(stats);
+    }
+
     // Wait for incoming connection
     struct pollfd polls[1] = {{0}};
     polls[0].fd = sock;
@@ -133,10 +157,10 @@ void VisionIpcServer::listener(){
     }
 
     int fds[VISIONIPC_MAX_FDS];
-    int num_fds = buffers[type].size();
+    int num_bufs = buffers[type].size();
     VisionBuf bufs[VISIONIPC_MAX_FDS];
 
-    for (int i = 0; i < num_fds; i++){
+    for (int i = 0; i < num_bufs; i++){
       fds[i] = buffers[type][i]->fd;
       bufs[i] = *buffers[type][i];
 
@@ -148,7 +172,10 @@ void VisionIpcServer::listener(){
       bufs[i].server_id = server_id;
     }
 
-    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_fds, fds, num_fds, nullptr);
+    // The lease table is sent after the buffers
+    fds[num_bufs] = lease_fds[type];
+
+    r = ipc_sendrecv_with_fds(true, fd, &bufs, sizeof(VisionBuf) * num_bufs, fds, num_bufs + 1, nullptr);
 
     close(fd);
   }
@@ -160,37 +187,150 @@ void VisionIpcServer::listener(){
 
 
 
+bool VisionIpcServer::is_held(VisionStreamType type, size_t idx){
+  for (VisionIpcLease &lease : leases[type]->clients){
+    uint64_t owner = lease.owner;
+    if (owner == 0 || lease.held_idx != (int32_t)idx) continue;
+
+    // Free the slot of a client that died while reading
+    if (!process_alive(owner >> 32)) {
+      int32_t held = idx;
+      lease.held_idx.compare_exchange_strong(held, -1);
+      lease.owner.compare_exchange_strong(owner, 0);
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool VisionIpcServer::try_acquire(VisionStreamType type, size_t idx){
+  // Mark the buffer as being written before looking at the clients. A client that starts
+  // reading it at the same time either shows up as holder here, or sees the odd generation.
+  std::atomic<uint64_t> &gen = leases[type]->gen[idx];
+  uint64_t g = gen;
+  gen = g | 1;
+
+  if (is_held(type, idx)) {
+    gen = g;
+    return false;
+  }
+  return true;
+}
+
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type, int idx){
-  // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
-  if (idx < 0) {
-    idx = cur_idx[type]++ % b.size();
-  } else {
-    assert(idx < b.size() && idx >= 0);
+  auto &b = buffers[type];
+  if (idx >= 0) {
+    assert(idx < b.size());
     cur_idx[type] = idx;
+
+    // The caller already filled this buffer, count it if a client was still reading it
+    leases[type]->gen[idx].fetch_or(1);
+    if (is_held(type, idx)) {
+      counters[type].num_overwrites++;
+    }
+    return b[idx];
+  }
+
+  // Take the next buffer that no client is reading
+  auto start = std::chrono::steady_clock::now();
+  bool stalled = false;
+  while (true) {
+    for (size_t i = 0; i < b.size(); i++) {
+      size_t candidate = cur_idx[type]++ % b.size();
+      if (try_acquire(type, candidate)) {
+        if (stalled) counters[type].num_stalls++;
+        return b[candidate];
+      }
+    }
+
+    if (lease_timeout_ms < 0) {
+      // Overwrite the next buffer. A client still reading it finds out with VisionIpcClient::valid()
+      size_t candidate = cur_idx[type]++ % b.size();
+      leases[type]->gen[candidate].fetch_or(1);
+      counters[type].num_overwrites++;
+      return b[candidate];
+    }
+    if (std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(lease_timeout_ms)) {
+      counters[type].num_drops++;
+      return nullptr;
+    }
+    stalled = true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
   }
-  return b[idx];
 }
 
 void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
   if (sync) {
+    auto sync_start = std::chrono::steady_clock::now();
     if (buf->sync(VISIONBUF_SYNC_FROM_DEVICE) != 0) {
       LOGE("Failed to sync buffer");
     }
+    uint64_t sync_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sync_start).count();
+
+    StreamCounters &c = counters[buf->type];
+    c.total_sync_ns += sync_ns;
+    if (sync_ns > c.max_sync_ns) {
+      c.max_sync_ns = sync_ns;
+    }
   }
   assert(buffers.count(buf->type));
   assert(buf->idx < buffers[buf->type].size());
 
+  // Buffer is complete, make the generation even again
+  std::atomic<uint64_t> &gen = leases[buf->type]->gen[buf->idx];
+  uint64_t g = gen;
+  if (g & 1) {
+    gen = ++g;
+  }
+
   // Send over correct msgq socket
   VisionIpcPacket packet = {0};
   packet.server_id = server_id;
   packet.idx = buf->idx;
+  packet.gen = g;
+  packet.sent_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
   packet.extra = *extra;
 
+  counters[buf->type].num_sent++;
   sockets[buf->type]->send((char*)&packet, sizeof(packet));
 }
 
+VisionIpcStats VisionIpcServer::get_stats(VisionStreamType type){
+  assert(leases.count(type));
+  StreamCounters &c = counters[type];
+
+  VisionIpcStats stats = {c.num_sent, c.num_stalls, c.num_drops, c.num_overwrites, c.total_sync_ns, c.max_sync_ns, {}};
+  for (VisionIpcLease &lease : leases[type]->clients){
+    uint64_t owner = lease.owner;
+    if (owner == 0) continue;
+
+    VisionIpcClientStats client = {
+      .pid = (uint32_t)(owner >> 32),
+      .name = std::string(lease.name, strnlen(lease.name, sizeof(lease.name))),
+      .holding = lease.held_idx >= 0,
+      .num_leases = lease.num_leases,
+      .total_hold_ns = lease.total_hold_ns,
+      .max_hold_ns = lease.max_hold_ns,
+      .num_dropped = lease.num_dropped,
+      .num_replaced = lease.num_replaced,
+      .num_frames = lease.num_frames,
+      .num_skipped = lease.num_skipped,
+      .total_sync_ns = lease.total_sync_ns,
+      .max_sync_ns = lease.max_sync_ns,
+    };
+    client.latency_hist.assign(std::begin(lease.latency_hist), std::end(lease.latency_hist));
+    stats.clients.push_back(client);
+  }
+  return stats;
+}
+
+void VisionIpcServer::set_stats_callback(std::function<void(const std::map<VisionStreamType, VisionIpcStats> &)> callback, int interval_ms){
+  stats_callback = callback;
+  stats_interval_ms = interval_ms;
+}
+
 VisionIpcServer::~VisionIpcServer(){
   should_exit = true;
   listener_thread.join();
@@ -205,6 +345,11 @@ VisionIpcServer::~VisionIpcServer(){
     }
   }
 
+  for (auto const& [type, table] : leases) {
+    munmap(table, sizeof(VisionIpcLeaseTable));
+    close(lease_fds[type]);
+  }
+
   // Messaging cleanup
   for (auto const& [type, sock] : sockets) {
     delete sock;
@@ -3,6 +3,7 @@
 #include <string>
 #include <thread>
 #include <atomic>
+#include <functional>
 #include <map>
 
 #include "msgq/ipc.h"
@@ -11,6 +12,33 @@
 std::string get_endpoint_name(std::string name, VisionStreamType type);
 std::string get_ipc_path(const std::string &name);
 
+struct VisionIpcClientStats {
+  uint32_t pid;
+  std::string name;
+  bool holding;
+  uint64_t num_leases;
+  uint64_t total_hold_ns;
+  uint64_t max_hold_ns;
+  uint64_t num_dropped;
+  uint64_t num_replaced;
+
+  uint64_t num_frames;
+  uint64_t num_skipped;
+  uint64_t total_sync_ns;
+  uint64_t max_sync_ns;
+  std::vector<uint64_t> latency_hist;
+};
+
+struct VisionIpcStats {
+  uint64_t num_sent;
+  uint64_t num_stalls; // get_buffer had to wait for a client to release a buffer
+  uint64_t num_drops; // no buffer was released within the lease timeout, get_buffer returned nullptr
+  uint64_t num_overwrites; // a buffer was handed out while a client held it, by index or because all were held
+  uint64_t total_sync_ns;
+  uint64_t max_sync_ns;
+  std::vector<VisionIpcClientStats> clients;
+};
+
 class VisionIpcServer {
  private:
   cl_device_id device_id = nullptr;
@@ -24,10 +52,28 @@ class VisionIpcServer {
   std::map<VisionStreamType, std::atomic<size_t> > cur_idx;
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
 
+  struct StreamCounters {
+    std::atomic<uint64_t> num_sent = 0;
+    std::atomic<uint64_t> num_stalls = 0;
+    std::atomic<uint64_t> num_drops = 0;
+    std::atomic<uint64_t> num_overwrites = 0;
+    std::atomic<uint64_t> total_sync_ns = 0;
+    std::atomic<uint64_t> max_sync_ns = 0;
+  };
+  int lease_timeout_ms = -1;
+  std::map<VisionStreamType, int> lease_fds;
+  std::map<VisionStreamType, VisionIpcLeaseTable*> leases;
+  std::map<VisionStreamType, StreamCounters> counters;
+
+  std::function<void(const std::map<VisionStreamType, VisionIpcStats> &)> stats_callback;
+  int stats_interval_ms = 1000;
+
   Context * msg_ctx;
   std::map<VisionStreamType, PubSocket*> sockets;
 
   void listener(void);
+  bool is_held(VisionStreamType type, size_t idx);
+  bool try_acquire(VisionStreamType type, size_t idx);
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
@@ -39,4 +85,13 @@ class VisionIpcServer {
   void create_buffers_with_sizes(VisionStreamType type, size_t num_buffers, size_t width, size_t height, size_t size, size_t stride, size_t uv_offset);
   void send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync=true);
   void start_listener();
+
+  // When clients hold all buffers, get_buffer overwrites the next one by default, and a client
+  // reading it gets a torn frame that VisionIpcClient::valid() reports afterwards. With a
+  // timeout >= 0 it waits that long for a client to release one, then returns nullptr.
+  void set_lease_timeout(int timeout_ms) { lease_timeout_ms = timeout_ms; }
+  VisionIpcStats get_stats(VisionStreamType type);
+
+  // Called from the listener thread with the stats of all stream types
+  void set_stats_callback(std::function<void(const std::map<VisionStreamType, VisionIpcStats> &)> callback, int interval_ms=1000);
 };
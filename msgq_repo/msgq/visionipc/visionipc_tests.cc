@@ -133,3 +133,124 @@ TEST_CASE("Test conflate"){
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Leased buffer is not reused"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 1, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  REQUIRE(buf != nullptr);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+
+  VisionBuf * recv_buf = client.recv();
+  REQUIRE(recv_buf != nullptr);
+
+  SECTION("Overwrite when no buffer is free"){
+    REQUIRE(client.valid(recv_buf));
+    REQUIRE(server.get_buffer(VISION_STREAM_ROAD) == buf);
+    REQUIRE_FALSE(client.valid(recv_buf));
+    REQUIRE_FALSE(client.valid(recv_buf));
+    VisionIpcStats stats = server.get_stats(VISION_STREAM_ROAD);
+    REQUIRE(stats.num_overwrites == 1);
+    REQUIRE(stats.num_drops == 0);
+    REQUIRE(stats.clients[0].num_dropped == 1);
+  }
+  SECTION("Drop when no buffer is free"){
+    server.set_lease_timeout(0);
+    REQUIRE(server.get_buffer(VISION_STREAM_ROAD) == nullptr);
+    REQUIRE(server.get_stats(VISION_STREAM_ROAD).num_drops == 1);
+
+    client.release();
+    REQUIRE(server.get_buffer(VISION_STREAM_ROAD) == buf);
+  }
+  SECTION("Stall until buffer is released"){
+    server.set_lease_timeout(5000);
+    std::thread t([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      client.release();
+    });
+    REQUIRE(server.get_buffer(VISION_STREAM_ROAD) == buf);
+    t.join();
+
+    VisionIpcStats stats = server.get_stats(VISION_STREAM_ROAD);
+    REQUIRE(stats.num_stalls == 1);
+    REQUIRE(stats.num_drops == 0);
+    REQUIRE(stats.clients.size() == 1);
+    REQUIRE(stats.clients[0].num_leases == 1);
+    REQUIRE(stats.clients[0].max_hold_ns >= 50 * 1000000ULL);
+    REQUIRE_FALSE(stats.clients[0].holding);
+  }
+  SECTION("Overwrite by index is counted"){
+    REQUIRE(server.get_buffer(VISION_STREAM_ROAD, 0) == buf);
+    REQUIRE(server.get_stats(VISION_STREAM_ROAD).num_overwrites == 1);
+  }
+}
+
+TEST_CASE("Buffer being rewritten is dropped"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 2, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionIpcBufExtra extra = {0};
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_ROAD);
+  server.send(buf, &extra);
+
+  // Cycle back to the same buffer before the client received the first frame
+  server.send(server.get_buffer(VISION_STREAM_ROAD), &extra);
+  REQUIRE(server.get_buffer(VISION_STREAM_ROAD) == buf);
+
+  REQUIRE(client.recv() == nullptr);
+  REQUIRE(client.recv() != nullptr);
+
+  VisionIpcStats stats = server.get_stats(VISION_STREAM_ROAD);
+  REQUIRE(stats.clients.size() == 1);
+  REQUIRE(stats.clients[0].num_dropped == 1);
+}
+
+TEST_CASE("Client telemetry"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_ROAD, 4, 100, 100);
+
+  std::atomic<int> num_callbacks = 0;
+  server.set_stats_callback([&](const std::map<VisionStreamType, VisionIpcStats> &stats) {
+    if (stats.count(VISION_STREAM_ROAD)) num_callbacks++;
+  }, 10);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_ROAD, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  for (uint32_t frame_id : {1, 2, 5}) {
+    VisionIpcBufExtra extra = {0};
+    extra.frame_id = frame_id;
+    server.send(server.get_buffer(VISION_STREAM_ROAD), &extra);
+  }
+  for (int i = 0; i < 3; i++) {
+    REQUIRE(client.recv() != nullptr);
+  }
+
+  VisionIpcStats stats = server.get_stats(VISION_STREAM_ROAD);
+  REQUIRE(stats.num_sent == 3);
+  REQUIRE(stats.clients.size() == 1);
+  REQUIRE(stats.clients[0].name.size() > 0);
+  REQUIRE(stats.clients[0].num_frames == 3);
+  REQUIRE(stats.clients[0].num_skipped == 2);
+
+  uint64_t hist_total = 0;
+  for (uint64_t count : stats.clients[0].latency_hist) hist_total += count;
+  REQUIRE(hist_total == 3);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  REQUIRE(num_callbacks > 0);
+}
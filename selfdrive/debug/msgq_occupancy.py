@@ -0,0 +1,26 @@
+#!/usr/bin/env python3
+import argparse
+
+import msgq
+from cereal.services import SERVICE_LIST
+
+
+def fmt_size(n: int) -> str:
+  return f"{n / 1024 / 1024:.2f} MB" if n >= 1024 * 1024 else f"{n / 1024:.1f} kB"
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="Report peak msgq usage per service, to tune segment sizes in cereal/services.py")
+  parser.add_argument("socket", type=str, nargs='*', help="socket names, defaults to all services")
+  args = parser.parse_args()
+
+  print(f"{'service':<30} {'configured':>12} {'segment':>12} {'peak used':>12} {'peak %':>7} {'max msg':>12} {'readers':>8} {'evictions':>10}")
+  for name in (args.socket or SERVICE_LIST.keys()):
+    stats = msgq.queue_stats(name)
+    if stats is None:
+      continue
+
+    configured = SERVICE_LIST[name].segment_size if name in SERVICE_LIST else 0
+    peak_pct = 100. * stats['peak_used'] / stats['segment_size'] if stats['segment_size'] else 0.
+    print(f"{name:<30} {fmt_size(configured):>12} {fmt_size(stats['segment_size']):>12} {fmt_size(stats['peak_used']):>12} " +
+          f"{peak_pct:>6.1f}% {fmt_size(stats['max_msg_size']):>12} {stats['num_readers']:>8} {stats['num_evictions']:>10}")
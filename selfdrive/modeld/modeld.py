@@ -373,6 +373,11 @@ def main(demo=False):
     mt2 = time.perf_counter()
     model_execution_time = mt2 - mt1
 
+    # camerad overwrote a frame while the model read it
+    if not vipc_client_main.buf_valid() or (use_extra_client and not vipc_client_extra.buf_valid()):
+      cloudlog.error(f"vipc frame {meta_main.frame_id} overwritten during model run")
+      model_output = None
+
     if model_output is not None:
       modelv2_send = messaging.new_message('modelV2')
       drivingdata_send = messaging.new_message('drivingModelData')
@@ -21,6 +21,7 @@
 
 #include "media/cam_sensor_cmn_header.h"
 
+#include "cereal/messaging/visionipc_stats.h"
 #include "common/clutil.h"
 #include "common/params.h"
 #include "common/swaglog.h"
@@ -261,7 +262,11 @@ void camerad_thread() {
   const cl_context_properties props[] = {CL_CONTEXT_PRIORITY_HINT_QCOM, CL_PRIORITY_HINT_HIGH_QCOM, 0};
   cl_context ctx = CL_CHECK_ERR(clCreateContext(props, 1, &device_id, NULL, NULL, &err));
 
+  PubMaster stats_pm({"visionipcStats"});
   VisionIpcServer v("camerad", device_id, ctx);
+  v.set_stats_callback([&](const std::map<VisionStreamType, VisionIpcStats> &stats) {
+    publish_visionipc_stats(stats_pm, "camerad", stats);
+  });
 
   // *** initial ISP init ***
   SpectraMaster m;
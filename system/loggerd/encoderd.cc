@@ -117,6 +117,12 @@ void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
         }
       }
 
+      // camerad overwrote the buffer while it was encoded
+      if (!vipc_client.valid(buf)) {
+        LOGE("encoder %s torn frame. frame_id: %d", cam_info.thread_name, extra.frame_id);
+        continue;
+      }
+
       if (jpeg_encoder && (extra.frame_id % 1200 == 100)) {
         jpeg_encoder->pushThumbnail(buf, extra);
       }
@@ -36,6 +36,7 @@ int main(int argc, char *argv[]) {
   cmd_parser.addOption({"zmq", "read can messages from zmq at the specified ip-address", "ip-address"});
   cmd_parser.addOption({"data_dir", "local directory with routes", "data_dir"});
   cmd_parser.addOption({"no-vipc", "do not output video"});
+  cmd_parser.addOption({"index-cache", "keep parsed logs on disk to open them faster next time"});
   cmd_parser.addOption({"dbc", "dbc file to open", "dbc"});
   cmd_parser.process(app);
 
@@ -60,6 +61,7 @@ int main(int argc, char *argv[]) {
     if (cmd_parser.isSet("qcam")) replay_flags |= REPLAY_FLAG_QCAMERA;
     if (cmd_parser.isSet("dcam")) replay_flags |= REPLAY_FLAG_DCAM;
     if (cmd_parser.isSet("no-vipc")) replay_flags |= REPLAY_FLAG_NO_VIPC;
+    if (cmd_parser.isSet("index-cache")) replay_flags |= REPLAY_FLAG_INDEX_CACHE;
 
     const QStringList args = cmd_parser.positionalArguments();
     QString route;
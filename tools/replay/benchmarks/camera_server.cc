@@ -0,0 +1,76 @@
+// Measures the CPU time CameraServer uses to send the frames of all three cameras at 20Hz,
+// waiting for every frame to be sent like replay does at speeds above 1x. The CPU time of
+// the waiting thread is reported on its own, the process total includes decoding.
+//
+// usage: camera_server <fcamera.hevc or qcamera.ts, file or url> [seconds]
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/camera.h"
+
+static double cpu_seconds(int who = RUSAGE_SELF) {
+  struct rusage usage = {};
+  getrusage(who, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <video file or url> [seconds]\n", argv[0]);
+    return 1;
+  }
+  const std::string url = argv[1];
+  const int seconds = argc > 2 ? atoi(argv[2]) : 30;
+
+  std::unique_ptr<FrameReader> readers[MAX_CAMERAS];
+  std::pair<int, int> camera_size[MAX_CAMERAS];
+  for (auto type : ALL_CAMERAS) {
+    readers[type] = std::make_unique<FrameReader>();
+    if (!readers[type]->load(type, url, true, nullptr, true)) {
+      printf("failed to load %s\n", url.c_str());
+      return 1;
+    }
+    camera_size[type] = {readers[type]->width, readers[type]->height};
+  }
+
+  CameraServer server(camera_size);
+  const int frames = std::min<int>(seconds * 20, readers[RoadCam]->getFrameCount());
+  const double start_cpu = cpu_seconds(), start_thread_cpu = cpu_seconds(RUSAGE_THREAD), start = millis_since_boot();
+  double wait_ms = 0;
+  for (int i = 0; i < frames; ++i) {
+    const double frame_start = millis_since_boot();
+    std::vector<kj::Array<capnp::word>> msgs;
+    std::vector<Event> events;
+    events.reserve(MAX_CAMERAS);
+    for (auto type : ALL_CAMERAS) {
+      MessageBuilder msg;
+      auto idx = msg.initEvent().initRoadEncodeIdx();
+      idx.setType(cereal::EncodeIndex::Type::FULL_H_E_V_C);
+      idx.setFrameId(i);
+      idx.setSegmentId(i);
+      idx.setTimestampSof(nanos_since_boot());
+      msgs.push_back(capnp::messageToFlatArray(msg));
+      server.pushFrame(type, readers[type].get(), &events.emplace_back(cereal::Event::ROAD_ENCODE_IDX, 0, msgs.back().asPtr(), i));
+    }
+
+    double wait_start = millis_since_boot();
+    server.waitForSent();
+    wait_ms += millis_since_boot() - wait_start;
+    util::sleep_for((int)std::max(0.0, 50 - (millis_since_boot() - frame_start)));
+  }
+
+  const double wall = (millis_since_boot() - start) / 1000;
+  printf("%d frames of %d cameras in %.1f s\n", frames, MAX_CAMERAS, wall);
+  printf("cpu %.1f%%, waiting thread %.1f%%, waiting for sent %.2f ms per frame\n", (cpu_seconds() - start_cpu) / wall * 100,
+         (cpu_seconds(RUSAGE_THREAD) - start_thread_cpu) / wall * 100, wait_ms / frames);
+  return 0;
+}
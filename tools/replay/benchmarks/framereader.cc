@@ -0,0 +1,78 @@
+// Reports how many frames FrameReader decodes and how long get() takes for sequential,
+// reverse and random access, with and without the decoded frame cache.
+//
+// usage: framereader <fcamera.hevc or qcamera.ts, file or url> [frames]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/camera.h"
+#include "tools/replay/framereader.h"
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s <video file or url> [frames]\n", argv[0]);
+    return 1;
+  }
+  const std::string url = argv[1];
+  int frames = argc > 2 ? atoi(argv[2]) : 200;
+
+  int width = 0, height = 0;
+  {
+    FrameReader fr;
+    if (!fr.load(RoadCam, url, true, nullptr, true)) {
+      printf("failed to load %s\n", url.c_str());
+      return 1;
+    }
+    frames = std::min<int>(frames, fr.getFrameCount());
+    width = fr.width;
+    height = fr.height;
+  }
+
+  auto [nv12_width, nv12_height, nv12_buffer_size] = get_nv12_info(width, height);
+  VisionBuf buf;
+  buf.allocate(nv12_buffer_size);
+  buf.init_yuv(width, height, nv12_width, nv12_width * nv12_height);
+
+  std::vector<int> sequential(frames);
+  std::iota(sequential.begin(), sequential.end(), 0);
+  std::vector<int> reverse(sequential.rbegin(), sequential.rend());
+  std::vector<int> random = sequential;
+  std::shuffle(random.begin(), random.end(), std::mt19937(42));
+
+  printf("%d frames of %dx%d\n", frames, width, height);
+  printf("%-12s %-10s %10s %10s %12s %12s\n", "", "cache MB", "decoded", "hits", "avg get ms", "max get ms");
+  for (size_t cache_size : {(size_t)0, DEFAULT_FRAME_CACHE_SIZE}) {
+    for (const auto &[name, order] : {std::pair{"sequential", &sequential}, std::pair{"reverse", &reverse}, std::pair{"random", &random}}) {
+      FrameReader::setCacheSize(cache_size);
+      const auto before = FrameReader::cacheStats();
+      double total_ms = 0, max_ms = 0;
+      {
+        FrameReader fr;
+        fr.load(RoadCam, url, true, nullptr, true);
+        for (int idx : *order) {
+          double start = millis_since_boot();
+          fr.get(idx, &buf);
+          double ms = millis_since_boot() - start;
+          total_ms += ms;
+          max_ms = std::max(max_ms, ms);
+          // Playback pace, gives the lookahead time to decode
+          if (order == &sequential) util::sleep_for((int)std::max(0.0, 50 - ms));
+        }
+      }
+      const auto after = FrameReader::cacheStats();
+      printf("%-12s %-10zu %10lu %10lu %12.2f %12.2f\n", name, cache_size / (1024 * 1024),
+             after.decoded - before.decoded, after.hits - before.hits, total_ms / frames, max_ms);
+    }
+  }
+  buf.free();
+  return 0;
+}
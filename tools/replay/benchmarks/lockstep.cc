@@ -0,0 +1,141 @@
+// Compares replaying a route in real time (at a high playback speed) against lockstep mode,
+// with a consumer of two services that spends a fixed time on every carState message. Writes
+// a synthetic route of 100Hz carState and carControl, replays it once paced and twice with
+// both services in lockstep, and reports the messages the consumer got, the speedup over real
+// time and a hash of the consumer's output, which has to be identical for both lockstep runs.
+//
+// usage: lockstep [segments] [work_us] [dir]
+
+#include <zstd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/prefix.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/replay.h"
+
+const std::string ROUTE = "0123456789abcdef|2024-01-01--00-00-00";
+
+static size_t generate(const std::string &dir, int segments) {
+  size_t count = 0;
+  for (int n = 0; n < segments; ++n) {
+    std::string raw;
+    for (uint64_t mono_time = 1e9 + n * 60e9; mono_time < 1e9 + (n + 1) * 60e9; mono_time += 5e6, ++count) {
+      MessageBuilder msg;
+      auto evt = msg.initEvent();
+      evt.setLogMonoTime(mono_time);
+      if (count % 2 == 0) {
+        auto cs = evt.initCarState();
+        cs.setVEgo((count % 4000) / 100.0);
+        cs.setSteeringAngleDeg((int)(count % 1800) / 10.0 - 90);
+      } else {
+        evt.initCarControl().initActuators().setAccel((int)(count % 777) / 100.0 - 3.5);
+      }
+      auto bytes = msg.toBytes();
+      raw.append((const char *)bytes.begin(), bytes.size());
+    }
+
+    std::string zst(ZSTD_compressBound(raw.size()), '\0');
+    zst.resize(ZSTD_compress(zst.data(), zst.size(), raw.data(), raw.size(), 3));
+    const std::string segment_dir = dir + "/2024-01-01--00-00-00--" + std::to_string(n);
+    util::create_directories(segment_dir, 0755);
+    std::ofstream(segment_dir + "/rlog.zst", std::ios::binary).write(zst.data(), zst.size());
+  }
+  return count;
+}
+
+struct Result {
+  size_t received = 0;
+  uint64_t hash = 0;
+  double seconds = 0;
+  double speedup = 0;
+};
+
+// Replays the route and consumes both services until every message arrived, or nothing did for a second
+static Result run(const std::string &dir, bool lockstep, float speed, int work_us, size_t expected) {
+  const std::vector<std::string> services = {"carState", "carControl"};
+  uint32_t flags = REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_NO_FILE_CACHE | REPLAY_FLAG_NO_LOOP;
+  if (lockstep) flags |= REPLAY_FLAG_LOCKSTEP;
+  Replay replay(ROUTE, services, {}, nullptr, flags, dir);
+  if (lockstep) replay.setLockstepServices(services);
+  replay.setSpeed(speed);
+
+  std::unique_ptr<Context> context(Context::create());
+  std::unique_ptr<Poller> poller(Poller::create());
+  std::vector<std::unique_ptr<SubSocket>> socks;
+  for (const auto &name : services) {
+    socks.emplace_back(SubSocket::create(context.get(), name));
+    poller->registerSocket(socks.back().get());
+  }
+  if (!replay.load()) return {};
+  replay.start();
+
+  // The consumer's output is a low-pass filtered speed plus the last accel, updated on every carState
+  // and hashed together with every message it read. It reads one message at a time, see the README.
+  Result result;
+  uint64_t hash = 14695981039346656037ULL;
+  auto hash_bytes = [&](const void *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) hash = (hash ^ ((const uint8_t *)data)[i]) * 1099511628211ULL;
+  };
+  AlignedBuffer aligned;
+  double filtered_speed = 0, accel = 0, start = 0;
+  while (result.received < expected) {
+    auto ready = poller->poll(1000);
+    if (ready.empty()) break;
+    for (auto sock : ready) {
+      std::unique_ptr<Message> msg(sock->receive(true));
+      if (!msg) continue;
+      if (result.received++ == 0) start = millis_since_boot();
+
+      capnp::FlatArrayMessageReader reader(aligned.align(msg.get()));
+      auto event = reader.getRoot<cereal::Event>();
+      hash_bytes(msg->getData(), msg->getSize());
+      if (event.isCarControl()) {
+        accel = event.getCarControl().getActuators().getAccel();
+        continue;
+      }
+      filtered_speed += 0.05 * (event.getCarState().getVEgo() - filtered_speed) + 0.01 * accel;
+      hash_bytes(&filtered_speed, sizeof(filtered_speed));
+      for (double until = millis_since_boot() + work_us / 1000.0; millis_since_boot() < until;) {}
+    }
+  }
+  result.hash = hash;
+  result.seconds = (millis_since_boot() - start) / 1000;
+  result.speedup = expected * 0.005 / result.seconds;
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  int segments = argc > 1 ? atoi(argv[1]) : 2;
+  int work_us = argc > 2 ? atoi(argv[2]) : 50;
+  std::string dir = argc > 3 ? argv[3] : "/tmp/replay_lockstep_route";
+  const size_t expected = generate(dir, segments);
+
+  OpenpilotPrefix prefix;
+  installMessageHandler([](ReplyMsgType type, const std::string msg) {
+    if (type == ReplyMsgType::Warning || type == ReplyMsgType::Critical) fprintf(stderr, "%s\n", msg.c_str());
+  });
+
+  printf("%d segments, %zu carState and carControl messages, %d us of work per carState\n", segments, expected, work_us);
+  printf("%-12s %10s %10s %10s %18s\n", "", "received", "seconds", "speedup", "hash");
+  const Result paced = run(dir, false, 20, work_us, expected);
+  printf("%-12s %10zu %10.2f %10.1f %18lx\n", "paced x20", paced.received, paced.seconds, paced.speedup, paced.hash);
+  Result lockstep[2];
+  for (int i = 0; i < 2; ++i) {
+    lockstep[i] = run(dir, true, 1, work_us, expected);
+    printf("%-12s %10zu %10.2f %10.1f %18lx\n", "lockstep", lockstep[i].received, lockstep[i].seconds, lockstep[i].speedup, lockstep[i].hash);
+  }
+
+  if (lockstep[0].received != expected || lockstep[0].received != lockstep[1].received || lockstep[0].hash != lockstep[1].hash) {
+    printf("lockstep runs differ\n");
+    return 1;
+  }
+  printf("lockstep runs are identical\n");
+  return 0;
+}
@@ -0,0 +1,136 @@
+// Compares loading a whole rlog into memory before parsing it, the way LogReader used to,
+// against the streaming LogReader::load, and a cold against a warm load with the index
+// cache. Writes a synthetic rlog of can and carState events as bz2 and zst, then loads it
+// in a child process per run, with and without a carState filter, and reports the load
+// time and the peak RSS of the child.
+//
+// usage: logreader [decompressed_mb] [dir]
+
+#include <bzlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <capnp/schema.h>
+
+#include "common/timing.h"
+#include "tools/replay/filereader.h"
+#include "tools/replay/logreader.h"
+#include "tools/replay/util.h"
+
+static void write_file(const std::string &path, const char *data, size_t size) {
+  std::ofstream fs(path, std::ios::binary | std::ios::out);
+  fs.write(data, size);
+}
+
+static void generate(const std::string &dir, size_t decompressed_mb) {
+  std::mt19937 rng(42);
+  std::string raw;
+  uint64_t mono_time = 1e9;
+  for (int i = 0; raw.size() < decompressed_mb * 1024 * 1024; ++i) {
+    MessageBuilder msg;
+    auto evt = msg.initEvent();
+    evt.setLogMonoTime(mono_time += 1e6);
+    if (i % 10 == 0) {
+      auto cs = evt.initCarState();
+      cs.setVEgo(rng() % 40);
+      cs.setSteeringAngleDeg(rng() % 90);
+    } else {
+      auto can = evt.initCan(64);
+      for (int j = 0; j < 64; ++j) {
+        can[j].setAddress(rng() % 2048);
+        can[j].setSrc(j % 3);
+        uint64_t dat = ((uint64_t)rng() << 32) | (rng() & 0xff);
+        can[j].setDat(kj::arrayPtr((const capnp::byte *)&dat, sizeof(dat)));
+      }
+    }
+    auto bytes = msg.toBytes();
+    raw.append((const char *)bytes.begin(), bytes.size());
+  }
+
+  unsigned int bz2_size = raw.size() * 1.01 + 600;
+  std::string bz2(bz2_size, '\0');
+  BZ2_bzBuffToBuffCompress(bz2.data(), &bz2_size, raw.data(), raw.size(), 9, 0, 0);
+  write_file(dir + "/rlog.bz2", bz2.data(), bz2_size);
+
+  std::string zst(ZSTD_compressBound(raw.size()), '\0');
+  size_t zst_size = ZSTD_compress(zst.data(), zst.size(), raw.data(), raw.size(), 10);
+  write_file(dir + "/rlog.zst", zst.data(), zst_size);
+}
+
+// The old LogReader::load: read and decompress everything, then parse
+static void load_whole(const std::string &file, const std::vector<bool> &filters) {
+  std::string data = FileReader(false).read(file);
+  data = file.find(".bz2") != std::string::npos ? decompressBZ2(data) : decompressZST(data);
+  LogReader log(filters);
+  log.load(data.data(), data.size());
+}
+
+// Runs fn in a child process and prints its load time and peak RSS
+template <class Fn>
+static void run(const char *name, const std::string &file, const char *filter_name, Fn fn) {
+  int fds[2];
+  if (pipe(fds) != 0) return;
+  pid_t pid = fork();
+  if (pid == 0) {
+    double start = millis_since_boot();
+    fn();
+    double total = millis_since_boot() - start;
+    write(fds[1], &total, sizeof(total));
+    _exit(0);
+  }
+
+  double total = 0;
+  read(fds[0], &total, sizeof(total));
+  close(fds[0]);
+  close(fds[1]);
+  struct rusage usage = {};
+  int status;
+  wait4(pid, &status, 0, &usage);
+  printf("%-4s %-7s %-8s %10.1f %12.1f\n", file.substr(file.rfind('.') + 1).c_str(), name, filter_name,
+         total, usage.ru_maxrss / 1024.0);
+}
+
+int main(int argc, char *argv[]) {
+  size_t decompressed_mb = argc > 1 ? atoi(argv[1]) : 64;
+  std::string dir = argc > 2 ? argv[2] : "/tmp";
+
+  // In a child, so that the generated log doesn't count towards the RSS of the runs
+  if (pid_t pid = fork(); pid == 0) {
+    generate(dir, decompressed_mb);
+    _exit(0);
+  } else {
+    waitpid(pid, nullptr, 0);
+  }
+
+  std::vector<bool> car_state_only(capnp::Schema::from<cereal::Event>().getUnionFields().size(), false);
+  car_state_only[cereal::Event::Which::CAR_STATE] = true;
+
+  printf("%zu MB decompressed\n", decompressed_mb);
+  printf("%-4s %-7s %-8s %10s %12s\n", "", "", "events", "total ms", "peak RSS MB");
+  for (auto file : {dir + "/rlog.bz2", dir + "/rlog.zst"}) {
+    auto load_stream = [&](const std::vector<bool> &filters, bool index_cache) {
+      LogReader log(filters);
+      log.load(file, nullptr, false, -1, 0, index_cache);
+    };
+
+    const std::string index_file = cacheFilePath(file) + ".idx";
+    for (const auto &[filter_name, filters] : {std::pair{"all", std::vector<bool>{}}, std::pair{"carState", car_state_only}}) {
+      run("whole", file, filter_name, [&]() { return load_whole(file, filters); });
+      run("stream", file, filter_name, [&]() { return load_stream(filters, false); });
+      unlink(index_file.c_str());
+      run("cold", file, filter_name, [&]() { return load_stream(filters, true); });
+      run("warm", file, filter_name, [&]() { return load_stream(filters, true); });
+    }
+    unlink(index_file.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+// Measures how many events per second RouteReader reads from a local route. Writes a
+// synthetic route of can and carState events, then reads all of it, only the event
+// headers, the parsed events, carState only, and with a cold and a warm index cache.
+//
+// usage: routereader [segments] [decompressed_mb_per_segment] [dir]
+
+#include <unistd.h>
+#include <zstd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/routereader.h"
+
+const std::string ROUTE = "0123456789abcdef|2024-01-01--00-00-00";
+
+static void generate(const std::string &dir, int segments, size_t decompressed_mb) {
+  std::mt19937 rng(42);
+  for (int n = 0; n < segments; ++n) {
+    std::string raw;
+    uint64_t mono_time = 1e9 + n * 60e9;
+    for (int i = 0; raw.size() < decompressed_mb * 1024 * 1024; ++i) {
+      MessageBuilder msg;
+      auto evt = msg.initEvent();
+      evt.setLogMonoTime(mono_time += 1e6);
+      if (i % 10 == 0) {
+        auto cs = evt.initCarState();
+        cs.setVEgo(rng() % 40);
+      } else {
+        auto can = evt.initCan(16);
+        for (int j = 0; j < 16; ++j) {
+          can[j].setAddress(rng() % 2048);
+          uint64_t dat = ((uint64_t)rng() << 32) | (rng() & 0xff);
+          can[j].setDat(kj::arrayPtr((const capnp::byte *)&dat, sizeof(dat)));
+        }
+      }
+      auto bytes = msg.toBytes();
+      raw.append((const char *)bytes.begin(), bytes.size());
+    }
+
+    std::string zst(ZSTD_compressBound(raw.size()), '\0');
+    zst.resize(ZSTD_compress(zst.data(), zst.size(), raw.data(), raw.size(), 3));
+    const std::string segment_dir = dir + "/2024-01-01--00-00-00--" + std::to_string(n);
+    util::create_directories(segment_dir, 0755);
+    std::ofstream(segment_dir + "/rlog.zst", std::ios::binary).write(zst.data(), zst.size());
+  }
+}
+
+// Reads the whole route, fn is called with every event
+template <class Fn>
+static void run(const char *name, const std::string &dir, const std::vector<std::string> &allow, uint32_t flags, Fn fn) {
+  double start = millis_since_boot();
+  RouteReader reader(ROUTE, allow, flags, dir);
+  if (!reader.load()) {
+    printf("failed to load route %s from %s\n", ROUTE.c_str(), dir.c_str());
+    exit(1);
+  }
+  size_t events = 0;
+  while (reader.next()) {
+    fn(reader);
+    ++events;
+  }
+  double seconds = (millis_since_boot() - start) / 1000;
+  printf("%-10s %12zu %10.2f %14.0f\n", name, events, seconds, events / seconds);
+}
+
+int main(int argc, char *argv[]) {
+  int segments = argc > 1 ? atoi(argv[1]) : 10;
+  size_t decompressed_mb = argc > 2 ? atoi(argv[2]) : 32;
+  std::string dir = argc > 3 ? argv[3] : "/tmp/replay_routereader_route";
+  generate(dir, segments, decompressed_mb);
+
+  const uint32_t flags = REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_NO_FILE_CACHE;
+  uint64_t checksum = 0;
+  double speed_sum = 0;
+  printf("%d segments of %zu MB decompressed\n", segments, decompressed_mb);
+  printf("%-10s %12s %10s %14s\n", "", "events", "seconds", "events/s");
+  run("headers", dir, {}, flags, [&](RouteReader &r) { checksum += r.event().mono_time; });
+  run("parsed", dir, {}, flags, [&](RouteReader &r) { checksum += r.get().getLogMonoTime(); });
+  run("carState", dir, {"carState"}, flags, [&](RouteReader &r) { speed_sum += r.get().getCarState().getVEgo(); });
+
+  for (int n = 0; n < segments; ++n) {
+    unlink((cacheFilePath(dir + "/2024-01-01--00-00-00--" + std::to_string(n) + "/rlog.zst") + ".idx").c_str());
+  }
+  run("cold index", dir, {}, flags | REPLAY_FLAG_INDEX_CACHE, [&](RouteReader &r) { checksum += r.get().getLogMonoTime(); });
+  run("warm index", dir, {}, flags | REPLAY_FLAG_INDEX_CACHE, [&](RouteReader &r) { checksum += r.get().getLogMonoTime(); });
+  printf("checksum %lu %.0f\n", checksum, speed_sum);
+  return 0;
+}
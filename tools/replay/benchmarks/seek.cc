@@ -0,0 +1,99 @@
+// Measures how long SegmentManager takes to resume after a seek across a local route.
+// Writes a synthetic route of zst rlogs, then for each number of segments that may load
+// at the same time, seeks from the start to the middle of the route and reports the time
+// until the target segment is merged, and until the whole cache window around it is.
+//
+// usage: seek [segments] [decompressed_mb_per_segment] [dir]
+
+#include <zstd.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/replay.h"
+#include "tools/replay/seg_mgr.h"
+
+const std::string ROUTE = "0123456789abcdef|2024-01-01--00-00-00";
+
+static void generate(const std::string &dir, int segments, size_t decompressed_mb) {
+  std::mt19937 rng(42);
+  for (int n = 0; n < segments; ++n) {
+    std::string raw;
+    uint64_t mono_time = 1e9 + n * 60e9;
+    while (raw.size() < decompressed_mb * 1024 * 1024) {
+      MessageBuilder msg;
+      auto evt = msg.initEvent();
+      evt.setLogMonoTime(mono_time += 1e6);
+      auto can = evt.initCan(64);
+      for (int j = 0; j < 64; ++j) {
+        can[j].setAddress(rng() % 2048);
+        uint64_t dat = ((uint64_t)rng() << 32) | (rng() & 0xff);
+        can[j].setDat(kj::arrayPtr((const capnp::byte *)&dat, sizeof(dat)));
+      }
+      auto bytes = msg.toBytes();
+      raw.append((const char *)bytes.begin(), bytes.size());
+    }
+
+    std::string zst(ZSTD_compressBound(raw.size()), '\0');
+    zst.resize(ZSTD_compress(zst.data(), zst.size(), raw.data(), raw.size(), 3));
+    const std::string segment_dir = dir + "/2024-01-01--00-00-00--" + std::to_string(n);
+    util::create_directories(segment_dir, 0755);
+    std::ofstream(segment_dir + "/rlog.zst", std::ios::binary).write(zst.data(), zst.size());
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int segments = argc > 1 ? atoi(argv[1]) : 30;
+  size_t decompressed_mb = argc > 2 ? atoi(argv[2]) : 32;
+  std::string dir = argc > 3 ? argv[3] : "/tmp/replay_seek_route";
+  generate(dir, segments, decompressed_mb);
+
+  const int target = segments / 2;
+  printf("%d segments of %zu MB decompressed, seek to segment %d\n", segments, decompressed_mb, target);
+  printf("%-8s %12s %12s\n", "loaders", "resume ms", "window ms");
+  for (int loaders : {1, 2, MAX_LOADING_SEGMENTS, 6}) {
+    std::mutex lock;
+    std::condition_variable cv;
+    SegmentManager mgr(ROUTE, REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_NO_FILE_CACHE, dir);
+    mgr.max_loading_segments_ = loaders;
+    mgr.setCallback([&]() {
+      std::lock_guard lk(lock);
+      cv.notify_all();
+    });
+
+    // Waits until the segments [first, last) are merged, returns the time it took in ms
+    auto wait_for = [&](int first, int last, double start) {
+      std::unique_lock lk(lock);
+      cv.wait(lk, [&]() {
+        auto data = mgr.getEventData();
+        for (int n = first; n < last; ++n) {
+          if (!data->isSegmentLoaded(n)) return false;
+        }
+        return true;
+      });
+      return millis_since_boot() - start;
+    };
+
+    if (!mgr.load()) {
+      printf("failed to load route %s from %s\n", ROUTE.c_str(), dir.c_str());
+      return 1;
+    }
+    const int behind = mgr.segment_cache_limit_ / 2;
+    mgr.setCurrentSegment(0);
+    wait_for(0, 1, millis_since_boot());
+
+    double start = millis_since_boot();
+    mgr.setCurrentSegment(target);
+    double resume = wait_for(target, target + 1, start);
+    double window = wait_for(target - behind, target - behind + mgr.segment_cache_limit_, start);
+    printf("%-8d %12.1f %12.1f\n", loaders, resume, window);
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Compares merging segments into a single sorted vector, the way SegmentManager used to,
+// against collecting per-segment runs and walking them with an EventCursor. Synthetic
+// segments of 60s each are slid through a cache window one at a time, like playing
+// through a route, and the cost of each merge, of a seek and of stepping is reported.
+//
+// usage: seg_merge [segments] [events_per_segment] [window]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "common/timing.h"
+#include "tools/replay/seg_mgr.h"
+
+constexpr uint64_t SEGMENT_NS = 60e9;
+
+static std::vector<Event> make_segment(int n, size_t count, std::mt19937 &rng) {
+  std::vector<Event> events;
+  events.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t mono_time = n * SEGMENT_NS + rng() % SEGMENT_NS;
+    events.emplace_back(cereal::Event::Which::CAN, mono_time, kj::ArrayPtr<const capnp::word>{});
+  }
+  std::sort(events.begin(), events.end());
+  return events;
+}
+
+// The old SegmentManager::mergeSegments
+static std::vector<Event> merge_vector(const std::map<int, std::vector<Event>> &window) {
+  std::vector<Event> merged;
+  for (const auto &[n, events] : window) {
+    auto middle = merged.insert(merged.end(), events.begin(), events.end());
+    std::inplace_merge(merged.begin(), middle, merged.end());
+  }
+  return merged;
+}
+
+static std::vector<EventCursor::Run> merge_runs(const std::map<int, std::vector<Event>> &window) {
+  std::vector<EventCursor::Run> runs;
+  for (const auto &[n, events] : window) {
+    runs.emplace_back(events.data(), events.data() + events.size());
+  }
+  return runs;
+}
+
+int main(int argc, char *argv[]) {
+  int segments = argc > 1 ? atoi(argv[1]) : 60;
+  size_t events_per_segment = argc > 2 ? atoi(argv[2]) : 300000;
+  int window = argc > 3 ? atoi(argv[3]) : MIN_SEGMENTS_CACHE;
+
+  std::mt19937 rng(42);
+  std::vector<std::vector<Event>> route(segments);
+  for (int n = 0; n < segments; ++n) {
+    route[n] = make_segment(n, events_per_segment, rng);
+  }
+
+  double vector_ms = 0, runs_ms = 0, vector_max_ms = 0, runs_max_ms = 0;
+  std::vector<Event> merged;
+  std::vector<EventCursor::Run> runs;
+  std::map<int, std::vector<Event>> cache;
+  for (int n = 0; n < segments; ++n) {
+    cache[n] = route[n];
+    if ((int)cache.size() > window) cache.erase(cache.begin());
+
+    double start = millis_since_boot();
+    merged = merge_vector(cache);
+    double t = millis_since_boot() - start;
+    vector_ms += t;
+    vector_max_ms = std::max(vector_max_ms, t);
+
+    start = millis_since_boot();
+    runs = merge_runs(cache);
+    t = millis_since_boot() - start;
+    runs_ms += t;
+    runs_max_ms = std::max(runs_max_ms, t);
+  }
+
+  // Seek to random points of the last window
+  const int seeks = 10000;
+  const uint64_t window_start = merged.front().mono_time, window_ns = merged.back().mono_time - window_start;
+  std::vector<Event> targets;
+  for (int i = 0; i < seeks; ++i) {
+    targets.emplace_back(cereal::Event::Which::CAN, window_start + rng() % window_ns, kj::ArrayPtr<const capnp::word>{});
+  }
+
+  uint64_t checksum = 0;
+  double start = millis_since_boot();
+  for (const auto &e : targets) {
+    checksum += std::upper_bound(merged.cbegin(), merged.cend(), e)->mono_time;
+  }
+  double vector_seek_us = (millis_since_boot() - start) * 1000 / seeks;
+
+  start = millis_since_boot();
+  for (const auto &e : targets) {
+    checksum -= EventCursor(runs, e)->mono_time;
+  }
+  double runs_seek_us = (millis_since_boot() - start) * 1000 / seeks;
+
+  // Step through the whole window
+  const Event before(cereal::Event::Which::INIT_DATA, 0, {});
+  start = millis_since_boot();
+  for (auto it = merged.cbegin(); it != merged.cend(); ++it) {
+    checksum += it->mono_time;
+  }
+  double vector_step_ns = (millis_since_boot() - start) * 1e6 / merged.size();
+
+  start = millis_since_boot();
+  size_t stepped = 0;
+  for (auto it = EventCursor(runs, before); !it.done(); ++it, ++stepped) {
+    checksum -= it->mono_time;
+  }
+  double runs_step_ns = (millis_since_boot() - start) * 1e6 / stepped;
+
+  if (checksum != 0 || stepped != merged.size()) {
+    printf("cursor and merged vector disagree\n");
+    return 1;
+  }
+
+  printf("%d segments, %zu events per segment, window of %d\n", segments, events_per_segment, window);
+  printf("%-8s %12s %12s %10s %10s\n", "", "merge ms", "max ms", "seek us", "step ns");
+  printf("%-8s %12.3f %12.3f %10.3f %10.3f\n", "vector", vector_ms / segments, vector_max_ms, vector_seek_us, vector_step_ns);
+  printf("%-8s %12.3f %12.3f %10.3f %10.3f\n", "cursor", runs_ms / segments, runs_max_ms, runs_seek_us, runs_step_ns);
+  return 0;
+}
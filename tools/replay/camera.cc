@@ -2,14 +2,14 @@
 
 #include <cassert>
 #include <algorithm>
+#include <limits>
 
 #include <capnp/dynamic.h>
 
+#include "cereal/messaging/visionipc_stats.h"
 #include "third_party/linux/include/msm_media_info.h"
 #include "tools/replay/util.h"
 
-const int BUFFER_COUNT = 40;
-
 std::tuple<size_t, size_t, size_t> get_nv12_info(int width, int height) {
   int nv12_width = VENUS_Y_STRIDE(COLOR_FMT_NV12, width);
   int nv12_height = VENUS_Y_SCANLINES(COLOR_FMT_NV12, height);
@@ -32,7 +32,7 @@ CameraServer::~CameraServer() {
       // Clear the queue
       std::pair<FrameReader*, const Event *> item;
       while (cam.queue.try_pop(item)) {
-        --publishing_;
+        frameSent();
       }
 
       // Signal termination and join the thread
@@ -46,7 +46,7 @@ CameraServer::~CameraServer() {
 void CameraServer::startVipcServer() {
   vipc_server_.reset(new VisionIpcServer("camerad"));
   for (auto &cam : cameras_) {
-    cam.cached_buf.clear();
+    cam.cached_buf.fill(nullptr);
 
     if (cam.width > 0 && cam.height > 0) {
       rInfo("camera[%d] frame size %dx%d", cam.type, cam.width, cam.height);
@@ -58,6 +58,12 @@ void CameraServer::startVipcServer() {
       }
     }
   }
+  if (!stats_pm_) {
+    stats_pm_ = std::make_unique<PubMaster>(std::vector<const char *>{"visionipcStats"});
+  }
+  vipc_server_->set_stats_callback([this](const std::map<VisionStreamType, VisionIpcStats> &stats) {
+    publish_visionipc_stats(*stats_pm_, "replay", stats);
+  });
   vipc_server_->start_listener();
 }
 
@@ -86,25 +92,35 @@ void CameraServer::cameraThread(Camera &cam) {
     // Prefetch the next frame
     getFrame(cam, fr, segment_id + 1, frame_id + 1);
 
-    --publishing_;
+    frameSent();
   }
 }
 
 VisionBuf *CameraServer::getFrame(Camera &cam, FrameReader *fr, int32_t segment_id, uint32_t frame_id) {
   // Check if the frame is cached
-  auto buf_it = std::find_if(cam.cached_buf.begin(), cam.cached_buf.end(),
-                             [frame_id](VisionBuf *buf) { return buf->get_frame_id() == frame_id; });
-  if (buf_it != cam.cached_buf.end()) return *buf_it;
+  VisionBuf *&slot = cam.cached_buf[frame_id % BUFFER_COUNT];
+  if (slot && slot->get_frame_id() == frame_id) return slot;
 
   VisionBuf *yuv_buf = vipc_server_->get_buffer(cam.stream_type);
+  if (!yuv_buf) return nullptr;
+
+  // The buffer may be in another slot, it holds no frame until this one is decoded
+  yuv_buf->set_frame_id(std::numeric_limits<uint64_t>::max());
   if (fr->get(segment_id, yuv_buf)) {
     yuv_buf->set_frame_id(frame_id);
-    cam.cached_buf.insert(yuv_buf);
+    slot = yuv_buf;
     return yuv_buf;
   }
   return nullptr;
 }
 
+void CameraServer::frameSent() {
+  std::lock_guard lk(publishing_lock_);
+  if (--publishing_ == 0) {
+    publishing_cv_.notify_all();
+  }
+}
+
 void CameraServer::pushFrame(CameraType type, FrameReader *fr, const Event *event) {
   auto &cam = cameras_[type];
   if (cam.width != fr->width || cam.height != fr->height) {
@@ -114,12 +130,14 @@ void CameraServer::pushFrame(CameraType type, FrameReader *fr, const Event *even
     startVipcServer();
   }
 
-  ++publishing_;
+  {
+    std::lock_guard lk(publishing_lock_);
+    ++publishing_;
+  }
   cam.queue.push({fr, event});
 }
 
 void CameraServer::waitForSent() {
-  while (publishing_ > 0) {
-    std::this_thread::yield();
-  }
+  std::unique_lock lk(publishing_lock_);
+  publishing_cv_.wait(lk, [this]() { return publishing_ == 0; });
 }
@@ -1,15 +1,20 @@
 #pragma once
 
+#include <array>
+#include <condition_variable>
 #include <memory>
-#include <set>
+#include <mutex>
 #include <tuple>
 #include <utility>
 
+#include "cereal/messaging/messaging.h"
 #include "msgq/visionipc/visionipc_server.h"
 #include "common/queue.h"
 #include "tools/replay/framereader.h"
 #include "tools/replay/logreader.h"
 
+const int BUFFER_COUNT = 40;
+
 std::tuple<size_t, size_t, size_t> get_nv12_info(int width, int height);
 
 class CameraServer {
@@ -27,17 +32,22 @@ protected:
     int height;
     std::thread thread;
     SafeQueue<std::pair<FrameReader*, const Event *>> queue;
-    std::set<VisionBuf *> cached_buf;
+    // Decoded frames in slot frame_id % BUFFER_COUNT, valid while the buffer still holds that frame
+    std::array<VisionBuf *, BUFFER_COUNT> cached_buf = {};
   };
   void startVipcServer();
   void cameraThread(Camera &cam);
   VisionBuf *getFrame(Camera &cam, FrameReader *fr, int32_t segment_id, uint32_t frame_id);
+  void frameSent();
 
   Camera cameras_[MAX_CAMERAS] = {
       {.type = RoadCam, .stream_type = VISION_STREAM_ROAD},
       {.type = DriverCam, .stream_type = VISION_STREAM_DRIVER},
       {.type = WideRoadCam, .stream_type = VISION_STREAM_WIDE_ROAD},
   };
-  std::atomic<int> publishing_ = 0;
+  std::mutex publishing_lock_;
+  std::condition_variable publishing_cv_;
+  int publishing_ = 0;
+  std::unique_ptr<PubMaster> stats_pm_;
   std::unique_ptr<VisionIpcServer> vipc_server_;
 };
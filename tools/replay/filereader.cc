@@ -33,6 +33,27 @@ std::string FileReader::read(const std::string &file, std::atomic<bool> *abort)
   return result;
 }
 
+bool FileReader::read(const std::string &file, const std::function<bool(const char *, size_t)> &on_data,
+                      std::atomic<bool> *abort) {
+  const bool is_remote = file.find("https://") == 0;
+  const std::string local_file = is_remote ? cacheFilePath(file) : file;
+
+  if ((!is_remote || cache_to_local_) && util::file_exists(local_file)) {
+    std::ifstream fs(local_file, std::ios::binary | std::ios::in);
+    std::string buf(1024 * 1024, '\0');
+    while (fs && !(abort && *abort)) {
+      fs.read(buf.data(), buf.size());
+      if (fs.gcount() > 0 && !on_data(buf.data(), fs.gcount())) {
+        return false;
+      }
+    }
+    return fs.eof() && !(abort && *abort);
+  }
+
+  std::string result = read(file, abort);
+  return !result.empty() && on_data(result.data(), result.size());
+}
+
 std::string FileReader::download(const std::string &url, std::atomic<bool> *abort) {
   for (int i = 0; i <= max_retries_ && !(abort && *abort); ++i) {
     if (i > 0) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
 #include <string>
 
 class FileReader {
@@ -9,6 +10,10 @@ public:
       : cache_to_local_(cache_to_local), chunk_size_(chunk_size), max_retries_(retries) {}
   virtual ~FileReader() {}
   std::string read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // Passes the file to on_data in pieces, stops when it returns false. Local and cached
+  // files are read a chunk at a time, remote files are downloaded first.
+  bool read(const std::string &file, const std::function<bool(const char *, size_t)> &on_data,
+            std::atomic<bool> *abort = nullptr);
 
 private:
   std::string download(const std::string &url, std::atomic<bool> *abort);
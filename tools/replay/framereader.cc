@@ -1,5 +1,6 @@
 #include "tools/replay/framereader.h"
 
+#include <list>
 #include <map>
 #include <memory>
 #include <tuple>
@@ -7,6 +8,7 @@
 
 #include "common/util.h"
 #include "third_party/libyuv/include/libyuv.h"
+#include "tools/replay/camera.h"
 #include "tools/replay/util.h"
 #include "system/hardware/hw.h"
 
@@ -61,6 +63,120 @@ struct DecoderManager {
 
 DecoderManager decoder_manager;
 
+// Decoded frames of all FrameReaders as packed NV12, grouped by GOP. GOPs are dropped as a
+// whole, any frame of a GOP has to be decoded from its key frame again anyway.
+class FrameCache {
+public:
+  bool get(const FrameReader *reader, int key_frame, int idx, VisionBuf *buf) {
+    std::lock_guard lk(mutex_);
+    auto it = gops_.find({reader, key_frame});
+    if (it == gops_.end()) return false;
+    auto frame = it->second->frames.find(idx);
+    if (frame == it->second->frames.end()) return false;
+
+    lru_.splice(lru_.begin(), lru_, it->second);
+    const uint8_t *y = frame->second.get(), *uv = y + reader->width * reader->height;
+    for (int i = 0; i < reader->height; ++i) {
+      memcpy(buf->y + i * buf->stride, y + i * reader->width, reader->width);
+    }
+    for (int i = 0; i < reader->height / 2; ++i) {
+      memcpy(buf->uv + i * buf->stride, uv + i * reader->width, reader->width);
+    }
+    return true;
+  }
+
+  bool contains(const FrameReader *reader, int key_frame, int idx) {
+    std::lock_guard lk(mutex_);
+    auto it = gops_.find({reader, key_frame});
+    return it != gops_.end() && it->second->frames.count(idx) > 0;
+  }
+
+  void put(const FrameReader *reader, int key_frame, int idx, const VisionBuf *buf) {
+    const size_t frame_size = reader->width * reader->height * 3 / 2;
+    if (capacity() < frame_size || contains(reader, key_frame, idx)) return;
+
+    auto frame = std::make_unique<uint8_t[]>(frame_size);
+    uint8_t *y = frame.get(), *uv = y + reader->width * reader->height;
+    for (int i = 0; i < reader->height; ++i) {
+      memcpy(y + i * reader->width, buf->y + i * buf->stride, reader->width);
+    }
+    for (int i = 0; i < reader->height / 2; ++i) {
+      memcpy(uv + i * reader->width, buf->uv + i * buf->stride, reader->width);
+    }
+
+    std::lock_guard lk(mutex_);
+    const Key key = {reader, key_frame};
+    auto it = gops_.find(key);
+    if (it == gops_.end()) {
+      lru_.push_front(Gop{key});
+      it = gops_.emplace(key, lru_.begin()).first;
+    } else {
+      lru_.splice(lru_.begin(), lru_, it->second);
+    }
+    auto gop = it->second;
+    if (gop->frames.emplace(idx, std::move(frame)).second) {
+      gop->size += frame_size;
+      size_ += frame_size;
+    }
+    evict();
+  }
+
+  void erase(const FrameReader *reader) {
+    std::lock_guard lk(mutex_);
+    for (auto it = lru_.begin(); it != lru_.end();) {
+      if (it->key.first == reader) {
+        size_ -= it->size;
+        gops_.erase(it->key);
+        it = lru_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void setCapacity(size_t capacity) {
+    std::lock_guard lk(mutex_);
+    capacity_ = capacity;
+    evict();
+  }
+
+  size_t capacity() {
+    std::lock_guard lk(mutex_);
+    return capacity_;
+  }
+
+  size_t size() {
+    std::lock_guard lk(mutex_);
+    return size_;
+  }
+
+private:
+  using Key = std::pair<const FrameReader *, int>;  // The reader and the key frame of the GOP
+  struct Gop {
+    Key key;
+    std::map<int, std::unique_ptr<uint8_t[]>> frames;
+    size_t size = 0;
+  };
+
+  // Drops the least recently used GOPs, the most recent one is kept while it is in use
+  void evict() {
+    while (size_ > capacity_ && !lru_.empty() && (lru_.size() > 1 || capacity_ == 0)) {
+      size_ -= lru_.back().size;
+      gops_.erase(lru_.back().key);
+      lru_.pop_back();
+    }
+  }
+
+  std::mutex mutex_;
+  std::list<Gop> lru_;  // Most recently used first
+  std::map<Key, std::list<Gop>::iterator> gops_;
+  size_t capacity_ = DEFAULT_FRAME_CACHE_SIZE;
+  size_t size_ = 0;
+};
+
+FrameCache frame_cache;
+std::atomic<uint64_t> frames_decoded = 0, cache_hits = 0, cache_misses = 0;
+
 }  // namespace
 
 FrameReader::FrameReader() {
@@ -68,6 +184,18 @@ FrameReader::FrameReader() {
 }
 
 FrameReader::~FrameReader() {
+  {
+    std::lock_guard lk(lookahead_lock_);
+    exit_ = true;
+  }
+  lookahead_cv_.notify_one();
+  if (lookahead_thread_.joinable()) lookahead_thread_.join();
+
+  frame_cache.erase(this);
+  if (decoder_) {
+    std::lock_guard lk(decoder_->lock);
+    if (decoder_->last_reader == this) decoder_->last_reader = nullptr;
+  }
   if (input_ctx) avformat_close_input(&input_ctx);
 }
 
@@ -104,10 +232,12 @@ bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no
   height = decoder_->height;
 
   AVPacket pkt;
+  int key_frame = 0;
   packets_info.reserve(60 * 20);  // 20fps, one minute
   while (!(abort && *abort) && av_read_frame(input_ctx, &pkt) == 0) {
     if (pkt.stream_index == video_stream_idx_) {
-      packets_info.emplace_back(PacketInfo{.flags = pkt.flags, .pos = pkt.pos});
+      if (pkt.flags & AV_PKT_FLAG_KEY) key_frame = packets_info.size();
+      packets_info.emplace_back(PacketInfo{.flags = pkt.flags, .pos = pkt.pos, .key_frame = key_frame});
     }
     av_packet_unref(&pkt);
   }
@@ -119,7 +249,98 @@ bool FrameReader::get(int idx, VisionBuf *buf) {
   if (!buf || idx < 0 || idx >= packets_info.size()) {
     return false;
   }
-  return decoder_->decode(this, idx, buf);
+
+  const int key_frame = packets_info[idx].key_frame;
+  bool ret = cache && frame_cache.get(this, key_frame, idx, buf);
+  if (ret) {
+    ++cache_hits;
+  } else {
+    std::lock_guard lk(decoder_->lock);
+    // The lookahead may have decoded it while waiting for the decoder
+    ret = cache && frame_cache.get(this, key_frame, idx, buf);
+    if (ret) {
+      ++cache_hits;
+    } else {
+      ++cache_misses;
+      ret = decode(idx, buf);
+    }
+  }
+
+  if (cache && lookahead > 0 && frame_cache.capacity() > 0) {
+    std::lock_guard lk(lookahead_lock_);
+    cursor_ = idx;
+    if (!lookahead_thread_.joinable()) {
+      lookahead_thread_ = std::thread(&FrameReader::lookaheadThread, this);
+    }
+    lookahead_cv_.notify_one();
+  }
+  return ret;
+}
+
+void FrameReader::setCacheSize(size_t size) {
+  frame_cache.setCapacity(size);
+}
+
+FrameReader::CacheStats FrameReader::cacheStats() {
+  return {.decoded = frames_decoded, .hits = cache_hits, .misses = cache_misses, .size = frame_cache.size()};
+}
+
+void FrameReader::cacheFrame(int idx, const VisionBuf *buf) {
+  ++frames_decoded;
+  if (cache) {
+    frame_cache.put(this, packets_info[idx].key_frame, idx, buf);
+  }
+}
+
+// Must be called with the decoder locked
+bool FrameReader::decode(int idx, VisionBuf *buf) {
+  if (decoder_->last_reader != this) {
+    // The decoder state belongs to another reader, seek to the key frame
+    decoder_->last_reader = this;
+    prev_idx = -2;
+  }
+  if (!decoder_->decode(this, idx, buf)) {
+    prev_idx = -2;
+    return false;
+  }
+  return true;
+}
+
+// Decodes the frames after the cursor into the cache, so that playback and stepping
+// forward don't wait for the decoder
+void FrameReader::lookaheadThread() {
+  auto [nv12_width, nv12_height, nv12_buffer_size] = get_nv12_info(width, height);
+  VisionBuf buf;
+  buf.allocate(nv12_buffer_size);
+  buf.init_yuv(width, height, nv12_width, nv12_width * nv12_height);
+
+  int done = -1;  // The cursor the lookahead is done for
+  std::unique_lock lk(lookahead_lock_);
+  while (true) {
+    lookahead_cv_.wait(lk, [&]() { return exit_ || cursor_ != done; });
+    if (exit_) break;
+
+    const int cursor = cursor_;
+    const int last = std::min<int>(cursor + lookahead, packets_info.size() - 1);
+    for (int i = cursor + 1; i <= last; ++i) {
+      // Give up on the window when the cursor left it
+      if (exit_ || cursor_ < cursor || cursor_ > last) break;
+
+      const int key_frame = packets_info[i].key_frame;
+      lk.unlock();
+      bool ok = frame_cache.contains(this, key_frame, i);
+      if (!ok) {
+        std::lock_guard decoder_lk(decoder_->lock);
+        ok = frame_cache.contains(this, key_frame, i) ||
+             (decode(i, &buf) && frame_cache.contains(this, key_frame, i));
+      }
+      lk.lock();
+      if (!ok) break;  // Failed to decode, or the cache is too small to hold it
+    }
+    done = cursor;
+  }
+  lk.unlock();
+  buf.free();
 }
 
 // class VideoDecoder
@@ -186,16 +407,10 @@ bool FFmpegVideoDecoder::initHardwareDecoder(AVHWDeviceType hw_device_type) {
 }
 
 bool FFmpegVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
-  int current_idx = idx;
-  if (idx != reader->prev_idx + 1) {
-    // seeking to the nearest key frame
-    for (int i = idx; i >= 0; --i) {
-      if (reader->packets_info[i].flags & AV_PKT_FLAG_KEY) {
-        current_idx = i;
-        break;
-      }
-    }
-
+  int current_idx = reader->prev_idx + 1;
+  if (idx < current_idx || reader->packets_info[idx].key_frame > current_idx) {
+    // seeking to the nearest key frame, unless decoding on reaches idx sooner
+    current_idx = reader->packets_info[idx].key_frame;
     auto pos = reader->packets_info[current_idx].pos;
     int ret = avformat_seek_file(reader->input_ctx, 0, pos, pos, pos, AVSEEK_FLAG_BYTE);
     if (ret < 0) {
@@ -221,8 +436,11 @@ bool FFmpegVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
       return false;
     }
 
+    // Frames on the way to idx are cached too, stepping back within the GOP won't decode them again
+    if (!copyBuffer(frame, buf)) return false;
+    reader->cacheFrame(current_idx, buf);
     if (current_idx++ == idx) {
-      return copyBuffer(frame, buf);
+      return true;
     }
   }
   rError("Failed to find frame at index %d", idx);
@@ -280,16 +498,10 @@ bool QcomVideoDecoder::open(AVCodecParameters *codecpar, bool hw_decoder) {
 }
 
 bool QcomVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
-  int from_idx = idx;
-  if (idx != reader->prev_idx + 1) {
-    // seeking to the nearest key frame
-    for (int i = idx; i >= 0; --i) {
-      if (reader->packets_info[i].flags & AV_PKT_FLAG_KEY) {
-        from_idx = i;
-        break;
-      }
-    }
-
+  int from_idx = reader->prev_idx + 1;
+  if (idx < from_idx || reader->packets_info[idx].key_frame > from_idx) {
+    // seeking to the nearest key frame, unless decoding on reaches idx sooner
+    from_idx = reader->packets_info[idx].key_frame;
     auto pos = reader->packets_info[from_idx].pos;
     int ret = avformat_seek_file(reader->input_ctx, 0, pos, pos, pos, AVSEEK_FLAG_BYTE);
     if (ret < 0) {
@@ -303,7 +515,9 @@ bool QcomVideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
   msm_vidc.avctx = reader->input_ctx;
   for (int i = from_idx; i <= idx; ++i) {
     if (av_read_frame(reader->input_ctx, &pkt) == 0) {
-      result = msm_vidc.decodeFrame(&pkt, buf) && (i == idx);
+      bool decoded = msm_vidc.decodeFrame(&pkt, buf);
+      if (decoded) reader->cacheFrame(i, buf);
+      result = decoded && (i == idx);
       av_packet_unref(&pkt);
     }
   }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "msgq/visionipc/visionbuf.h"
@@ -18,17 +22,37 @@ extern "C" {
 
 class VideoDecoder;
 
+const size_t DEFAULT_FRAME_CACHE_SIZE = 256 * 1024 * 1024;
+const int DEFAULT_FRAME_LOOKAHEAD = 10;
+
 class FrameReader {
 public:
+  struct CacheStats {
+    uint64_t decoded = 0;  // Frames decoded by all FrameReaders
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t size = 0;       // Bytes of decoded frames in the cache
+  };
+
   FrameReader();
   ~FrameReader();
   bool load(CameraType type, const std::string &url, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr, bool local_cache = false,
             int chunk_size = -1, int retries = 0);
   bool loadFromFile(CameraType type, const std::string &file, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr);
+  // Copies the frame from the cache or decodes it, then decodes the next frames in the background
   bool get(int idx, VisionBuf *buf);
   size_t getFrameCount() const { return packets_info.size(); }
+  // Decoded frames of all FrameReaders are cached in whole GOPs, least recently used GOPs
+  // are dropped to stay within size. A size of 0 turns off caching and lookahead.
+  static void setCacheSize(size_t size);
+  static CacheStats cacheStats();
+  // Called by the decoders with every frame they decode
+  void cacheFrame(int idx, const VisionBuf *buf);
 
   int width = 0, height = 0;
+  int lookahead = DEFAULT_FRAME_LOOKAHEAD;
+  // Off for readers that get every frame once, in order: frames are neither cached nor decoded ahead
+  bool cache = true;
 
   VideoDecoder *decoder_ = nullptr;
   AVFormatContext *input_ctx = nullptr;
@@ -37,8 +61,19 @@ public:
   struct PacketInfo {
     int flags;
     int64_t pos;
+    int key_frame;  // Index of the key frame that starts the GOP of this frame
   };
   std::vector<PacketInfo> packets_info;
+
+private:
+  bool decode(int idx, VisionBuf *buf);
+  void lookaheadThread();
+
+  std::mutex lookahead_lock_;
+  std::condition_variable lookahead_cv_;
+  std::thread lookahead_thread_;
+  int cursor_ = -1;  // The last frame passed to get()
+  bool exit_ = false;
 };
 
 
@@ -48,6 +83,10 @@ public:
   virtual bool open(AVCodecParameters *codecpar, bool hw_decoder) = 0;
   virtual bool decode(FrameReader *reader, int idx, VisionBuf *buf) = 0;
   int width = 0, height = 0;
+
+  // Decoders are shared by the FrameReaders of a camera, only one of them may decode at a time
+  std::mutex lock;
+  const FrameReader *last_reader = nullptr;
 };
 
 class FFmpegVideoDecoder : public VideoDecoder {
@@ -1,66 +1,335 @@
 #include "tools/replay/logreader.h"
 
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <utility>
+#include "common/util.h"
 #include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
-#include "common/util.h"
 
-bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
-  std::string data = FileReader(local_cache, chunk_size, retries).read(url, abort);
-  if (!data.empty()) {
-    if (url.find(".bz2") != std::string::npos || util::starts_with(data, "BZh9")) {
-      data = decompressBZ2(data, abort);
-    } else if (url.find(".zst") != std::string::npos || util::starts_with(data, "\x28\xB5\x2F\xFD")) {
-      data = decompressZST(data, abort);
+namespace {
+
+// Decompressed data is collected in blocks of this size, messages don't span blocks
+constexpr size_t BLOCK_SIZE = 4 * 1024 * 1024;
+
+// An index file is the header, the decompressed log and an entry for each message
+constexpr uint32_t INDEX_MAGIC = 0x58444952;  // "RIDX"
+constexpr uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint8_t source_sha256[SHA256_DIGEST_LENGTH];
+  uint64_t source_size;
+  uint64_t payload_words;
+  uint64_t entry_count;
+};
+static_assert(sizeof(IndexHeader) % sizeof(capnp::word) == 0, "the payload must be word aligned");
+
+struct IndexEntry {
+  uint64_t mono_time;
+  uint64_t offset;  // in words
+  uint32_t size;    // in words
+  uint16_t which;
+  uint16_t reserved;
+};
+
+std::string indexFilePath(const std::string &url) {
+  return cacheFilePath(url) + ".idx";
+}
+
+// Compares the source file with the one the index was created from
+bool sourceMatches(const std::string &source, const IndexHeader &header, std::atomic<bool> *abort) {
+  std::ifstream fs(source, std::ios::binary | std::ios::ate);
+  if (!fs || (uint64_t)fs.tellg() != header.source_size) return false;
+
+  fs.seekg(0);
+  SHA256_CTX sha;
+  SHA256_Init(&sha);
+  std::string buf(1024 * 1024, '\0');
+  while (fs && !(abort && *abort)) {
+    fs.read(buf.data(), buf.size());
+    SHA256_Update(&sha, buf.data(), fs.gcount());
+  }
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256_Final(digest, &sha);
+  return fs.eof() && !(abort && *abort) && memcmp(digest, header.source_sha256, sizeof(digest)) == 0;
+}
+
+bool isEncodeIdx(cereal::Event::Which which) {
+  return which == cereal::Event::ROAD_ENCODE_IDX ||
+         which == cereal::Event::DRIVER_ENCODE_IDX ||
+         which == cereal::Event::WIDE_ROAD_ENCODE_IDX;
+}
+
+}  // namespace
+
+// Writes the index of a log while it is loaded. The index goes to a temporary file that
+// replaces the old index once the whole log was parsed.
+class LogReader::IndexWriter {
+public:
+  IndexWriter(const std::string &path) : path_(path), tmp_path_(path + "." + util::random_string(8)) {
+    IndexHeader header = {};
+    fs_.open(tmp_path_, std::ios::binary | std::ios::out);
+    fs_.write((const char *)&header, sizeof(header));
+    SHA256_Init(&sha_);
+  }
+  ~IndexWriter() {
+    if (!committed_) {
+      fs_.close();
+      unlink(tmp_path_.c_str());
     }
   }
+  void source(const char *data, size_t size) {
+    SHA256_Update(&sha_, data, size);
+    source_size_ += size;
+  }
+  void payload(const char *data, size_t size) {
+    fs_.write(data, size);
+    payload_size_ += size;
+  }
+  void add(uint64_t offset, uint32_t size, cereal::Event::Which which, uint64_t mono_time) {
+    entries_.push_back({mono_time, offset, size, (uint16_t)which, 0});
+  }
+  bool commit() {
+    if (payload_size_ % sizeof(capnp::word) != 0) return false;
+
+    IndexHeader header = {};
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    SHA256_Final(header.source_sha256, &sha_);
+    header.source_size = source_size_;
+    header.payload_words = payload_size_ / sizeof(capnp::word);
+    header.entry_count = entries_.size();
+    fs_.write((const char *)entries_.data(), entries_.size() * sizeof(IndexEntry));
+    fs_.seekp(0);
+    fs_.write((const char *)&header, sizeof(header));
+    fs_.close();
+    committed_ = !fs_.fail() && rename(tmp_path_.c_str(), path_.c_str()) == 0;
+    return committed_;
+  }
+  const std::string &path() const { return path_; }
 
-  bool success = !data.empty() && load(data.data(), data.size(), abort);
-  if (filters_.empty())
-    raw_ = std::move(data);
-  return success;
+private:
+  const std::string path_, tmp_path_;
+  std::ofstream fs_;
+  SHA256_CTX sha_;
+  uint64_t source_size_ = 0, payload_size_ = 0;
+  std::vector<IndexEntry> entries_;
+  bool committed_ = false;
+};
+
+LogReader::~LogReader() {
+  if (index_data_) {
+    munmap(index_data_, index_size_);
+  }
 }
 
-bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
-  try {
-    events.reserve(65000);
-    kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
-    while (words.size() > 0 && !(abort && *abort)) {
-      capnp::FlatArrayMessageReader reader(words);
-      auto event = reader.getRoot<cereal::Event>();
-      auto which = event.which();
-      auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
-      words = kj::arrayPtr(reader.getEnd(), words.end());
-      if (which == cereal::Event::Which::SELFDRIVE_STATE) {
-        requires_migration = false;
-      }
+bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries,
+                     bool index_cache) {
+  // The index can only be checked against a local file
+  const bool is_remote = url.find("https://") == 0;
+  if (index_cache && (!is_remote || local_cache)) {
+    const std::string index_file = indexFilePath(url);
+    if (loadIndex(index_file, is_remote ? cacheFilePath(url) : url, abort)) {
+      return finish(abort);
+    }
+    index_writer_ = std::make_unique<IndexWriter>(index_file);
+  }
 
-      if (!filters_.empty()) {
-        if (which >= filters_.size() || !filters_[which])
-          continue;
-        auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
-        memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
-        event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
-      }
+  std::unique_ptr<StreamDecompressor> decompressor;
+  // Complete messages are parsed as soon as they are decompressed. A message that doesn't
+  // fit into the rest of the block is moved to the next one. Without filters the events
+  // point into the blocks, so full blocks are kept.
+  std::unique_ptr<capnp::word[]> block;
+  size_t capacity = 0, filled = 0, parsed = 0;  // in bytes
+  size_t offset = 0;  // of the block in the decompressed log, in bytes
+
+  auto on_output = [&](const char *data, size_t size) {
+    if (index_writer_) index_writer_->payload(data, size);
+    while (size > 0) {
+      if (filled == capacity) {
+        const size_t partial = filled - parsed;
+        const capnp::word *partial_begin = block.get() + parsed / sizeof(capnp::word);
+        size_t expected = partial >= sizeof(capnp::word)
+            ? capnp::expectedSizeInWordsFromPrefix(kj::arrayPtr(partial_begin, partial / sizeof(capnp::word))) * sizeof(capnp::word)
+            : 0;
+        size_t new_capacity = std::max({BLOCK_SIZE, expected, partial * 2});
+        new_capacity = (new_capacity + sizeof(capnp::word) - 1) / sizeof(capnp::word) * sizeof(capnp::word);
 
-      uint64_t mono_time = event.getLogMonoTime();
-      const Event &evt = events.emplace_back(which, mono_time, event_data);
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-        if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
-          uint64_t sof = idx.getTimestampSof();
-          events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
+        if (!filters_.empty() && new_capacity == capacity) {
+          memmove(block.get(), partial_begin, partial);
+        } else {
+          auto new_block = std::make_unique<capnp::word[]>(new_capacity / sizeof(capnp::word));
+          if (partial > 0) memcpy(new_block.get(), partial_begin, partial);
+          if (filters_.empty() && parsed > 0) blocks_.push_back(std::move(block));
+          block = std::move(new_block);
+          capacity = new_capacity;
         }
+        filled = partial;
+        offset += parsed;
+        parsed = 0;
       }
+
+      size_t n = std::min(size, capacity - filled);
+      memcpy((char *)block.get() + filled, data, n);
+      filled += n;
+      data += n;
+      size -= n;
+      parsed += parse(block.get() + parsed / sizeof(capnp::word), (filled - parsed) / sizeof(capnp::word), abort,
+                      (offset + parsed) / sizeof(capnp::word)) * sizeof(capnp::word);
+    }
+    return !(abort && *abort);
+  };
+
+  events.reserve(65000);
+  bool complete = false;
+  try {
+    complete = FileReader(local_cache, chunk_size, retries).read(url, [&](const char *data, size_t size) {
+      if (!decompressor) {
+        decompressor = std::make_unique<StreamDecompressor>(StreamDecompressor::detect(url, data, size));
+      }
+      if (index_writer_) index_writer_->source(data, size);
+      return decompressor->feed(data, size, on_output);
+    }, abort);
+    if (filled > parsed && !(abort && *abort)) {
+      complete = false;
+      rWarning("Incomplete log.\nRetrieved %zu events from corrupt log", events.size());
     }
   } catch (const kj::Exception &e) {
     rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
   }
 
+  if (index_writer_) {
+    if (complete && !(abort && *abort) && !index_writer_->commit()) {
+      rWarning("failed to write index %s", index_writer_->path().c_str());
+    }
+    index_writer_.reset();
+  }
+
+  if (filters_.empty() && parsed > 0) {
+    blocks_.push_back(std::move(block));
+  }
+  return finish(abort);
+}
+
+bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
+  events.reserve(65000);
+  const size_t words = size / sizeof(capnp::word);
+  try {
+    if (parse((const capnp::word *)data, words, abort) < words && !(abort && *abort)) {
+      rWarning("Incomplete log.\nRetrieved %zu events from corrupt log", events.size());
+    }
+  } catch (const kj::Exception &e) {
+    rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
+  }
+  return finish(abort);
+}
+
+bool LogReader::loadIndex(const std::string &index_file, const std::string &source, std::atomic<bool> *abort) {
+  int fd = HANDLE_EINTR(open(index_file.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) return false;
+
+  struct stat st = {};
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(IndexHeader)) {
+    data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) return false;
+
+  const size_t file_size = st.st_size;
+  const auto &header = *(const IndexHeader *)data;
+  const auto *payload = (const capnp::word *)(&header + 1);
+  bool valid = header.magic == INDEX_MAGIC && header.version == INDEX_VERSION &&
+               header.payload_words <= file_size / sizeof(capnp::word) &&
+               header.entry_count <= file_size / sizeof(IndexEntry) &&
+               file_size == sizeof(IndexHeader) + header.payload_words * sizeof(capnp::word) + header.entry_count * sizeof(IndexEntry);
+  const auto *entries = (const IndexEntry *)(payload + header.payload_words);
+  valid = valid && std::all_of(entries, entries + header.entry_count, [&](const IndexEntry &e) {
+    return e.offset <= header.payload_words && e.size <= header.payload_words - e.offset;
+  });
+  if (!valid || !sourceMatches(source, header, abort)) {
+    munmap(data, file_size);
+    return false;
+  }
+
+  index_data_ = data;
+  index_size_ = file_size;
+  events.reserve(header.entry_count);
+  for (const IndexEntry &e : kj::arrayPtr(entries, header.entry_count)) {
+    auto which = (cereal::Event::Which)e.which;
+    if (which == cereal::Event::Which::SELFDRIVE_STATE) {
+      requires_migration = false;
+    }
+    if (!filters_.empty() && (which >= filters_.size() || !filters_[which])) continue;
+
+    auto event_data = kj::arrayPtr(payload + e.offset, e.size);
+    addEvent(which, e.mono_time, event_data);
+    if (isEncodeIdx(which)) {
+      capnp::FlatArrayMessageReader reader(event_data);
+      addFrameEvent(reader.getRoot<cereal::Event>(), e.mono_time, event_data);
+    }
+  }
+  return true;
+}
+
+size_t LogReader::parse(const capnp::word *data, size_t size, std::atomic<bool> *abort, uint64_t offset) {
+  kj::ArrayPtr<const capnp::word> words(data, size);
+  while (words.size() > 0 && !(abort && *abort)) {
+    // Stop at a message that is not complete yet
+    if (capnp::expectedSizeInWordsFromPrefix(words) > words.size()) break;
+
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    auto which = event.which();
+    auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
+    uint64_t mono_time = event.getLogMonoTime();
+    if (index_writer_) {
+      index_writer_->add(offset + (words.begin() - data), event_data.size(), which, mono_time);
+    }
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+    if (which == cereal::Event::Which::SELFDRIVE_STATE) {
+      requires_migration = false;
+    }
+
+    if (!filters_.empty()) {
+      if (which >= filters_.size() || !filters_[which])
+        continue;
+      auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
+      memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
+      event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+    }
+
+    addEvent(which, mono_time, event_data);
+    if (isEncodeIdx(which)) {
+      addFrameEvent(event, mono_time, event_data);
+    }
+  }
+  return words.begin() - data;
+}
+
+// Adds an encodeIdx packet again as a frame packet for the video stream
+void LogReader::addFrameEvent(const cereal::Event::Reader &event, uint64_t mono_time, const kj::ArrayPtr<const capnp::word> &data) {
+  auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+  if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+    uint64_t sof = idx.getTimestampSof();
+    addEvent(event.which(), sof ? sof : mono_time, data, idx.getSegmentNum());
+  }
+}
+
+void LogReader::addEvent(cereal::Event::Which which, uint64_t mono_time, const kj::ArrayPtr<const capnp::word> &data, int eidx_segnum) {
+  events.emplace_back(which, mono_time, data, eidx_segnum);
+}
+
+bool LogReader::finish(std::atomic<bool> *abort) {
   if (requires_migration) {
     migrateOldEvents();
   }
@@ -110,7 +379,7 @@ void LogReader::migrateOldEvents() {
 
       // Store the migrated event in the events list
       auto event_data = kj::arrayPtr(reinterpret_cast<const capnp::word *>(buf), buf_size);
-      events.emplace_back(new_evt.which(), new_evt.getLogMonoTime(), event_data);
+      addEvent(new_evt.which(), new_evt.getLogMonoTime(), event_data);
     }
   }
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -27,15 +28,35 @@ public:
 class LogReader {
 public:
   LogReader(const std::vector<bool> &filters = {}) { filters_ = filters; }
+  ~LogReader();
+  // Decompresses and parses the file as it is read. With filters only the events that pass are
+  // kept, so the whole decompressed log is never held at once. Without filters the events
+  // point into the decompressed log, which is kept in full. Remote files are still
+  // downloaded completely first.
+  // With index_cache, the decompressed log and its events are kept in an index next to the
+  // file cache, later loads of the unchanged file map the index instead of parsing.
   bool load(const std::string &url, std::atomic<bool> *abort = nullptr,
-            bool local_cache = false, int chunk_size = -1, int retries = 0);
+            bool local_cache = false, int chunk_size = -1, int retries = 0, bool index_cache = false);
   bool load(const char *data, size_t size, std::atomic<bool> *abort = nullptr);
   std::vector<Event> events;
 
 private:
+  class IndexWriter;
+
+  bool loadIndex(const std::string &index_file, const std::string &source, std::atomic<bool> *abort);
+  // offset is where data starts in the decompressed log, in words
+  size_t parse(const capnp::word *data, size_t size, std::atomic<bool> *abort, uint64_t offset = 0);
+  void addEvent(cereal::Event::Which which, uint64_t mono_time, const kj::ArrayPtr<const capnp::word> &data, int eidx_segnum = -1);
+  void addFrameEvent(const cereal::Event::Reader &event, uint64_t mono_time, const kj::ArrayPtr<const capnp::word> &data);
+  bool finish(std::atomic<bool> *abort);
   void migrateOldEvents();
 
-  std::string raw_;
+  // Decompressed data the events point into, when there are no filters
+  std::vector<std::unique_ptr<capnp::word[]>> blocks_;
+  // Mapped index the events point into, when it was loaded from the index cache
+  void *index_data_ = nullptr;
+  size_t index_size_ = 0;
+  std::unique_ptr<IndexWriter> index_writer_;
   bool requires_migration = true;
   std::vector<bool> filters_;
   MonotonicBuffer buffer_{1024 * 1024};
@@ -16,6 +16,9 @@ Options:
   -a, --allow        Whitelist of services to send (comma-separated)
   -b, --block        Blacklist of services to send (comma-separated)
   -c, --cache        Cache <n> segments in memory. Default is 5
+      --behind       Keep <n> of the cached segments before the current one. Default is half
+  -l, --loaders      Load <n> segments at the same time. Default is 3
+      --frame-cache  Cache <MB> of decoded video frames. Default is 256
   -s, --start        Start from <seconds>
   -x, --playback     Playback <speed>
       --demo         Use a demo route instead of providing your own
@@ -31,6 +34,9 @@ Options:
       --no-hw-decoder Disable HW video decoding
       --no-vipc      Do not output video
       --all          Output all messages including uiDebug, userBookmark
+      --index-cache  Keep parsed logs on disk to open them faster next time
+      --lockstep     Publish as fast as subscribers of these services (comma-separated)
+                     read each message, instead of in real time
   -h, --help         Show this help message
 )";
 
@@ -38,12 +44,16 @@ struct ReplayConfig {
   std::string route;
   std::vector<std::string> allow;
   std::vector<std::string> block;
+  std::vector<std::string> lockstep;
   std::string data_dir;
   std::string prefix;
   uint32_t flags = REPLAY_FLAG_NONE;
   bool auto_source = false;
   int start_seconds = 0;
   int cache_segments = -1;
+  int segments_behind = -1;
+  int loading_segments = -1;
+  int frame_cache_mb = -1;
   float playback_speed = -1;
 };
 
@@ -52,6 +62,9 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
       {"allow", required_argument, nullptr, 'a'},
       {"block", required_argument, nullptr, 'b'},
       {"cache", required_argument, nullptr, 'c'},
+      {"behind", required_argument, nullptr, 0},
+      {"loaders", required_argument, nullptr, 'l'},
+      {"frame-cache", required_argument, nullptr, 0},
       {"start", required_argument, nullptr, 's'},
       {"playback", required_argument, nullptr, 'x'},
       {"demo", no_argument, nullptr, 0},
@@ -66,6 +79,8 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
       {"no-hw-decoder", no_argument, nullptr, 0},
       {"no-vipc", no_argument, nullptr, 0},
       {"all", no_argument, nullptr, 0},
+      {"index-cache", no_argument, nullptr, 0},
+      {"lockstep", required_argument, nullptr, 0},
       {"help", no_argument, nullptr, 'h'},
       {nullptr, 0, nullptr, 0},  // Terminating entry
   };
@@ -79,6 +94,7 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
       {"no-hw-decoder", REPLAY_FLAG_NO_HW_DECODER},
       {"no-vipc", REPLAY_FLAG_NO_VIPC},
       {"all", REPLAY_FLAG_ALL_SERVICES},
+      {"index-cache", REPLAY_FLAG_INDEX_CACHE},
   };
 
   if (argc == 1) {
@@ -87,11 +103,12 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
   }
 
   int opt, option_index = 0;
-  while ((opt = getopt_long(argc, argv, "a:b:c:s:x:d:p:h", cli_options, &option_index)) != -1) {
+  while ((opt = getopt_long(argc, argv, "a:b:c:l:s:x:d:p:h", cli_options, &option_index)) != -1) {
     switch (opt) {
       case 'a': config.allow = split(optarg, ','); break;
       case 'b': config.block = split(optarg, ','); break;
       case 'c': config.cache_segments = std::atoi(optarg); break;
+      case 'l': config.loading_segments = std::atoi(optarg); break;
       case 's': config.start_seconds = std::atoi(optarg); break;
       case 'x': config.playback_speed = std::atof(optarg); break;
       case 'd': config.data_dir = optarg; break;
@@ -100,6 +117,9 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
         std::string name = cli_options[option_index].name;
         if (name == "demo") config.route = DEMO_ROUTE;
         else if (name == "auto") config.auto_source = true;
+        else if (name == "behind") config.segments_behind = std::atoi(optarg);
+        else if (name == "frame-cache") config.frame_cache_mb = std::atoi(optarg);
+        else if (name == "lockstep") config.lockstep = split(optarg, ',');
         else config.flags |= flag_map.at(name);
         break;
       }
@@ -118,6 +138,12 @@ bool parseArgs(int argc, char *argv[], ReplayConfig &config) {
     return false;
   }
 
+  // ZMQ publishers can't tell whether their subscribers read a message
+  if (!config.lockstep.empty() && messaging_use_zmq()) {
+    std::cerr << "--lockstep is not supported with ZMQ.\n";
+    return false;
+  }
+
   return true;
 }
 
@@ -138,10 +164,26 @@ int main(int argc, char *argv[]) {
     op_prefix = std::make_unique<OpenpilotPrefix>(config.prefix);
   }
 
+  if (!config.lockstep.empty()) {
+    config.flags |= REPLAY_FLAG_LOCKSTEP;
+  }
+
   Replay replay(config.route, config.allow, config.block, nullptr, config.flags, config.data_dir, config.auto_source);
   if (config.cache_segments > 0) {
     replay.setSegmentCacheLimit(config.cache_segments);
   }
+  if (config.segments_behind >= 0) {
+    replay.setSegmentsBehind(config.segments_behind);
+  }
+  if (config.loading_segments > 0) {
+    replay.setMaxLoadingSegments(config.loading_segments);
+  }
+  if (config.frame_cache_mb >= 0) {
+    FrameReader::setCacheSize((size_t)config.frame_cache_mb * 1024 * 1024);
+  }
+  if (!config.lockstep.empty()) {
+    replay.setLockstepServices(config.lockstep);
+  }
   if (config.playback_speed > 0) {
     replay.setSpeed(std::clamp(config.playback_speed, ConsoleUI::speed_array.front(), ConsoleUI::speed_array.back()));
   }
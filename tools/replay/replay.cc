@@ -2,6 +2,7 @@
 
 #include <capnp/dynamic.h>
 #include <csignal>
+#include <tuple>
 #include "cereal/services.h"
 #include "common/params.h"
 #include "tools/replay/util.h"
@@ -22,6 +23,10 @@ Replay::Replay(const std::string &route, std::vector<std::string> allow, std::ve
   if (!(flags_ & REPLAY_FLAG_ALL_SERVICES)) {
     block.insert(block.end(), {"uiDebug", "userBookmark"});
   }
+  // The CameraServer publishes visionipcStats of replay's own VisionIPC server
+  if (!(flags_ & REPLAY_FLAG_NO_VIPC)) {
+    block.push_back("visionipcStats");
+  }
   setupServices(allow, block);
   setupSegmentManager(!allow.empty() || !block.empty());
 }
@@ -46,6 +51,23 @@ void Replay::setupServices(const std::vector<std::string> &allow, const std::vec
   }
 }
 
+void Replay::setLockstepServices(const std::vector<std::string> &names) {
+  if (messaging_use_zmq()) {
+    rError("lockstep: not supported with ZMQ");
+    return;
+  }
+  auto event_schema = capnp::Schema::from<cereal::Event>().asStruct();
+  lockstep_sockets_.assign(sockets_.size(), false);
+  for (const auto &name : names) {
+    uint16_t which = services.count(name) ? event_schema.getFieldByName(name).getProto().getDiscriminantValue() : 0;
+    if (!sockets_[which]) {
+      rWarning("lockstep: %s is not a published service", name.c_str());
+      continue;
+    }
+    lockstep_sockets_[which] = true;
+  }
+}
+
 void Replay::setupSegmentManager(bool has_filters) {
   seg_mgr_->setCallback([this]() { handleSegmentMerge(); });
 
@@ -111,6 +133,7 @@ void Replay::seekTo(double seconds, bool relative) {
     cur_mono_time_ = route_start_ts_ + target_time * 1e9;
     cur_which_ = cereal::Event::Which::INIT_DATA;
     seeking_to_.store(target_time, std::memory_order_relaxed);
+    streamed_route_ns_ = streamed_wall_ns_ = 0;
     return false;
   });
 
@@ -258,24 +281,27 @@ void Replay::streamThread() {
     if (exit_) break;
 
     event_data_ = seg_mgr_->getEventData();
-    const auto &events = event_data_->events;
-    auto first = std::upper_bound(events.cbegin(), events.cend(), Event(cur_which_, cur_mono_time_, {}));
-    if (first == events.cend()) {
+    auto it = event_data_->upperBound(Event(cur_which_, cur_mono_time_, {}));
+    if (it.done()) {
       rInfo("waiting for events...");
       events_ready_ = false;
       continue;
     }
 
-    auto it = publishEvents(first, events.cend());
+    publishEvents(it);
 
     // Ensure frames are sent before unlocking to prevent race conditions
     if (camera_server_) {
       camera_server_->waitForSent();
     }
 
-    if (it == events.cend() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
-      int last_segment = seg_mgr_->route_.segments().rbegin()->first;
-      if (event_data_->isSegmentLoaded(last_segment)) {
+    int last_segment = seg_mgr_->route_.segments().rbegin()->first;
+    if (it.done() && event_data_->isSegmentLoaded(last_segment)) {
+      if (hasFlag(REPLAY_FLAG_LOCKSTEP)) {
+        rInfo("lockstep: %.1f s of route in %.1f s, %.1fx realtime", streamed_route_ns_ / 1e9,
+              streamed_wall_ns_ / 1e9, achieved_speed_.load());
+      }
+      if (!hasFlag(REPLAY_FLAG_NO_LOOP)) {
         rInfo("reaches the end of route, restart from beginning");
         stream_lock_.unlock();
         seekTo(minSeconds(), false);
@@ -285,19 +311,52 @@ void Replay::streamThread() {
   }
 }
 
-std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::const_iterator first,
-                                                         std::vector<Event>::const_iterator last) {
+void Replay::waitForReaders(const Event *e) {
+  const char *name = sockets_[e->which];
+  const uint64_t start = nanos_since_boot();
+  uint64_t warned = start;
+  while (!interrupt_requested_ && !pm_->allReadersUpdated(name)) {
+    const uint64_t now = nanos_since_boot();
+    if (now - warned > 1e9) {
+      rWarning("lockstep: waiting for subscribers of %s for %.1f s", name, (now - start) / 1e9);
+      warned = now;
+    }
+    // Fast consumers usually catch up within a few microseconds
+    if (now - start < 100e3) {
+      std::this_thread::yield();
+    } else {
+      precise_nano_sleep(100e3, interrupt_requested_);
+    }
+  }
+}
+
+void Replay::publishEvents(EventCursor &it) {
+  const bool lockstep = hasFlag(REPLAY_FLAG_LOCKSTEP);
   uint64_t evt_start_ts = cur_mono_time_;
   uint64_t loop_start_ts = nanos_since_boot();
   double prev_replay_speed = speed_;
 
-  for (; !interrupt_requested_ && first != last; ++first) {
-    const Event &evt = *first;
+  // Route and wall time covered by this call, added to the totals since the last seek
+  const uint64_t publish_start_mono_time = cur_mono_time_;
+  const uint64_t publish_start_ts = loop_start_ts;
+  auto update_achieved_speed = [&]() {
+    const uint64_t route_ns = streamed_route_ns_ + (cur_mono_time_ - publish_start_mono_time);
+    const uint64_t wall_ns = streamed_wall_ns_ + (nanos_since_boot() - publish_start_ts);
+    achieved_speed_ = wall_ns > 0 ? (double)route_ns / wall_ns : 0;
+    return std::pair{route_ns, wall_ns};
+  };
+
+  for (; !interrupt_requested_ && !it.done(); ++it) {
+    const Event &evt = *it;
 
     int segment = toSeconds(evt.mono_time) / 60;
     if (current_segment_.load(std::memory_order_relaxed) != segment) {
       current_segment_.store(segment, std::memory_order_relaxed);
       seg_mgr_->setCurrentSegment(segment);
+      if (lockstep) {
+        update_achieved_speed();
+        rInfo("lockstep: reached segment %d at %.1fx realtime", segment, achieved_speed_.load());
+      }
     }
 
     cur_mono_time_ = evt.mono_time;
@@ -306,31 +365,36 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
     // Skip events if socket is not present
     if (!sockets_[evt.which]) continue;
 
-    const uint64_t current_nanos = nanos_since_boot();
-    const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
-
-    // Reset timestamps for potential synchronization issues:
-    // - A negative time_diff may indicate slow execution or system wake-up,
-    // - A time_diff exceeding 1 second suggests a skipped segment.
-    if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
-      evt_start_ts = evt.mono_time;
-      loop_start_ts = current_nanos;
-      prev_replay_speed = speed_;
-    } else if (time_diff > 0) {
-      precise_nano_sleep(time_diff, interrupt_requested_);
+    if (!lockstep) {
+      const uint64_t current_nanos = nanos_since_boot();
+      const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
+
+      // Reset timestamps for potential synchronization issues:
+      // - A negative time_diff may indicate slow execution or system wake-up,
+      // - A time_diff exceeding 1 second suggests a skipped segment.
+      if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
+        evt_start_ts = evt.mono_time;
+        loop_start_ts = current_nanos;
+        prev_replay_speed = speed_;
+      } else if (time_diff > 0) {
+        precise_nano_sleep(time_diff, interrupt_requested_);
+      }
     }
 
     if (interrupt_requested_) break;
 
     if (evt.eidx_segnum == -1) {
       publishMessage(&evt);
+      // The in-process SubMaster is updated synchronously, sockets are acknowledged by their readers
+      if (lockstep && pm_ && lockstep_sockets_.size() > evt.which && lockstep_sockets_[evt.which] && sockets_[evt.which]) {
+        waitForReaders(&evt);
+      }
     } else if (camera_server_) {
-      if (speed_ > 1.0) {
+      if (speed_ > 1.0 || lockstep) {
         camera_server_->waitForSent();
       }
       publishFrame(&evt);
     }
   }
-
-  return first;
+  std::tie(streamed_route_ns_, streamed_wall_ns_) = update_achieved_speed();
 }
@@ -24,6 +24,8 @@ enum REPLAY_FLAGS {
   REPLAY_FLAG_NO_HW_DECODER = 0x0100,
   REPLAY_FLAG_NO_VIPC = 0x0400,
   REPLAY_FLAG_ALL_SERVICES = 0x0800,
+  REPLAY_FLAG_INDEX_CACHE = 0x1000,
+  REPLAY_FLAG_LOCKSTEP = 0x2000,
 };
 
 class Replay {
@@ -40,6 +42,12 @@ public:
   inline bool isPaused() const { return user_paused_; }
   inline int segmentCacheLimit() const { return seg_mgr_->segment_cache_limit_; }
   inline void setSegmentCacheLimit(int n) { seg_mgr_->segment_cache_limit_ = std::max(MIN_SEGMENTS_CACHE, n); }
+  inline void setSegmentsBehind(int n) { seg_mgr_->segments_behind_ = n; }
+  inline void setMaxLoadingSegments(int n) { seg_mgr_->max_loading_segments_ = std::max(1, n); }
+  // In lockstep mode, wait for every subscriber of these services to read each message before
+  // publishing the next event. Replay waits for the read, not for the work the subscriber does
+  // with it, see the README for which subscribers get the same result on every run. Call before start().
+  void setLockstepServices(const std::vector<std::string> &names);
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
   void setLoop(bool loop) { loop ? flags_ &= ~REPLAY_FLAG_NO_LOOP : flags_ |= REPLAY_FLAG_NO_LOOP; }
   bool loop() const { return !(flags_ & REPLAY_FLAG_NO_LOOP); }
@@ -52,6 +60,8 @@ public:
   inline double maxSeconds() const { return max_seconds_; }
   inline void setSpeed(float speed) { speed_ = speed; }
   inline float getSpeed() const { return speed_; }
+  // Route seconds published per wall clock second since the stream last started or seeked
+  inline double achievedSpeed() const { return achieved_speed_; }
   inline const std::string &carFingerprint() const { return car_fingerprint_; }
   inline const std::shared_ptr<std::vector<Timeline::Entry>> getTimeline() const { return timeline_.getEntries(); }
   inline const std::optional<Timeline::Entry> findAlertAtTime(double sec) const { return timeline_.findAlertAtTime(sec); }
@@ -71,10 +81,10 @@ private:
   void streamThread();
   void handleSegmentMerge();
   void interruptStream(const std::function<bool()>& update_fn);
-  std::vector<Event>::const_iterator publishEvents(std::vector<Event>::const_iterator first,
-                                                   std::vector<Event>::const_iterator last);
+  void publishEvents(EventCursor &it);
   void publishMessage(const Event *e);
   void publishFrame(const Event *e);
+  void waitForReaders(const Event *e);
   void checkSeekProgress();
 
   std::unique_ptr<SegmentManager> seg_mgr_;
@@ -99,11 +109,15 @@ private:
   SubMaster *sm_ = nullptr;
   std::unique_ptr<PubMaster> pm_;
   std::vector<const char*> sockets_;
+  std::vector<bool> lockstep_sockets_;
   std::unique_ptr<CameraServer> camera_server_;
   std::atomic<uint32_t> flags_ = REPLAY_FLAG_NONE;
 
   std::string car_fingerprint_;
   std::atomic<float> speed_ = 1.0;
+  std::atomic<double> achieved_speed_ = 0;
+  uint64_t streamed_route_ns_ = 0;
+  uint64_t streamed_wall_ns_ = 0;
   std::function<bool(const Event *)> event_filter_ = nullptr;
 
   std::shared_ptr<SegmentManager::EventData> event_data_ = std::make_shared<SegmentManager::EventData>();
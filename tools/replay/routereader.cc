@@ -0,0 +1,186 @@
+#include "tools/replay/routereader.h"
+
+#include <utility>
+
+#include <capnp/dynamic.h>
+
+#include "cereal/services.h"
+#include "tools/replay/util.h"
+
+RouteReader::RouteReader(const std::string &route, const std::vector<std::string> &allow, uint32_t flags,
+                         const std::string &data_dir)
+    : route_(route, data_dir), flags_(flags) {
+  const bool frames = !(flags & REPLAY_FLAG_NO_VIPC);
+  cameras_[RoadCam] = frames;
+  cameras_[DriverCam] = frames && (flags & REPLAY_FLAG_DCAM);
+  cameras_[WideRoadCam] = frames && (flags & REPLAY_FLAG_ECAM);
+
+  auto event_schema = capnp::Schema::from<cereal::Event>().asStruct();
+  services_.assign(event_schema.getUnionFields().size(), allow.empty());
+  for (const auto &name : allow) {
+    if (services.count(name) == 0) {
+      rWarning("unknown service %s", name.c_str());
+      continue;
+    }
+    services_[event_schema.getFieldByName(name).getProto().getDiscriminantValue()] = true;
+  }
+
+  // Without filters, the LogReader keeps the decompressed log instead of copying every event
+  if (!allow.empty()) {
+    filters_ = services_;
+    filters_[cereal::Event::ROAD_ENCODE_IDX] = filters_[cereal::Event::ROAD_ENCODE_IDX] || cameras_[RoadCam];
+    filters_[cereal::Event::DRIVER_ENCODE_IDX] = filters_[cereal::Event::DRIVER_ENCODE_IDX] || cameras_[DriverCam];
+    filters_[cereal::Event::WIDE_ROAD_ENCODE_IDX] = filters_[cereal::Event::WIDE_ROAD_ENCODE_IDX] || cameras_[WideRoadCam];
+  }
+}
+
+RouteReader::~RouteReader() {
+  for (auto &buf : frame_bufs_) {
+    if (buf.addr) buf.free();
+  }
+}
+
+bool RouteReader::load() {
+  if (!route_.load()) {
+    rError("failed to load route: %s", route_.name().c_str());
+    return false;
+  }
+  next_segment_ = route_.segments().cbegin();
+  return true;
+}
+
+bool RouteReader::loadNextSegment() {
+  while (next_segment_ != route_.segments().cend()) {
+    const auto &[n, files] = *next_segment_++;
+    const bool local_cache = !(flags_ & REPLAY_FLAG_NO_FILE_CACHE);
+    SegmentData segment{n, std::make_unique<LogReader>(filters_)};
+    bool success = segment.log->load(files.rlog.empty() ? files.qlog : files.rlog, nullptr, local_cache, 0, 3,
+                                     flags_ & REPLAY_FLAG_INDEX_CACHE);
+
+    // [RoadCam, DriverCam, WideRoadCam], fallback to qcamera like Segment
+    const std::string camera_files[] = {
+        (flags_ & REPLAY_FLAG_QCAMERA) || files.road_cam.empty() ? files.qcamera : files.road_cam,
+        files.driver_cam,
+        files.wide_road_cam,
+    };
+    for (auto cam : ALL_CAMERAS) {
+      if (success && cameras_[cam] && !camera_files[cam].empty()) {
+        auto &fr = segment.frames[cam] = std::make_unique<FrameReader>();
+        fr->cache = false;  // Frames are read once and in order, on the calling thread only
+        success = fr->load(cam, camera_files[cam], flags_ & REPLAY_FLAG_NO_HW_DECODER, nullptr, local_cache, 20 * 1024 * 1024, 3);
+      }
+    }
+
+    if (success) {
+      segments_.push_back(std::move(segment));
+      return true;
+    }
+    rWarning("failed to load segment %d, skipping it", n);
+  }
+  return false;
+}
+
+void RouteReader::resetCursor(const Event &after) {
+  runs_.clear();
+  for (const auto &segment : segments_) {
+    const auto &events = segment.log->events;
+    runs_.emplace_back(events.data(), events.data() + events.size());
+  }
+  cursor_.emplace(runs_, after);
+}
+
+// The front segment is done once all of its events were read. Until then, the next segment
+// is loaded as well, its first events may be earlier than the last ones of the front segment.
+bool RouteReader::frontSegmentDone() const {
+  const auto &events = segments_.front().log->events;
+  return events.empty() || cursor_->done() || events.back() < **cursor_;
+}
+
+bool RouteReader::wanted(const Event &e) const {
+  if (e.eidx_segnum >= 0) {
+    switch (e.which) {
+      case cereal::Event::ROAD_ENCODE_IDX: return cameras_[RoadCam];
+      case cereal::Event::DRIVER_ENCODE_IDX: return cameras_[DriverCam];
+      case cereal::Event::WIDE_ROAD_ENCODE_IDX: return cameras_[WideRoadCam];
+      default: return false;
+    }
+  }
+  return e.which < services_.size() && services_[e.which];
+}
+
+bool RouteReader::next() {
+  reader_.reset();
+  if (!cursor_) {
+    while (segments_.size() < 2 && loadNextSegment()) {}
+    resetCursor(last_);
+  } else if (!cursor_->done()) {
+    ++*cursor_;
+  }
+
+  while (!segments_.empty()) {
+    if (frontSegmentDone()) {
+      segments_.pop_front();
+      while (segments_.size() < 2 && loadNextSegment()) {}
+      resetCursor(last_);
+      continue;
+    }
+    if (!wanted(**cursor_)) {
+      ++*cursor_;
+      continue;
+    }
+
+    last_ = **cursor_;
+    const Event *e = &**cursor_;
+    for (const auto &segment : segments_) {
+      const auto &events = segment.log->events;
+      if (e >= events.data() && e < events.data() + events.size()) {
+        segment_ = segment.seg_num;
+        break;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+cereal::Event::Reader RouteReader::get() {
+  if (!reader_) {
+    reader_.emplace(event().data);
+  }
+  return reader_->getRoot<cereal::Event>();
+}
+
+const VisionBuf *RouteReader::frame() {
+  const Event &e = event();
+  CameraType cam;
+  switch (e.which) {
+    case cereal::Event::ROAD_ENCODE_IDX: cam = RoadCam; break;
+    case cereal::Event::DRIVER_ENCODE_IDX: cam = DriverCam; break;
+    case cereal::Event::WIDE_ROAD_ENCODE_IDX: cam = WideRoadCam; break;
+    default: return nullptr;
+  }
+  if (e.eidx_segnum < 0) return nullptr;
+
+  FrameReader *fr = nullptr;
+  for (const auto &segment : segments_) {
+    if (segment.seg_num == e.eidx_segnum) fr = segment.frames[cam].get();
+  }
+  if (!fr) return nullptr;
+
+  VisionBuf &buf = frame_bufs_[cam];
+  if (frame_sizes_[cam] != std::pair{fr->width, fr->height}) {
+    if (buf.addr) buf.free();
+    auto [nv12_width, nv12_height, nv12_buffer_size] = get_nv12_info(fr->width, fr->height);
+    buf.allocate(nv12_buffer_size);
+    buf.init_yuv(fr->width, fr->height, nv12_width, nv12_width * nv12_height);
+    frame_sizes_[cam] = {fr->width, fr->height};
+  }
+
+  auto eidx = capnp::AnyStruct::Reader(get()).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+  if (!fr->get(eidx.getSegmentId(), &buf)) {
+    rError("camera[%d] failed to get frame: %u", cam, eidx.getSegmentId());
+    return nullptr;
+  }
+  buf.set_frame_id(eidx.getFrameId());
+  return &buf;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "msgq/visionipc/visionbuf.h"
+#include "tools/replay/replay.h"
+
+// Reads the events of a route in time order on the calling thread, for offline analysis tools.
+// Unlike Replay nothing is published: there are no sockets, no VisionIPC server, no Params
+// writes and no threads per file or camera. Segments are loaded one after another as reading
+// gets to them, only the current and the next one are kept in memory.
+//
+//   RouteReader reader(route, {"carState"});
+//   if (!reader.load()) return;
+//   while (reader.next()) {
+//     auto car_state = reader.get().getCarState();
+//   }
+class RouteReader {
+public:
+  // Only events of the allowed services are read, all of them if empty. Frames are read like
+  // Replay loads them: road camera unless REPLAY_FLAG_NO_VIPC, driver and wide road camera
+  // with REPLAY_FLAG_DCAM and REPLAY_FLAG_ECAM.
+  RouteReader(const std::string &route, const std::vector<std::string> &allow = {},
+              uint32_t flags = REPLAY_FLAG_NO_VIPC, const std::string &data_dir = "");
+  ~RouteReader();
+  bool load();
+  const Route &route() const { return route_; }
+  // Steps to the next event, false at the end of the route. Segments that fail to load are skipped.
+  bool next();
+  // The current event, its data is valid until the next call to next()
+  const Event &event() const { return **cursor_; }
+  cereal::Event::Reader get();
+  int segment() const { return segment_; }
+  // With a frame event (eidx_segnum >= 0) of a camera that is read, decodes its frame as
+  // NV12 into a buffer owned by the reader, valid until the next call to frame(). Frames
+  // bypass the frame cache of replay.
+  const VisionBuf *frame();
+
+private:
+  struct SegmentData {
+    int seg_num;
+    std::unique_ptr<LogReader> log;
+    std::unique_ptr<FrameReader> frames[MAX_CAMERAS] = {};
+  };
+
+  bool loadNextSegment();
+  void resetCursor(const Event &after);
+  bool frontSegmentDone() const;
+  bool wanted(const Event &e) const;
+
+  Route route_;
+  uint32_t flags_;
+  std::vector<bool> services_;  // Message events to read, indexed by which
+  std::vector<bool> filters_;   // What the LogReader keeps, services_ and encodeIdx of the read cameras
+  bool cameras_[MAX_CAMERAS] = {};
+
+  std::map<int, SegmentFile>::const_iterator next_segment_;
+  std::deque<SegmentData> segments_;
+  std::vector<EventCursor::Run> runs_;
+  std::optional<EventCursor> cursor_;
+  Event last_{cereal::Event::Which::INIT_DATA, 0, {}};
+  int segment_ = -1;
+
+  std::optional<capnp::FlatArrayMessageReader> reader_;
+  VisionBuf frame_bufs_[MAX_CAMERAS] = {};
+  std::pair<int, int> frame_sizes_[MAX_CAMERAS] = {};
+};
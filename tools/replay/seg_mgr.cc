@@ -2,6 +2,46 @@
 
 #include <algorithm>
 
+namespace {
+
+// Heap order for EventCursor, the run with the earliest next event on top
+bool laterRun(const EventCursor::Run &a, const EventCursor::Run &b) {
+  return *b.first < *a.first;
+}
+
+}  // namespace
+
+EventCursor::EventCursor(const std::vector<Run> &runs, const Event &after) {
+  for (const auto &[begin, end] : runs) {
+    if (auto it = std::upper_bound(begin, end, after); it != end) {
+      heap_.emplace_back(it, end);
+    }
+  }
+  std::make_heap(heap_.begin(), heap_.end(), laterRun);
+  popEarliest();
+}
+
+EventCursor &EventCursor::operator++() {
+  if (++cur_.first == cur_.second) {
+    cur_ = {};
+    popEarliest();
+  } else if (!heap_.empty() && *heap_.front().first < *cur_.first) {
+    // Another run continues before this one
+    heap_.push_back(cur_);
+    std::push_heap(heap_.begin(), heap_.end(), laterRun);
+    popEarliest();
+  }
+  return *this;
+}
+
+void EventCursor::popEarliest() {
+  if (!heap_.empty()) {
+    std::pop_heap(heap_.begin(), heap_.end(), laterRun);
+    cur_ = heap_.back();
+    heap_.pop_back();
+  }
+}
+
 SegmentManager::~SegmentManager() {
   {
     std::unique_lock lock(mutex_);
@@ -55,7 +95,8 @@ void SegmentManager::manageSegmentCache() {
     if (cur == segments_.end()) continue;
 
     // Calculate the range of segments to load
-    auto begin = std::prev(cur, std::min<int>(segment_cache_limit_ / 2, std::distance(segments_.begin(), cur)));
+    int behind = std::clamp(segments_behind_ < 0 ? segment_cache_limit_ / 2 : segments_behind_, 0, segment_cache_limit_ - 1);
+    auto begin = std::prev(cur, std::min<int>(behind, std::distance(segments_.begin(), cur)));
     auto end = std::next(begin, std::min<int>(segment_cache_limit_, std::distance(begin, segments_.end())));
     begin = std::prev(end, std::min<int>(segment_cache_limit_, std::distance(segments_.begin(), end)));
 
@@ -64,7 +105,8 @@ void SegmentManager::manageSegmentCache() {
     loadSegmentsInRange(begin, cur, end);
     bool merged = mergeSegments(begin, end);
 
-    // Free segments outside the current range
+    // Free segments outside the current range. This also aborts segments that are still
+    // loading but no longer needed after a seek.
     std::for_each(segments_.begin(), begin, [](auto &segment) { segment.second.reset(); });
     std::for_each(end, segments_.end(), [](auto &segment) { segment.second.reset(); });
 
@@ -76,33 +118,26 @@ void SegmentManager::manageSegmentCache() {
 
 bool SegmentManager::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
   std::set<int> segments_to_merge;
-  size_t total_event_count = 0;
   for (auto it = begin; it != end; ++it) {
     const auto &segment = it->second;
     if (segment && segment->getState() == Segment::LoadState::Loaded) {
       segments_to_merge.insert(segment->seg_num);
-      total_event_count += segment->log->events.size();
     }
   }
 
   if (segments_to_merge == merged_segments_) return false;
 
+  // The events stay in their segments, merging only collects the runs. EventCursor
+  // interleaves them while streaming.
   auto merged_event_data = std::make_shared<EventData>();
-  auto &merged_events = merged_event_data->events;
-  merged_events.reserve(total_event_count);
-
   rDebug("merging segments: %s", join(segments_to_merge, ", ").c_str());
   for (int n : segments_to_merge) {
     const auto &events = segments_.at(n)->log->events;
     if (events.empty()) continue;
 
     // Skip INIT_DATA if present
-    auto events_begin = (events.front().which == cereal::Event::Which::INIT_DATA) ? std::next(events.begin()) : events.begin();
-
-    size_t previous_size = merged_events.size();
-    merged_events.insert(merged_events.end(), events_begin, events.end());
-    std::inplace_merge(merged_events.begin(), merged_events.begin() + previous_size, merged_events.end());
-
+    const Event *events_begin = events.data() + (events.front().which == cereal::Event::Which::INIT_DATA ? 1 : 0);
+    merged_event_data->runs.emplace_back(events_begin, events.data() + events.size());
     merged_event_data->segments[n] = segments_.at(n);
   }
 
@@ -112,29 +147,30 @@ bool SegmentManager::mergeSegments(const SegmentMap::iterator &begin, const Segm
   return true;
 }
 
+// Starts loading the segments of the range in priority order, the current segment first,
+// then the ones ahead of it, then the ones behind it. At most max_loading_segments_ are
+// loading at a time.
 void SegmentManager::loadSegmentsInRange(SegmentMap::iterator begin, SegmentMap::iterator cur, SegmentMap::iterator end) {
-  auto tryLoadSegment = [this](auto first, auto last) {
-    for (auto it = first; it != last; ++it) {
-      auto &segment_ptr = it->second;
-      if (!segment_ptr) {
-        segment_ptr = std::make_shared<Segment>(
-            it->first, route_.at(it->first), flags_, filters_,
-            [this](int seg_num, bool success) {
-              std::unique_lock lock(mutex_);
-              needs_update_ = true;
-              cv_.notify_one();
-            });
-      }
-
-      if (segment_ptr->getState() == Segment::LoadState::Loading) {
-        return true;  // Segment is still loading
-      }
+  std::vector<SegmentMap::iterator> order;
+  for (auto it = cur; it != end; ++it) order.push_back(it);
+  for (auto it = cur; it != begin;) order.push_back(--it);
+
+  int loading = std::count_if(order.begin(), order.end(), [](auto it) {
+    return it->second && it->second->getState() == Segment::LoadState::Loading;
+  });
+  const int max_loading = std::max(1, max_loading_segments_);
+  for (auto it : order) {
+    if (loading >= max_loading) break;
+
+    if (!it->second) {
+      it->second = std::make_shared<Segment>(
+          it->first, route_.at(it->first), flags_, filters_,
+          [this](int seg_num, bool success) {
+            std::unique_lock lock(mutex_);
+            needs_update_ = true;
+            cv_.notify_one();
+          });
+      ++loading;
     }
-    return false;  // No segments need loading
-  };
-
-  // Try forward loading, then reverse if necessary
-  if (!tryLoadSegment(cur, end)) {
-    tryLoadSegment(std::make_reverse_iterator(cur), std::make_reverse_iterator(begin));
   }
 }
@@ -4,20 +4,42 @@
 #include <map>
 #include <mutex>
 #include <set>
+#include <utility>
 #include <vector>
 
 #include "tools/replay/route.h"
 
 constexpr int MIN_SEGMENTS_CACHE = 5;
+constexpr int MAX_LOADING_SEGMENTS = 3;
 
 using SegmentMap = std::map<int, std::shared_ptr<Segment>>;
 
+// Walks the sorted event runs of several segments in time order (k-way merge). Segments
+// rarely overlap, so stepping usually costs a single comparison.
+class EventCursor {
+public:
+  using Run = std::pair<const Event *, const Event *>;
+  // Starts at the first event after `after`
+  EventCursor(const std::vector<Run> &runs, const Event &after);
+  inline bool done() const { return cur_.first == cur_.second; }
+  inline const Event &operator*() const { return *cur_.first; }
+  inline const Event *operator->() const { return cur_.first; }
+  EventCursor &operator++();
+
+private:
+  void popEarliest();
+
+  Run cur_ = {};
+  std::vector<Run> heap_;  // the other runs, earliest first
+};
+
 class SegmentManager {
 public:
   struct EventData {
-    std::vector<Event> events;  //  Events extracted from the segments
-    SegmentMap segments;        // Associated segments that contributed to these events
+    std::vector<EventCursor::Run> runs;  // Sorted events of each segment, they are not copied
+    SegmentMap segments;                 // Associated segments that own these events
     bool isSegmentLoaded(int n) const { return segments.find(n) != segments.end(); }
+    EventCursor upperBound(const Event &e) const { return EventCursor(runs, e); }
   };
 
   SegmentManager(const std::string &route_name, uint32_t flags, const std::string &data_dir = "", bool auto_source = false)
@@ -33,6 +55,8 @@ public:
 
   Route route_;
   int segment_cache_limit_ = MIN_SEGMENTS_CACHE;
+  int segments_behind_ = -1;  // Segments of the cache before the current one, half of it if negative
+  int max_loading_segments_ = MAX_LOADING_SEGMENTS;
 
 private:
   void manageSegmentCache();
@@ -1,6 +1,14 @@
 #define CATCH_CONFIG_MAIN
+#include <unistd.h>
+#include <zstd.h>
+
+#include <cstring>
+#include <fstream>
+
 #include "catch2/catch.hpp"
+#include "common/util.h"
 #include "tools/replay/replay.h"
+#include "tools/replay/routereader.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
 
@@ -14,4 +22,95 @@ TEST_CASE("LogReader") {
     REQUIRE(log.load(corrupt_content.data(), corrupt_content.size()));
     REQUIRE(log.events.size() > 0);
   }
+
+  SECTION("index cache") {
+    const std::string rlog = "/tmp/test_replay_index_rlog.bz2";
+    std::string content = FileReader(true).read(TEST_RLOG_URL);
+    std::ofstream(rlog, std::ios::binary).write(content.data(), content.size());
+    const std::string index_file = cacheFilePath(rlog) + ".idx";
+    unlink(index_file.c_str());
+
+    LogReader cold;
+    REQUIRE(cold.load(rlog, nullptr, false, -1, 0, true));
+    REQUIRE(util::file_exists(index_file));
+
+    LogReader warm;
+    REQUIRE(warm.load(rlog, nullptr, false, -1, 0, true));
+    REQUIRE(warm.events.size() == cold.events.size());
+    for (size_t i = 0; i < cold.events.size(); ++i) {
+      const Event &a = cold.events[i], &b = warm.events[i];
+      REQUIRE(a.which == b.which);
+      REQUIRE(a.mono_time == b.mono_time);
+      REQUIRE(a.eidx_segnum == b.eidx_segnum);
+      REQUIRE(a.data.size() == b.data.size());
+      REQUIRE(memcmp(a.data.begin(), b.data.begin(), a.data.size() * sizeof(capnp::word)) == 0);
+    }
+
+    // The index is not used for a changed file
+    content.resize(content.size() / 2);
+    std::ofstream(rlog, std::ios::binary).write(content.data(), content.size());
+    LogReader changed;
+    REQUIRE(changed.load(rlog, nullptr, false, -1, 0, true));
+    REQUIRE(changed.events.size() > 0);
+    REQUIRE(changed.events.size() < cold.events.size());
+
+    unlink(index_file.c_str());
+    unlink(rlog.c_str());
+  }
+}
+
+TEST_CASE("RouteReader") {
+  // Three segments of carState and can at 100Hz, offset by 1ms from each other. The last
+  // events of each segment are later than the first ones of the next
+  const std::string dir = "/tmp/test_replay_route_reader";
+  const int segments = 3;
+  size_t car_state_count = 0, total = 0;
+  for (int n = 0; n < segments; ++n) {
+    std::string raw;
+    for (uint64_t t = n * 60e9 + n * 1e6; t < (n + 1) * 60e9 + 50e6; t += 10e6, ++total) {
+      MessageBuilder msg;
+      auto evt = msg.initEvent();
+      evt.setLogMonoTime(1e9 + t);
+      if (total % 2 == 0) {
+        evt.initCarState().setVEgo(n);
+        ++car_state_count;
+      } else {
+        evt.initCan(1);
+      }
+      auto bytes = msg.toBytes();
+      raw.append((const char *)bytes.begin(), bytes.size());
+    }
+    std::string zst(ZSTD_compressBound(raw.size()), '\0');
+    zst.resize(ZSTD_compress(zst.data(), zst.size(), raw.data(), raw.size(), 1));
+    const std::string segment_dir = dir + "/2024-01-01--00-00-00--" + std::to_string(n);
+    REQUIRE(util::create_directories(segment_dir, 0755));
+    std::ofstream(segment_dir + "/rlog.zst", std::ios::binary).write(zst.data(), zst.size());
+  }
+
+  const std::string route = "0123456789abcdef|2024-01-01--00-00-00";
+  SECTION("all events in time order") {
+    RouteReader reader(route, {}, REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_NO_FILE_CACHE, dir);
+    REQUIRE(reader.load());
+    size_t count = 0;
+    uint64_t prev = 0;
+    while (reader.next()) {
+      REQUIRE(reader.event().mono_time >= prev);
+      REQUIRE(reader.get().getLogMonoTime() == reader.event().mono_time);
+      prev = reader.event().mono_time;
+      ++count;
+    }
+    REQUIRE(count == total);
+  }
+
+  SECTION("allowed services") {
+    RouteReader reader(route, {"carState"}, REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_NO_FILE_CACHE, dir);
+    REQUIRE(reader.load());
+    size_t count = 0;
+    while (reader.next()) {
+      REQUIRE(reader.event().which == cereal::Event::CAR_STATE);
+      REQUIRE(reader.get().getCarState().getVEgo() == reader.segment());
+      ++count;
+    }
+    REQUIRE(count == car_state_count);
+  }
 }
@@ -362,6 +362,88 @@ std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool>
   return {};
 }
 
+struct StreamDecompressor::State {
+  bz_stream bz = {};
+  bool bz_end = false;
+  ZSTD_DCtx *zst = nullptr;
+};
+
+StreamDecompressor::Format StreamDecompressor::detect(const std::string &url, const char *data, size_t size) {
+  std::string_view magic(data, std::min<size_t>(size, 4));
+  if (url.find(".bz2") != std::string::npos || magic == "BZh9") {
+    return Format::BZ2;
+  } else if (url.find(".zst") != std::string::npos || magic == std::string_view("\x28\xB5\x2F\xFD", 4)) {
+    return Format::ZST;
+  }
+  return Format::None;
+}
+
+StreamDecompressor::StreamDecompressor(Format format) : format_(format), state_(std::make_unique<State>()) {
+  if (format_ == Format::BZ2) {
+    int bzerror = BZ2_bzDecompressInit(&state_->bz, 0, 0);
+    assert(bzerror == BZ_OK);
+  } else if (format_ == Format::ZST) {
+    state_->zst = ZSTD_createDCtx();
+    assert(state_->zst != nullptr);
+  }
+  if (format_ != Format::None) {
+    out_.resize(1024 * 1024);
+  }
+}
+
+StreamDecompressor::~StreamDecompressor() {
+  if (format_ == Format::BZ2) {
+    BZ2_bzDecompressEnd(&state_->bz);
+  } else if (format_ == Format::ZST) {
+    ZSTD_freeDCtx(state_->zst);
+  }
+}
+
+bool StreamDecompressor::feed(const char *in, size_t size, const std::function<bool(const char *, size_t)> &on_output) {
+  if (format_ == Format::None) {
+    return on_output(in, size);
+  }
+
+  if (format_ == Format::BZ2) {
+    // Anything after the end of the stream is ignored, like decompressBZ2 does
+    if (state_->bz_end) return true;
+    bz_stream &strm = state_->bz;
+    strm.next_in = (char *)in;
+    strm.avail_in = size;
+    // A full output buffer means that bzip2 may have more output for the same input
+    do {
+      strm.next_out = out_.data();
+      strm.avail_out = out_.size();
+      unsigned int prev_avail_in = strm.avail_in;
+      int bzerror = BZ2_bzDecompress(&strm);
+      size_t out_size = out_.size() - strm.avail_out;
+      if (out_size > 0 && !on_output(out_.data(), out_size)) return false;
+      if (bzerror == BZ_STREAM_END) {
+        state_->bz_end = true;
+        return true;
+      }
+      if (bzerror != BZ_OK || (out_size == 0 && prev_avail_in == strm.avail_in)) {
+        rWarning("decompressBZ2 error: content is corrupt");
+        return false;
+      }
+    } while (strm.avail_in > 0 || strm.avail_out == 0);
+    return true;
+  }
+
+  ZSTD_inBuffer input = {in, size, 0};
+  while (true) {
+    ZSTD_outBuffer output = {out_.data(), out_.size(), 0};
+    size_t result = ZSTD_decompressStream(state_->zst, &output, &input);
+    if (ZSTD_isError(result)) {
+      rWarning("decompressZST error: content is corrupt");
+      return false;
+    }
+    if (output.pos > 0 && !on_output(out_.data(), output.pos)) return false;
+    // Done once all input is consumed and zstd had room left to flush into
+    if (input.pos == input.size && output.pos < output.size) return true;
+  }
+}
+
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &interrupt_requested) {
   struct timespec req, rem;
   req.tv_sec = nanoseconds / 1000000000;
@@ -3,6 +3,7 @@
 #include <atomic>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -52,6 +53,26 @@ std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort = null
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
+
+// Decompresses bz2 or zstd data that arrives in pieces, without holding all of it
+class StreamDecompressor {
+public:
+  enum class Format { None, BZ2, ZST };
+  // Guesses the format from the file name or the first bytes of the file
+  static Format detect(const std::string &url, const char *data, size_t size);
+
+  StreamDecompressor(Format format);
+  ~StreamDecompressor();
+  // Passes the output for in to on_output in pieces. Returns false if the input is
+  // corrupt or on_output returned false.
+  bool feed(const char *in, size_t size, const std::function<bool(const char *, size_t)> &on_output);
+
+private:
+  struct State;
+  Format format_;
+  std::unique_ptr<State> state_;
+  std::string out_;
+};
 std::string getUrlWithoutQuery(const std::string &url);
 size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort = nullptr);
 std::string httpGet(const std::string &url, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);